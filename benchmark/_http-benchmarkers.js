@@ -1,6 +1,9 @@
 'use strict';
 
 const child_process = require('child_process');
+const fs = require('fs');
+const os = require('os');
+const path = require('path');
 
 // The port used by servers and wrk
 exports.PORT = process.env.PORT || 12346;
@@ -59,6 +62,57 @@ WrkBenchmarker.prototype.processResults = function(output) {
   }
 };
 
+// h2load, from nghttp2, speaks prior-knowledge h2c to http:// URLs
+function H2LoadBenchmarker() {
+  this.name = 'h2load';
+  this.regexp = /finished in [0-9\.]+m?s, ([0-9\.]+) req\/s/;
+  const result = child_process.spawnSync('h2load', ['--version']);
+  this.present = !(result.error && result.error.code === 'ENOENT');
+}
+
+// Returns why h2load cannot run a benchmark with options, if it cannot
+H2LoadBenchmarker.prototype.check = function(options) {
+  if (options.push)
+    return 'h2load does not accept pushed streams';
+  // h2load takes the window as a number of bits
+  if (options.window && (options.window & (options.window + 1)) !== 0)
+    return `h2load does not support a window of ${options.window} bytes, ` +
+           'only of 2^n - 1 bytes';
+};
+
+H2LoadBenchmarker.prototype.create = function(options) {
+  const args = ['-D', options.duration, '-c', options.connections,
+                '-m', options.streams || 1];
+  if (options.window) {
+    const bits = Math.log2(options.window + 1);
+    args.push('-w', bits, '-W', bits);
+  }
+  for (var n = 0; n < (options.headers || 0); n++)
+    args.push('-H', `x-header-${n}: value-${n}`);
+  // Requests with a body are POSTed from a file
+  var file;
+  if (options.body) {
+    file = path.join(os.tmpdir(), `node-benchmark-h2load-${process.pid}`);
+    fs.writeFileSync(file, Buffer.alloc(options.body, 'x'));
+    args.push('-d', file);
+  }
+  args.push(`http://127.0.0.1:${options.port}${options.path}`);
+  const child = child_process.spawn('h2load', args);
+  if (file !== undefined)
+    child.once('close', () => fs.unlinkSync(file));
+  return child;
+};
+
+H2LoadBenchmarker.prototype.processResults = function(output) {
+  const match = output.match(this.regexp);
+  const result = match && +match[1];
+  if (!result) {
+    return undefined;
+  } else {
+    return result;
+  }
+};
+
 const http_benchmarkers = [ new WrkBenchmarker(),
                             new AutocannonBenchmarker() ];
 
@@ -71,6 +125,10 @@ http_benchmarkers.forEach((benchmarker) => {
   }
 });
 
+// h2load only speaks HTTP/2, so it is never the default
+const h2load = new H2LoadBenchmarker();
+benchmarkers[h2load.name] = h2load;
+
 exports.run = function(options, callback) {
   options = Object.assign({
     port: exports.PORT,
@@ -97,6 +155,12 @@ exports.run = function(options, callback) {
     return;
   }
 
+  const unsupported = benchmarker.check && benchmarker.check(options);
+  if (unsupported) {
+    callback(new Error(unsupported));
+    return;
+  }
+
   const benchmarker_start = process.hrtime();
 
   const child = benchmarker.create(options);
@@ -116,6 +116,44 @@ Benchmark.prototype.http = function(options, cb) {
   });
 };
 
+// Benchmark an HTTP/2 server. The load generator in http2/_h2c_load.js is
+// used unless h2load is requested, as other benchmarkers only speak HTTP/1.
+Benchmark.prototype.http2 = function(options, cb) {
+  const self = this;
+  const benchmarker = self.config.benchmarker ||
+                      self.extra_options.benchmarker ||
+                      'h2c-load';
+  if (benchmarker === 'h2load') {
+    self.http(Object.assign({ benchmarker: benchmarker }, options), cb);
+    return;
+  }
+  if (benchmarker !== 'h2c-load') {
+    if (cb) {
+      cb(1);
+    }
+    console.error(`Requested benchmarker '${benchmarker}' does not support ` +
+                  'HTTP/2. Use h2c-load or h2load.');
+    process.exit(1);
+  }
+  const load = require('./http2/_h2c_load.js');
+  const http2_options = Object.assign({
+    port: exports.PORT,
+    duration: 10
+  }, options);
+  self.start();
+  load(http2_options, function(error, result) {
+    if (cb) {
+      cb(error ? 1 : 0);
+    }
+    if (error) {
+      console.error(error);
+      process.exit(1);
+    }
+    self.config.benchmarker = 'h2c-load';
+    self.end(result.requests);
+  });
+};
+
 Benchmark.prototype._run = function() {
   const self = this;
 
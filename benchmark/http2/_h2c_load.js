@@ -0,0 +1,401 @@
+'use strict';
+
+// A small HTTP/2 load generator used by the benchmarks in this directory.
+// It speaks prior-knowledge h2c (no TLS, no upgrade) over a number of
+// connections, each keeping a number of streams open at once, for a fixed
+// duration. Header blocks are encoded once, as HPACK literals that are not
+// indexed, so that the client costs as little as possible next to the
+// server it runs in-process with. Response header blocks are not decoded.
+
+const net = require('net');
+
+const PREFACE = Buffer.from('PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n', 'latin1');
+
+const DATA = 0x0;
+const HEADERS = 0x1;
+const RST_STREAM = 0x3;
+const SETTINGS = 0x4;
+const PUSH_PROMISE = 0x5;
+const PING = 0x6;
+const GOAWAY = 0x7;
+const WINDOW_UPDATE = 0x8;
+
+const FLAG_END_STREAM = 0x1;
+const FLAG_ACK = 0x1;
+const FLAG_END_HEADERS = 0x4;
+const FLAG_PADDED = 0x8;
+
+const SETTINGS_ENABLE_PUSH = 0x2;
+const SETTINGS_INITIAL_WINDOW_SIZE = 0x4;
+const SETTINGS_MAX_FRAME_SIZE = 0x5;
+
+const DEFAULT_WINDOW_SIZE = 65535;
+const MAX_FRAME_SIZE = 16384;
+const MAX_WINDOW_SIZE = 0x7fffffff;
+
+function frame(type, flags, id, payload) {
+  const length = payload ? payload.length : 0;
+  const buf = Buffer.allocUnsafe(9 + length);
+  buf.writeUIntBE(length, 0, 3);
+  buf[3] = type;
+  buf[4] = flags;
+  buf.writeUInt32BE(id, 5);
+  if (length > 0)
+    payload.copy(buf, 9);
+  return buf;
+}
+
+function windowUpdate(id, increment) {
+  const payload = Buffer.allocUnsafe(4);
+  payload.writeUInt32BE(increment, 0);
+  return frame(WINDOW_UPDATE, 0, id, payload);
+}
+
+// HPACK integer with a 7 bit prefix, as used for string lengths
+function encodeLength(length, out) {
+  if (length < 127) {
+    out.push(length);
+    return;
+  }
+  out.push(127);
+  length -= 127;
+  while (length >= 128) {
+    out.push((length & 0x7f) | 0x80);
+    length >>>= 7;
+  }
+  out.push(length);
+}
+
+// Encodes headers, an array of [name, value] pairs, as literal header
+// fields without indexing
+function encodeHeaders(headers) {
+  const parts = [];
+  for (const [name, value] of headers) {
+    const bytes = [0];
+    encodeLength(Buffer.byteLength(name), bytes);
+    parts.push(Buffer.from(bytes), Buffer.from(name));
+    bytes.length = 0;
+    encodeLength(Buffer.byteLength(value), bytes);
+    parts.push(Buffer.from(bytes), Buffer.from(value));
+  }
+  return Buffer.concat(parts);
+}
+
+// options:
+// * port, host: the server to connect to
+// * path: the :path of each request, defaults to '/'
+// * connections: number of connections to open, defaults to 1
+// * streams: number of requests in progress on each connection at once,
+//   defaults to 1
+// * headers: number of extra request headers, defaults to 0
+// * body: bytes of request body; requests with a body are POSTs,
+//   defaults to 0
+// * window: initial stream window size advertised to the server, defaults
+//   to the largest one. The connection window is raised to match.
+// * push: whether to accept pushed streams, defaults to false
+// * duration: seconds during which new requests are started, defaults to 5
+//
+// callback(err, result) is called once every connection has finished.
+// result has the number of requests completed, of pushed streams
+// received, of streams reset by the server, and of response bytes
+// received.
+function run(options, callback) {
+  const connections = options.connections || 1;
+  const duration = options.duration === undefined ? 5 : options.duration;
+  const result = { requests: 0, pushes: 0, resets: 0, bytes: 0 };
+  let remaining = connections;
+  let failed = false;
+  let stopped = false;
+
+  const body = Buffer.alloc(options.body || 0, 'x');
+  const fields = [
+    [':method', body.length > 0 ? 'POST' : 'GET'],
+    [':path', options.path || '/'],
+    [':scheme', 'http'],
+    [':authority', `${options.host || '127.0.0.1'}:${options.port}`]
+  ];
+  for (var n = 0; n < (options.headers || 0); n++)
+    fields.push([`x-header-${n}`, `value-${n}`]);
+  const block = encodeHeaders(fields);
+  if (block.length > MAX_FRAME_SIZE)
+    throw new Error('request headers must fit in a single frame');
+
+  const clients = [];
+  for (n = 0; n < connections; n++)
+    clients.push(new Client(options, block, body, result, done));
+
+  const timer = setTimeout(() => {
+    stopped = true;
+    for (const client of clients)
+      client.stop();
+  }, duration * 1000);
+
+  function done(err) {
+    if (err && !failed) {
+      failed = true;
+      clearTimeout(timer);
+      for (const client of clients)
+        client.destroy();
+      callback(err);
+      return;
+    }
+    if (--remaining === 0 && !failed) {
+      clearTimeout(timer);
+      if (!stopped)
+        return callback(new Error('connections closed early'));
+      callback(null, result);
+    }
+  }
+}
+
+function Client(options, block, body, result, done) {
+  this.block = block;
+  this.body = body;
+  this.result = result;
+  this.done = done;
+  this.streams = options.streams || 1;
+  this.window = Math.min(options.window || MAX_WINDOW_SIZE, MAX_WINDOW_SIZE);
+  this.nextStreamID = 1;
+  this.active = new Map();
+  this.stopping = false;
+  this.finished = false;
+  this.pending = null;
+  this.output = [];
+
+  // Received DATA not yet returned to the server with WINDOW_UPDATE
+  this.consumed = 0;
+
+  // Flow control windows of the server, for request bodies
+  this.sendWindow = DEFAULT_WINDOW_SIZE;
+  this.initialSendWindow = DEFAULT_WINDOW_SIZE;
+  this.blocked = [];
+
+  const settings = Buffer.alloc(18);
+  settings.writeUInt16BE(SETTINGS_ENABLE_PUSH, 0);
+  settings.writeUInt32BE(options.push ? 1 : 0, 2);
+  settings.writeUInt16BE(SETTINGS_INITIAL_WINDOW_SIZE, 6);
+  settings.writeUInt32BE(this.window, 8);
+  settings.writeUInt16BE(SETTINGS_MAX_FRAME_SIZE, 12);
+  settings.writeUInt32BE(MAX_FRAME_SIZE, 14);
+
+  const socket = this.socket = net.connect(options.port, options.host);
+  socket.setNoDelay(true);
+  socket.on('connect', () => {
+    this.output.push(PREFACE, frame(SETTINGS, 0, 0, settings));
+    if (this.window > DEFAULT_WINDOW_SIZE)
+      this.output.push(windowUpdate(0, this.window - DEFAULT_WINDOW_SIZE));
+    for (var n = 0; n < this.streams; n++)
+      this.request();
+    this.flush();
+  });
+  socket.on('data', (data) => {
+    this.receive(data);
+    this.flush();
+  });
+  socket.on('error', (err) => this.finish(err));
+  socket.on('close', () => this.finish());
+}
+
+Client.prototype.request = function() {
+  const id = this.nextStreamID;
+  this.nextStreamID += 2;
+  const stream = {
+    id,
+    window: this.initialSendWindow,
+    sent: 0,
+    consumed: 0
+  };
+  this.active.set(id, stream);
+  if (this.body.length === 0) {
+    this.output.push(frame(HEADERS, FLAG_END_HEADERS | FLAG_END_STREAM, id,
+                           this.block));
+    return;
+  }
+  this.output.push(frame(HEADERS, FLAG_END_HEADERS, id, this.block));
+  this.blocked.push(stream);
+  this.sendBodies();
+};
+
+// Sends as much of the request bodies as the server's windows allow
+Client.prototype.sendBodies = function() {
+  const body = this.body;
+  const blocked = this.blocked;
+  var n = 0;
+  while (n < blocked.length && this.sendWindow > 0) {
+    const stream = blocked[n];
+    if (stream.window <= 0 || !this.active.has(stream.id)) {
+      if (!this.active.has(stream.id))
+        blocked.splice(n, 1);
+      else
+        n++;
+      continue;
+    }
+    const length = Math.min(body.length - stream.sent, stream.window,
+                            this.sendWindow, MAX_FRAME_SIZE);
+    const end = stream.sent + length === body.length;
+    this.output.push(frame(DATA, end ? FLAG_END_STREAM : 0, stream.id,
+                           body.slice(stream.sent, stream.sent + length)));
+    stream.sent += length;
+    stream.window -= length;
+    this.sendWindow -= length;
+    if (end)
+      blocked.splice(n, 1);
+  }
+};
+
+Client.prototype.receive = function(data) {
+  if (this.pending !== null) {
+    data = Buffer.concat([this.pending, data]);
+    this.pending = null;
+  }
+  var offset = 0;
+  while (data.length - offset >= 9) {
+    const length = data.readUIntBE(offset, 3);
+    if (data.length - offset < 9 + length)
+      break;
+    const type = data[offset + 3];
+    const flags = data[offset + 4];
+    const id = data.readUInt32BE(offset + 5) & 0x7fffffff;
+    this.onFrame(type, flags, id, data, offset + 9, length);
+    offset += 9 + length;
+  }
+  if (offset < data.length)
+    this.pending = data.slice(offset);
+  this.returnWindow();
+};
+
+Client.prototype.onFrame = function(type, flags, id, data, start, length) {
+  switch (type) {
+    case DATA:
+      this.result.bytes += length;
+      this.consumed += length;
+      if (this.active.has(id))
+        this.active.get(id).consumed += length;
+      if (flags & FLAG_PADDED)
+        this.result.bytes -= data[start] + 1;
+      if (flags & FLAG_END_STREAM)
+        this.complete(id);
+      break;
+    case HEADERS:
+      if (flags & FLAG_END_STREAM)
+        this.complete(id);
+      break;
+    case PUSH_PROMISE: {
+      const padding = (flags & FLAG_PADDED) ? 1 : 0;
+      const promised = data.readUInt32BE(start + padding) & 0x7fffffff;
+      this.active.set(promised,
+                      { id: promised, window: 0, sent: 0, consumed: 0 });
+      break;
+    }
+    case RST_STREAM:
+      if (this.active.delete(id)) {
+        this.result.resets++;
+        this.next(id);
+      }
+      break;
+    case SETTINGS:
+      if (flags & FLAG_ACK)
+        break;
+      for (var n = start; n + 6 <= start + length; n += 6) {
+        if (data.readUInt16BE(n) === SETTINGS_INITIAL_WINDOW_SIZE) {
+          const value = data.readUInt32BE(n + 2);
+          const delta = value - this.initialSendWindow;
+          this.initialSendWindow = value;
+          for (const stream of this.active.values())
+            stream.window += delta;
+        }
+      }
+      this.output.push(frame(SETTINGS, FLAG_ACK, 0));
+      this.sendBodies();
+      break;
+    case PING:
+      if (!(flags & FLAG_ACK)) {
+        this.output.push(frame(PING, FLAG_ACK, 0,
+                               data.slice(start, start + length)));
+      }
+      break;
+    case GOAWAY:
+      this.stop();
+      break;
+    case WINDOW_UPDATE: {
+      const increment = data.readUInt32BE(start) & 0x7fffffff;
+      if (id === 0)
+        this.sendWindow += increment;
+      else if (this.active.has(id))
+        this.active.get(id).window += increment;
+      this.sendBodies();
+      break;
+    }
+  }
+};
+
+Client.prototype.complete = function(id) {
+  if (!this.active.delete(id))
+    return;
+  if (id % 2 === 0)
+    this.result.pushes++;
+  else
+    this.result.requests++;
+  this.next(id);
+};
+
+// Starts the next request in place of the completed stream id, unless it
+// was pushed, or closes the connection once stopped and idle
+Client.prototype.next = function(id) {
+  if (!this.stopping) {
+    if (id % 2 === 1)
+      this.request();
+  } else if (this.active.size === 0) {
+    this.socket.end();
+  }
+};
+
+// Returns the DATA consumed once half of a window has been used, so that
+// the server is limited by the advertised window but is not left waiting
+// for every byte of it to be acknowledged.
+Client.prototype.returnWindow = function() {
+  const threshold = this.window / 2;
+  if (this.consumed >= threshold) {
+    this.output.push(windowUpdate(0, this.consumed));
+    this.consumed = 0;
+  }
+  for (const stream of this.active.values()) {
+    if (stream.consumed >= threshold) {
+      this.output.push(windowUpdate(stream.id, stream.consumed));
+      stream.consumed = 0;
+    }
+  }
+};
+
+Client.prototype.flush = function() {
+  if (this.output.length === 0 || this.finished)
+    return;
+  const output = this.output.length === 1 ?
+      this.output[0] : Buffer.concat(this.output);
+  this.output = [];
+  this.socket.write(output);
+};
+
+// Stops starting new requests. The connection is closed once those in
+// progress have completed.
+Client.prototype.stop = function() {
+  if (this.stopping)
+    return;
+  this.stopping = true;
+  if (this.active.size === 0)
+    this.socket.end();
+};
+
+Client.prototype.destroy = function() {
+  this.finished = true;
+  this.socket.destroy();
+};
+
+Client.prototype.finish = function(err) {
+  if (this.finished)
+    return;
+  this.finished = true;
+  this.done(err);
+};
+
+module.exports = run;
@@ -0,0 +1,31 @@
+// Large responses to a client that advertises a small stream window, so
+// that the server spends most of its time waiting for WINDOW_UPDATE frames
+'use strict';
+
+const common = require('../common.js');
+
+const bench = common.createBenchmark(main, {
+  window: [1024, 16384, 65535],
+  kb: [256],
+  streams: [1, 10],
+  dur: [5]
+});
+
+function main(conf) {
+  const http2 = require('http').HTTP2;
+  const chunk = Buffer.alloc(conf.kb * 1024, 'x');
+  const server = http2.createServer(function(req, res) {
+    res.end(chunk);
+  });
+
+  server.listen(common.PORT, function() {
+    bench.http2({
+      connections: 1,
+      streams: conf.streams,
+      window: conf.window,
+      duration: conf.dur
+    }, function() {
+      server.close();
+    });
+  });
+}
@@ -0,0 +1,33 @@
+// Requests and responses that each carry n small extra headers
+'use strict';
+
+const common = require('../common.js');
+
+const bench = common.createBenchmark(main, {
+  n: [0, 10, 100],
+  streams: [1, 10],
+  dur: [5]
+});
+
+function main(conf) {
+  const http2 = require('http').HTTP2;
+  const names = [];
+  for (var n = 0; n < conf.n; n++)
+    names.push(`x-header-${n}`);
+  const server = http2.createServer(function(req, res) {
+    for (var n = 0; n < names.length; n++)
+      res.setHeader(names[n], `value-${n}`);
+    res.end('ok');
+  });
+
+  server.listen(common.PORT, function() {
+    bench.http2({
+      connections: 1,
+      streams: conf.streams,
+      headers: conf.n,
+      duration: conf.dur
+    }, function() {
+      server.close();
+    });
+  });
+}
@@ -0,0 +1,33 @@
+// Responses with bodies larger than the default flow control windows,
+// written either with a single end() or in a number of write() calls.
+'use strict';
+
+const common = require('../common.js');
+
+const bench = common.createBenchmark(main, {
+  kb: [64, 1024],
+  chunks: [1, 16],
+  streams: [1, 10],
+  dur: [5]
+});
+
+function main(conf) {
+  const http2 = require('http').HTTP2;
+  const chunks = conf.chunks;
+  const chunk = Buffer.alloc(conf.kb * 1024 / chunks, 'x');
+  const server = http2.createServer(function(req, res) {
+    for (var n = 1; n < chunks; n++)
+      res.write(chunk);
+    res.end(chunk);
+  });
+
+  server.listen(common.PORT, function() {
+    bench.http2({
+      connections: 1,
+      streams: conf.streams,
+      duration: conf.dur
+    }, function() {
+      server.close();
+    });
+  });
+}
@@ -0,0 +1,36 @@
+// Each response pushes a number of small resources along with it
+'use strict';
+
+const common = require('../common.js');
+
+const bench = common.createBenchmark(main, {
+  pushes: [0, 1, 4],
+  streams: [1, 10],
+  dur: [5]
+});
+
+function main(conf) {
+  const http2 = require('http').HTTP2;
+  const chunk = Buffer.alloc(1024, 'x');
+  const server = http2.createServer(function(req, res) {
+    for (var n = 0; n < conf.pushes; n++) {
+      const push = res.createPushResponse();
+      push.path = `/pushed/${n}`;
+      push.push(function(req, res) {
+        res.end(chunk);
+      });
+    }
+    res.end(chunk);
+  });
+
+  server.listen(common.PORT, function() {
+    bench.http2({
+      connections: 1,
+      streams: conf.streams,
+      push: true,
+      duration: conf.dur
+    }, function() {
+      server.close();
+    });
+  });
+}
@@ -0,0 +1,31 @@
+// POST requests whose bodies the server reads before responding
+'use strict';
+
+const common = require('../common.js');
+
+const bench = common.createBenchmark(main, {
+  kb: [1, 64],
+  streams: [1, 10],
+  dur: [5]
+});
+
+function main(conf) {
+  const http2 = require('http').HTTP2;
+  const server = http2.createServer(function(req, res) {
+    req.resume();
+    req.on('end', function() {
+      res.end('ok');
+    });
+  });
+
+  server.listen(common.PORT, function() {
+    bench.http2({
+      connections: 1,
+      streams: conf.streams,
+      body: conf.kb * 1024,
+      duration: conf.dur
+    }, function() {
+      server.close();
+    });
+  });
+}
@@ -0,0 +1,28 @@
+'use strict';
+
+const common = require('../common.js');
+
+const bench = common.createBenchmark(main, {
+  length: [4, 1024],
+  streams: [1, 10, 100],
+  c: [1, 10],
+  dur: [5]
+});
+
+function main(conf) {
+  const http2 = require('http').HTTP2;
+  const chunk = Buffer.alloc(conf.length, 'x');
+  const server = http2.createServer(function(req, res) {
+    res.end(chunk);
+  });
+
+  server.listen(common.PORT, function() {
+    bench.http2({
+      connections: conf.c,
+      streams: conf.streams,
+      duration: conf.dur
+    }, function() {
+      server.close();
+    });
+  });
+}
@@ -0,0 +1,29 @@
+// Responses that end with a block of n trailers
+'use strict';
+
+const common = require('../common.js');
+
+const bench = common.createBenchmark(main, {
+  n: [0, 1, 10],
+  streams: [1, 10],
+  dur: [5]
+});
+
+function main(conf) {
+  const http2 = require('http').HTTP2;
+  const server = http2.createServer(function(req, res) {
+    for (var n = 0; n < conf.n; n++)
+      res.setTrailer(`x-trailer-${n}`, `value-${n}`);
+    res.end('ok');
+  });
+
+  server.listen(common.PORT, function() {
+    bench.http2({
+      connections: 1,
+      streams: conf.streams,
+      duration: conf.dur
+    }, function() {
+      server.close();
+    });
+  });
+}
@@ -1,19 +1,22 @@
 'use strict';
 
 const http2 = process.binding('http2');
+const zlib = process.binding('zlib');
+const zlibConstants = process.binding('constants').zlib;
 const util = require('util');
 const debug = util.debuglog('http2');
 const Buffer = require('buffer').Buffer;
 const assert = require('assert');
+const fs = require('fs');
 const EventEmitter = require('events');
-const internalHttp = require('internal/http');
-const TLSServer = require('tls').Server;
-const NETServer = require('net').Server;
+const tls = require('tls');
+const net = require('net');
+const TLSServer = tls.Server;
+const NETServer = net.Server;
 const stream = require('stream');
 const Writable = stream.Writable;
 const PassThrough = stream.PassThrough;
 const constants = http2.constants;
-const utcDate = internalHttp.utcDate;
 
 const kOptions = Symbol('options');
 const kHandle = Symbol('handle');
@@ -24,6 +27,7 @@ const kHeadersSent = Symbol('headers-sent');
 const kTrailersSent = Symbol('trailers-sent');
 const kSession = Symbol('session');
 const kOutgoingData = Symbol('outgoing-data');
+const kConsumed = Symbol('consumed');
 const kRequest = Symbol('request');
 const kResponse = Symbol('response');
 const kFinished = Symbol('finished');
@@ -38,14 +42,75 @@ const kEndStream = Symbol('end-stream');
 const kHasTrailers = Symbol('has-trailers');
 const kExpectContinue = Symbol('expect-continue');
 const kResponseFlags = Symbol('response-flags');
+const kHeaderTemplate = Symbol('header-template');
+const kBufferedLength = Symbol('buffered-length');
+const kWriteCallback = Symbol('write-callback');
+const kTakeData = Symbol('take-data');
+const kReleaseData = Symbol('release-data');
+const kConnecting = Symbol('connecting');
+const kStreams = Symbol('streams');
+const kSessions = Symbol('sessions');
+const kGoaway = Symbol('goaway');
+const kRespondWithFD = Symbol('respond-with-fd');
+const kOwner = Symbol('owner');
+const kPushManifest = Symbol('push-manifest');
+const kPushed = Symbol('pushed');
+const kPushTemplates = Symbol('push-templates');
+const kPushStreams = Symbol('push-streams');
+const kResponseCache = Symbol('response-cache');
+const kCacheKey = Symbol('cache-key');
+const kCacheChunks = Symbol('cache-chunks');
+const kCacheLength = Symbol('cache-length');
+const kCacheHeaders = Symbol('cache-headers');
+const kCacheWrite = Symbol('cache-write');
+const kCompression = Symbol('compression');
+const kAcceptEncoding = Symbol('accept-encoding');
+const kCompressor = Symbol('compressor');
+const kNegotiate = Symbol('negotiate');
+const kWriteData = Symbol('write-data');
+const kFinishCompression = Symbol('finish-compression');
+const kReleaseCompressor = Symbol('release-compressor');
 const kResponseFlag_SendDate = 0x1;
 
 const kDefaultSocketTimeout = 2 * 60 * 1000;
-
-// The process.binding('http2').Http2Session object will
-// emit events as callbacks. To allow this to happen,
-// it has to inherit from EventEmitter.
-util.inherits(http2.Http2Session, EventEmitter);
+// How long a resource registered with server.addPush() is not pushed again
+// on the same session, unless given for the resource
+const kDefaultPushInterval = 60 * 1000;
+// Reading from a socket pauses while its Http2Session has more than this many
+// frames queued for sending. Matches HTTP2_MAX_OUTBOUND_QUEUE_SIZE, which is
+// used when the session has consumed the socket.
+const kMaxOutboundQueueSize = 1024;
+
+// Values of the schedulingPolicy option
+const kSchedulingPolicies = {
+  'priority-tree': constants.HTTP2_SCHEDULING_PRIORITY_TREE,
+  'strict': constants.HTTP2_SCHEDULING_STRICT,
+  'weighted-fair': constants.HTTP2_SCHEDULING_WEIGHTED_FAIR,
+  'round-robin': constants.HTTP2_SCHEDULING_ROUND_ROBIN
+};
+
+const {
+  HTTP2_EVENT_SEND,
+  HTTP2_EVENT_ERROR,
+  HTTP2_EVENT_HEADERS_COMPLETE,
+  HTTP2_EVENT_STREAM_CLOSE,
+  HTTP2_EVENT_DATA_CHUNKS,
+  HTTP2_EVENT_FRAME_SENT,
+  HTTP2_EVENT_GOAWAY,
+  HTTP2_EVENT_RST_STREAM,
+  HTTP2_EVENT_CAN_CLOSE,
+  HTTP2_EVENT_DESTROY,
+  SESSION_FIELD_OUTBOUND_QUEUE_SIZE,
+  SESSION_FIELD_FRAMES_RECEIVED,
+  SESSION_FIELD_FRAMES_SENT,
+  SESSION_FIELD_BYTES_RECEIVED,
+  SESSION_FIELD_BYTES_SENT,
+  SESSION_FIELD_REMOTE_ENABLE_PUSH,
+  STREAM_FIELD_COUNT,
+  STREAM_FIELD_STATE,
+  STREAM_FIELD_REMOTE_WINDOW_SIZE,
+  STREAM_FIELD_TIMED_OUT
+} = constants;
 
 // If rv (the return value from an internal nghttp2 method) is
 // negative, then the value indicates an error condition. In
@@ -71,6 +136,127 @@ Object.defineProperty(exports, 'constants', {
   value: constants
 });
 
+// Every event of a process.binding('http2').Http2Session is delivered to
+// this one function, with the native session as this and the kind of event
+// as one of the HTTP2_EVENT_* constants. The handlers below are called with
+// the Http2Session wrapper that owns the native session.
+function onSessionEvent(event, a, b, c, d) {
+  const owner = this[kOwner];
+  switch (event) {
+    case HTTP2_EVENT_SEND:
+      onSessionSend(owner, a);
+      break;
+    case HTTP2_EVENT_DATA_CHUNKS:
+      onSessionDataChunks(owner, a);
+      break;
+    case HTTP2_EVENT_FRAME_SENT:
+      onSessionFrameSent(owner, a, b, c);
+      break;
+    case HTTP2_EVENT_HEADERS_COMPLETE:
+      onSessionHeadersComplete(owner, a, b, c, d);
+      break;
+    case HTTP2_EVENT_STREAM_CLOSE:
+      onSessionStreamClose(owner, a, b);
+      break;
+    case HTTP2_EVENT_RST_STREAM:
+      onSessionRstStream(owner, a, b);
+      break;
+    case HTTP2_EVENT_GOAWAY:
+      onSessionGoaway(owner, a, b, c);
+      break;
+    case HTTP2_EVENT_ERROR:
+      onSessionError(owner, a);
+      break;
+    case HTTP2_EVENT_CAN_CLOSE:
+      debug('Http2Session::canClose');
+      break;
+    case HTTP2_EVENT_DESTROY:
+      debug('Http2Session::destroy');
+      break;
+  }
+}
+
+function onSessionError(session, error) {
+  debug(`Http2Session::error [${error.message}]`);
+  process.nextTick(() => session.emit('error', error));
+}
+
+function onSessionSend(session, buffer) {
+  debug(`Http2Session::send [${buffer.length}]`);
+  process.nextTick(() => session.emit('send', buffer));
+}
+
+function onSessionHeadersComplete(session, stream, flags, category, fields) {
+  const finished = Boolean(flags & constants.NGHTTP2_FLAG_END_STREAM);
+  debug(
+    `Http2Session::headers-complete [${stream.id}, ${finished}, ${flags}]`);
+  if (!stream.session) {
+    debug('Http2Session::headers-complete [New Stream]');
+    Object.defineProperty(stream, 'session', {
+      enumerable: true,
+      configurable: true,
+      value: session
+    });
+  }
+  // fields is a flat array of alternating header names and values
+  const headers = new Headers(category);
+  for (var n = 0; n < fields.length; n += 2)
+    headers.set(fields[n], fields[n + 1]);
+  process.nextTick(() => {
+    session.emit('headers-complete', stream, finished, headers);
+  });
+}
+
+function onSessionStreamClose(session, stream, code) {
+  debug(`Http2Session::stream-close [${stream.id}, ${code}]`);
+  process.nextTick(() => session.emit('stream-close', stream, code));
+}
+
+// chunks is a flat array of stream and value pairs covering all of the
+// DATA received by one read. Each value is either a Buffer slice holding a
+// chunk of the payload or, at the end of a DATA frame, the flags of that
+// frame.
+function onSessionDataChunks(session, chunks) {
+  debug(`Http2Session::data-chunks [${chunks.length / 2}]`);
+  process.nextTick(() => {
+    for (var n = 0; n < chunks.length; n += 2) {
+      const stream = chunks[n];
+      const value = chunks[n + 1];
+      if (typeof value === 'number') {
+        const finished = Boolean(value & constants.NGHTTP2_FLAG_END_STREAM);
+        session.emit('data-end', stream, finished);
+      } else {
+        session.emit('data-chunk', stream, value);
+      }
+    }
+  });
+}
+
+// streamID is the stream the frame belongs to
+// type is the frame type
+// flags are the frame flags
+function onSessionFrameSent(session, streamID, type, flags) {
+  debug(`Http2Session::frame-sent [${streamID}, ${type}, ${flags}]`);
+  process.nextTick(() => session.emit('frame-sent', streamID, type, flags));
+}
+
+// code is the error code
+// lastStreamID is the last processed stream ID
+// data is the optional additional application data
+function onSessionGoaway(session, code, lastStreamID, data) {
+  debug(`Http2Session::goaway [${code}, ${lastStreamID}, ${data}]`);
+  process.nextTick(() => session.emit('goaway', code, lastStreamID, data));
+}
+
+// stream is the stream identifier. by this time, the underlying
+// Http2Stream object has been unreferenced and the nghttp2_stream
+// has been destroyed. The only reference we have left is the id
+// code is the RstStream code
+function onSessionRstStream(session, stream, code) {
+  debug(`Http2Session::rst-stream [${stream}, ${code}]`);
+  process.nextTick(() => session.emit('rst-stream', stream, code));
+}
+
 // Effectively  a wrapper for process.binding('http').Http2Session
 // that ensures that events are emitted in nextTick. Also performs
 // type checking and other tasks that are easier/better done in
@@ -78,7 +264,7 @@ Object.defineProperty(exports, 'constants', {
 // TODO(jasnell): It should be possible to do this without creating
 // a wrapper object. Explore opportunities to improve this.
 class Http2Session extends EventEmitter {
-  constructor(type) {
+  constructor(type, options) {
     debug(`Creating new Http2Session [Type ${type}]`);
     super();
     type |= 0;
@@ -87,99 +273,8 @@ class Http2Session extends EventEmitter {
       throw new TypeError('Invalid session type');
     }
 
-    const session = new http2.Http2Session(type);
-    EventEmitter.call(session);
-
-    session.on('canClose', () => {
-      debug('Http2Session::canClose');
-    });
-
-    session.on('error', (error) => {
-      debug(`Http2Session::error [${error.message}]`);
-      process.nextTick(() => this.emit('error', error));
-    });
-
-    session.on('send', (buffer) => {
-      debug(`Http2Session::send [${buffer.length}]`);
-      process.nextTick(() => this.emit('send', buffer));
-    });
-
-    session.on('begin-headers', (stream, category) => {
-      debug(`Http2Session::begin-headers [${stream.id}, ${category}]`);
-      if (!stream.session) {
-        debug('Http2Session::begin-headers [New Stream]');
-        Object.defineProperty(stream, 'session', {
-          enumerable: true,
-          configurable: true,
-          value: this
-        });
-      }
-      process.nextTick(() => this.emit('begin-headers', stream, category));
-    });
-
-    session.on('header', (stream, name, value) => {
-      debug(`Http2Session::header [${stream.id}, "${name}": "${value}""]`);
-      process.nextTick(() => this.emit('header', stream, name, value));
-    });
-
-    session.on('headers-complete', (stream, flags) => {
-      const finished = Boolean(flags & constants.NGHTTP2_FLAG_END_STREAM);
-      debug(
-        `Http2Session::headers-complete [${stream.id}, ${finished}, ${flags}]`);
-      process.nextTick(() => this.emit('headers-complete', stream, finished));
-    });
-
-    session.on('stream-close', (stream, code) => {
-      debug(`Http2Session::stream-close [${stream.id}, ${code}]`);
-      process.nextTick(() => this.emit('stream-close', stream, code));
-    });
-
-    session.on('data-chunk', (stream, flags, data) => {
-      debug(
-        `Http2Session::data-chunk [${stream.id}, ${flags}, ${data.length}]`);
-      // streamID is the numeric stream ID the data belongs to
-      // flags is the data flags
-      // data is the Buffer containing the data
-      process.nextTick(() => this.emit('data-chunk', stream, data));
-    });
-
-    session.on('data', (stream, flags, length, padding) => {
-      // stream is the Http2Stream object the data belongs to
-      // flags is the frame flags
-      // length is the amount of data
-      // padding is the amount of padding in the data
-      const finished = Boolean(flags & constants.NGHTTP2_DATA_FLAG_EOF ||
-                               flags & constants.NGHTTP2_FLAG_END_STREAM);
-      debug(
-        `Http2Session::data [${stream.id}, ${flags}, ${length}, ${padding}]`);
-      process.nextTick(() => this.emit('data-end', stream, finished, padding));
-    });
-
-    session.on('frame-sent', (streamID, type, flags) => {
-      // streamID is the stream the frame belongs to
-      // type is the frame type
-      // flags are the frame flags
-      debug(`Http2Session::frame-sent [${streamID}, ${type}, ${flags}]`);
-      process.nextTick(() => this.emit('frame-sent', streamID, type, flags));
-    });
-
-    session.on('goaway', (code, lastStreamID, data) => {
-      // code is the error code
-      // lastStreamID is the last processed stream ID
-      // data is the optional additional application data
-      debug(`Http2Session::goaway [${code}, ${lastStreamID}, ${data}]`);
-      process.nextTick(() => this.emit('goaway', code, lastStreamID, data));
-    });
-
-    session.on('rst-stream', (stream, code) => {
-      // stream is the stream identifier. by this time, the underlying
-      // Http2Stream object has been unreferenced and the nghttp2_stream
-      // has been destroyed. The only reference we have left is the id
-      // code is the RstStream code
-      debug(`Http2Session::rst-stream [${stream}, ${code}]`);
-      process.nextTick(() => this.emit('rst-stream', stream, code));
-    });
-
+    const session = new http2.Http2Session(type, options, onSessionEvent);
+    session[kOwner] = this;
     this[kHandle] = session;
   }
 
@@ -223,6 +318,21 @@ class Http2Session extends EventEmitter {
       return this._handle.outboundQueueSize;
   }
 
+  get allocatedMemory() {
+    if (this._handle)
+      return this._handle.allocatedMemory;
+  }
+
+  get peakAllocatedMemory() {
+    if (this._handle)
+      return this._handle.peakAllocatedMemory;
+  }
+
+  get reservedMemory() {
+    if (this._handle)
+      return this._handle.reservedMemory;
+  }
+
   get lastProcStreamID() {
     if (this._handle)
       return this._handle.lastProcStreamID;
@@ -253,6 +363,29 @@ class Http2Session extends EventEmitter {
       return this._handle.wantRead;
   }
 
+  // The frame and byte counters are read from the fields shared with the
+  // native session, which are current as of the last receiveData() or
+  // sendData() call.
+  get framesReceived() {
+    if (this._handle)
+      return this._handle.fields[SESSION_FIELD_FRAMES_RECEIVED];
+  }
+
+  get framesSent() {
+    if (this._handle)
+      return this._handle.fields[SESSION_FIELD_FRAMES_SENT];
+  }
+
+  get bytesReceived() {
+    if (this._handle)
+      return this._handle.fields[SESSION_FIELD_BYTES_RECEIVED];
+  }
+
+  get bytesSent() {
+    if (this._handle)
+      return this._handle.fields[SESSION_FIELD_BYTES_SENT];
+  }
+
   get wantWrite() {
     if (this._handle)
       return this._handle.wantWrite;
@@ -286,6 +419,8 @@ class Http2Session extends EventEmitter {
     if (this._handle) {
       this._handle.destroy();
       this[kHandle] = null;
+      // The streams of the session are closed without 'stream-close'
+      releasePushStreams(this);
     }
   }
 
@@ -317,6 +452,59 @@ class Http2Session extends EventEmitter {
     }
   }
 
+  /**
+   * Attaches the underlying nghttp2_session directly to the socket's native
+   * StreamBase handle. Once consumed, data read from the socket is passed to
+   * nghttp2 and serialized frames are written to the socket without a round
+   * trip through JavaScript, and the 'send' event is no longer emitted.
+   * Returns false if the socket does not expose a native stream.
+   **/
+  consumeSocket(socket) {
+    const handle = socket._handle;
+    const external = handle && handle._externalStream;
+    if (!this._handle || !external || this[kConsumed])
+      return false;
+    debug('Http2Session::consumeSocket');
+    this._handle.consumeSocket(external);
+    this[kConsumed] = true;
+    return true;
+  }
+
+  unconsumeSocket() {
+    debug('Http2Session::unconsumeSocket');
+    if (this._handle && this[kConsumed])
+      this._handle.unconsumeSocket();
+    this[kConsumed] = false;
+  }
+
+  /**
+   * Registers a set of response headers that are sent unchanged on many
+   * streams. The headers are stored natively, ready for submission, and
+   * the returned id may be passed to response.setHeaderTemplate(). Headers
+   * set on an individual response replace template headers of the same
+   * name. headers may be a Map or an object.
+   **/
+  createHeaderTemplate(headers) {
+    if (!this._handle)
+      throw new Error('The Http2Session has been destroyed');
+    const map = new Map();
+    const keys = headers instanceof Map ?
+        Array.from(headers.keys()) : Object.keys(headers);
+    for (var key of keys) {
+      const value = headers instanceof Map ? headers.get(key) : headers[key];
+      const name = String(key).toLowerCase();
+      if (isPseudoHeader(name))
+        throw new Error('Cannot set HTTP/2 pseudo-headers');
+      map.set(name, value);
+    }
+    const packed = mapToHeaders(map);
+    const id = this._handle.createHeaderTemplate(packed[0], packed[1]);
+    if (id < 0)
+      throw new Error(`HTTP2Error: ${http2.nghttp2ErrorString(id)}`);
+    debug(`Http2Session::createHeaderTemplate [${id}, ${packed[1]}]`);
+    return id;
+  }
+
   /**
    * When a chunk of data is received by the Socket, the receiveData
    * method passes that data on to the underlying nghttp2_session. The
@@ -336,7 +524,8 @@ class Http2Session extends EventEmitter {
    **/
   sendData() {
     debug('Http2Session::sendData');
-    if (this._handle)
+    // A client session holds its frames until the socket has connected
+    if (this._handle && !this[kConnecting])
       checkSuccessOrEmitError(this, this._handle.sendData());
   }
 
@@ -405,10 +594,12 @@ class Http2Incoming extends PassThrough {
     return this[kFinished];
   }
 
+  // Resets the stream with CANCEL, and emits 'timeout', once nothing has
+  // been received or sent on it for msecs milliseconds
   setTimeout(msecs, callback) {
     if (callback)
       this.on('timeout', callback);
-    this.socket.setTimeout(msecs);
+    this.stream.setIdleTimeout(msecs);
     return this;
   }
 
@@ -438,18 +629,18 @@ class Http2ServerRequest extends Http2Incoming {
 }
 
 
-// class Http2ClientResponse extends Http2Incoming {
-//   constructor(stream, headers, socket) {
-//     super(stream, headers, socket);
-//   }
+class Http2ClientResponse extends Http2Incoming {
+  constructor(stream, headers, socket) {
+    super(stream, headers, socket);
+  }
 
-//   get status() {
-//     return this.headers.get(constants.HTTP2_HEADER_STATUS) | 0;
-//   }
-// }
+  get status() {
+    return this.headers.get(constants.HTTP2_HEADER_STATUS) | 0;
+  }
+}
 
 class Http2Outgoing extends Writable {
-  constructor(stream, socket) {
+  constructor(stream, socket, provider) {
     super({});
     this[kStream] = stream;
     this[kSocket] = socket;
@@ -459,6 +650,23 @@ class Http2Outgoing extends Writable {
     this[kHeadersSent] = false;
     this[kTrailersSent] = false;
     this[kChunks] = [];
+    // The number of bytes queued in kChunks, and the callback of the last
+    // write if it has been held back because too much data is queued
+    this[kBufferedLength] = 0;
+    this[kWriteCallback] = null;
+    // Set by the server while the response may be stored in its
+    // responseCache (see Http2ResponseCache)
+    this[kCacheKey] = undefined;
+    this[kCacheChunks] = undefined;
+    this[kCacheLength] = 0;
+    this[kCacheHeaders] = undefined;
+    // Set by the server when its compression option is enabled. The
+    // content coding accepted by the client is kept until the response
+    // headers are final, when the compressor is acquired if the response
+    // is to be compressed.
+    this[kCompression] = undefined;
+    this[kAcceptEncoding] = undefined;
+    this[kCompressor] = undefined;
 
     debug(`Http2Outgoing::constructor [${stream.id}]`);
     // The Http2DataProvider objects wraps a nghttp2_data_provider internally
@@ -466,16 +674,18 @@ class Http2Outgoing extends Writable {
     // object is a Writable stream that stores the chunks of written data into
     // a simple this[kchunks] array (currently). The Http2DataProvider object
     // simply harvests the chunks from that array. TODO: Make this more
-    // efficient
-    this[kProvider] = new http2.Http2DataProvider(stream);
+    // efficient. A client request passes in the provider it was submitted
+    // with.
+    this[kProvider] = provider || new http2.Http2DataProvider(stream);
     // This callback is invoked from node_http2.cc while the outgoing data
-    // frame is being processed. The buffer argument is a pre-allocated, fixed
-    // sized buffer to read the data into. flags is an object that supports
-    // two properties used to indicate if the data has concluded or not.
-    // The callback must return the actual number of bytes written up to but
-    // not exceeding buffer.length
-    this[kProvider]._read = (buffer, flags) => {
-      debug(`Http2DataProvider::_read [${stream.id}, ${buffer.length}]`);
+    // frame is being processed. The length argument is the maximum number of
+    // bytes that may be included in the frame. flags is an object that
+    // supports two properties used to indicate if the data has concluded or
+    // not. The callback returns an array of Buffers making up the frame
+    // payload, totalling at most length bytes. The Buffers are written to
+    // the socket as-is, so the queued chunks are never copied here.
+    this[kProvider]._read = (length, flags) => {
+      debug(`Http2DataProvider::_read [${stream.id}, ${length}]`);
       const chunks = this[kChunks];
       if (chunks.length === 0) {
         if (!this[kFinished]) {
@@ -494,7 +704,15 @@ class Http2Outgoing extends Writable {
           return 0;
         }
       } else {
-        if (this[kFinished]) {
+        // Take as much of the currently buffered
+        // data as possible per data frame up to length
+        debug(`Http2DataProvider::_read [${stream.id}, TAKING BUFFERS]`);
+        const ret = takeBuffers(length, chunks);
+        var taken = 0;
+        for (var n = 0; n < ret.length; n++)
+          taken += ret[n].length;
+        this[kTakeData](taken);
+        if (this[kFinished] && chunks.length === 0) {
           // Finish has been called so there will
           // not be any more data queued. Set the
           // flags to avoid another data frame write.
@@ -506,11 +724,7 @@ class Http2Outgoing extends Writable {
           debug(`Http2DataProvider::_read [${stream.id}, CALL kEndStream()]`);
           this[kEndStream](flags);
         }
-        // Consume as much of the currently buffered
-        // data as possible per data frame up to buffer.length
-        debug(`Http2DataProvider::_read [${stream.id}, COPYING BUFFERS]`);
-        const ret = copyBuffers(buffer, chunks);
-        debug(`Http2DataProvider::_read [${stream.id}, COPIED ${ret}]`);
+        debug(`Http2DataProvider::_read [${stream.id}, TOOK ${ret.length}]`);
         return ret;
       }
     };
@@ -550,22 +764,17 @@ class Http2Outgoing extends Writable {
     // TODO(jasnell): Enable the following check later
     // if (this.headersSent)
     //   throw new Error('Cannot set headers after they are sent');
-    name = String(name).toLowerCase().trim();
+    name = String(name).toLowerCase();
     if (isPseudoHeader(name))
       throw new Error('Cannot set HTTP/2 pseudo-headers');
-    if (isIllegalConnectionSpecificHeader(name, value))
-      throw new Error('Connection-specific HTTP headers are not permitted');
     // Delete the current value if it's null
     if (value === undefined || value === null) {
       this[kHeaders].delete(name);
       return this;
     }
-
-    if (Array.isArray(value)) {
-      this[kHeaders].set(name, value.map((i) => String(i)));
-    } else {
-      this[kHeaders].set(name, String(value));
-    }
+    // Names and values are only checked, and stringified, when the block is
+    // packed and submitted, see kBeginSend
+    this[kHeaders].set(name, value);
     return this;
   }
 
@@ -574,22 +783,41 @@ class Http2Outgoing extends Writable {
       `Http2Outgoing::setTrailer [${this.stream.id}, "${name}": "${value}"]`);
     if (this.trailersSent)
       throw new Error('Cannot set trailers after they are sent');
-    name = String(name).toLowerCase().trim();
+    name = String(name).toLowerCase();
     if (isPseudoHeader(name))
       throw new Error('Cannot set HTTP/2 pseudo-headers');
-    if (isIllegalConnectionSpecificHeader(name, value))
-      throw new Error('Connection-specific HTTP headers are not permitted');
     // Delete the current value if it's null
     if (value === undefined || value === null) {
       this[kTrailers].delete(name);
       return this;
     }
+    // Names and values are only checked, and stringified, when the block is
+    // packed and submitted, see kBeginSend
+    this[kTrailers].set(name, value);
+    return this;
+  }
 
-    if (Array.isArray(value)) {
-      this[kTrailers].set(name, value.map((i) => String(i)));
-    } else {
-      this[kTrailers].set(name, String(value));
+  // Sets the scheduling priority hint of the stream, from 0 (most urgent)
+  // to 7. Only used when the session has a schedulingPolicy other than
+  // 'priority-tree'.
+  setPriority(level) {
+    if (!Number.isInteger(level) || level < 0 ||
+        level >= constants.HTTP2_PRIORITY_LEVELS) {
+      throw new RangeError('level must be an integer from 0 to ' +
+                           `${constants.HTTP2_PRIORITY_LEVELS - 1}`);
     }
+    debug(`Http2Outgoing::setPriority [${this.stream.id}, ${level}]`);
+    this.stream.setPriority(level);
+    this.stream.session.sendData();
+    return this;
+  }
+
+  // Sends the headers of the template id, created using
+  // session.createHeaderTemplate(), along with the headers of this message.
+  setHeaderTemplate(id) {
+    if (this.headersSent)
+      throw new Error('Cannot set headers after they are sent');
+    this[kHeaderTemplate] = id;
     return this;
   }
 
@@ -629,31 +857,94 @@ class Http2Outgoing extends Writable {
     return this;
   }
 
+  // Resets the stream with CANCEL, and emits 'timeout', once nothing has
+  // been received or sent on it for msecs milliseconds
   setTimeout(msecs, callback) {
     if (callback)
       this.on('timeout', callback);
-    if (!this.socket) {
-      this.once('socket', (socket) => socket.setTimeout(msecs));
-    } else {
-      this.socket.setTimeout(msecs);
-    }
+    this.stream.setIdleTimeout(msecs);
     return this;
   }
 
   _write(chunk, encoding, callback) {
-    if (typeof chunk === 'string')
+    // Buffers written by the caller may be modified once written, so the
+    // cache keeps a copy of them
+    var owned = false;
+    if (typeof chunk === 'string') {
       chunk = Buffer.from(chunk, encoding);
+      owned = true;
+    }
     debug(`Http2Outgoing::_write [${this.stream.id}, ${chunk.length}]`);
-    const state = this.stream.state;
+    if (this[kCacheChunks] !== undefined && chunk.length > 0)
+      this[kCacheWrite](owned ? chunk : Buffer.from(chunk));
+    if (this[kAcceptEncoding] !== undefined)
+      this[kNegotiate]();
+    const compressor = this[kCompressor];
+    if (compressor !== undefined && chunk.length > 0) {
+      this[kBeginSend]();
+      compressor.write(chunk, zlibConstants.Z_NO_FLUSH, (err, output) => {
+        if (err)
+          return this[kFinishCompression](err, callback);
+        this[kWriteData](output, callback);
+        // kReleaseData() cannot release the compressor while it is busy, so
+        // it is released here if the stream was closed or reset meanwhile
+        const state = this.stream.fields[STREAM_FIELD_STATE];
+        if (this[kFinished] || this.socket.destroyed ||
+            state === constants.NGHTTP2_STREAM_STATE_CLOSED ||
+            state === constants.NGHTTP2_STREAM_STATE_HALF_CLOSED_LOCAL) {
+          this[kReleaseCompressor]();
+        }
+      });
+      return;
+    }
+    this[kWriteData](chunk, callback);
+  }
+
+  // Queues chunk to be sent in DATA frames
+  [kWriteData](chunk, callback) {
+    const state = this.stream.fields[STREAM_FIELD_STATE];
     if (!this.socket.destroyed &&
         state !== constants.NGHTTP2_STREAM_STATE_CLOSED &&
         state !== constants.NGHTTP2_STREAM_STATE_HALF_CLOSED_LOCAL) {
       debug(`Http2Outgoing::_write WRITING [${this.stream.id}]`);
-      if (chunk.length > 0)
+      if (chunk.length > 0) {
+        const rv = this.stream.queueData(chunk.length);
+        if (rv < 0) {
+          // The session is over its maxSessionMemory limit and the stream
+          // has been reset. Drop whatever is still queued for it.
+          debug(`Http2Outgoing::_write MEMORY LIMIT [${this.stream.id}]`);
+          this[kReleaseData]();
+          this[kFinished] = true;
+          this.stream.session.sendData();
+          const err = new Error('The stream was reset, as the session is ' +
+                                'over its maxSessionMemory limit');
+          err.code = rv;
+          err.errno = rv;
+          // Errors passed to the callback of a write are emitted by the
+          // Writable; the final compressed output has no such callback.
+          if (callback === noop)
+            process.nextTick(() => this.emit('error', err));
+          callback(err);
+          return;
+        }
         this[kChunks].push(chunk);
+        this[kBufferedLength] += chunk.length;
+        updateOutgoingData(this.socket, chunk.length);
+      }
       this[kResume]();
       this[kBeginSend]();
       this.stream.session.sendData();
+      // Hold the callback back, causing write() to return false, while more
+      // is queued than the peer will currently accept plus the high water
+      // mark. It is invoked as nghttp2 takes the data, which happens as
+      // WINDOW_UPDATE frames arrive and the socket drains.
+      if (this[kBufferedLength] >
+          this.stream.fields[STREAM_FIELD_REMOTE_WINDOW_SIZE] +
+          this._writableState.highWaterMark) {
+        debug(`Http2Outgoing::_write BUFFER FULL [${this.stream.id}]`);
+        this[kWriteCallback] = callback;
+        return;
+      }
     } else {
       debug('Http2Outgoing::_write NOT WRITING, STREAM CLOSED ' +
             `[${this.stream.id}]`);
@@ -667,26 +958,145 @@ class Http2Outgoing extends Writable {
 
   end(data, encoding, callback) {
     debug(`Http2Outgoing::end [${this.stream.id}]`);
-    this[kFinished] = true;
-    const state = this.stream.state;
-    if (!this.socket.destroyed &&
+    if (this[kAcceptEncoding] !== undefined) {
+      // Nothing has been written yet, so data is the whole body
+      this[kNegotiate](typeof data === 'string' ?
+          Buffer.byteLength(data, typeof encoding === 'string' ?
+                                      encoding : undefined) :
+          Buffer.isBuffer(data) ? data.length : 0);
+    }
+    const state = this.stream.fields[STREAM_FIELD_STATE];
+    const writable = !this.socket.destroyed &&
         state !== constants.NGHTTP2_STREAM_STATE_CLOSED &&
-        state !== constants.NGHTTP2_STREAM_STATE_HALF_CLOSED_LOCAL) {
+        state !== constants.NGHTTP2_STREAM_STATE_HALF_CLOSED_LOCAL;
+    if (this[kCompressor] !== undefined && writable &&
+        !this._writableState.ending) {
+      // The end of the compressed body is only known once every chunk has
+      // been compressed, after which 'prefinish' is emitted. Until then the
+      // stream is not finished, so the DATA frames do not end it.
+      this.once('prefinish', () => {
+        const compressor = this[kCompressor];
+        if (compressor === undefined)
+          return;
+        compressor.write(null, zlibConstants.Z_FINISH, (err, output) => {
+          this[kFinishCompression](err);
+          if (!err)
+            this[kWriteData](output, noop);
+        });
+      });
+      super.end(data, encoding, callback);
+      this[kBeginSend]();
+      return;
+    }
+    this[kFinished] = true;
+    if (writable) {
       super.end(data, encoding, callback);
       this[kResume]();
       this[kBeginSend]();
     }
   }
 
+  // Called as nghttp2 takes length bytes of queued data
+  [kTakeData](length) {
+    this[kBufferedLength] -= length;
+    updateOutgoingData(this.socket, -length);
+    const callback = this[kWriteCallback];
+    if (callback !== null &&
+        this[kBufferedLength] <=
+            this._writableState.highWaterMark +
+            this.stream.fields[STREAM_FIELD_REMOTE_WINDOW_SIZE]) {
+      this[kWriteCallback] = null;
+      process.nextTick(callback);
+    }
+  }
+
+  // Discards any queued data, as when the stream has been closed
+  [kReleaseData]() {
+    this[kReleaseCompressor]();
+    this[kChunks].length = 0;
+    updateOutgoingData(this.socket, -this[kBufferedLength]);
+    this[kBufferedLength] = 0;
+    const callback = this[kWriteCallback];
+    if (callback !== null) {
+      this[kWriteCallback] = null;
+      process.nextTick(callback);
+    }
+  }
+
+  // Decides, once the response headers are final, whether the body is
+  // compressed with the content coding accepted by the client. length is
+  // the size of the body, if known.
+  [kNegotiate](length) {
+    const encoding = this[kAcceptEncoding];
+    this[kAcceptEncoding] = undefined;
+    if (this[kHeadersSent] || this[kHeaderTemplate] !== undefined ||
+        !this[kCompression].compressible(this[kHeaders], length)) {
+      return;
+    }
+    debug(`Http2Outgoing::kNegotiate [${this.stream.id}, ${encoding}]`);
+    this[kCompressor] = this[kCompression].acquire(encoding);
+  }
+
+  // Returns the compressor to the pool of the server once the body is
+  // complete, or on err, after which the stream is reset. callback, if
+  // given, is the callback of the write that failed.
+  [kFinishCompression](err, callback) {
+    if (err) {
+      debug(`Http2Outgoing::kFinishCompression [${this.stream.id}, ` +
+            `${err.message}]`);
+      const stream = this.stream;
+      checkSuccessOrEmitError(
+          stream.session,
+          stream.sendRstStream(constants.NGHTTP2_INTERNAL_ERROR));
+    } else {
+      this[kFinished] = true;
+    }
+    this[kReleaseCompressor]();
+    if (callback !== undefined)
+      callback();
+  }
+
+  // Compressors that are still compressing are released when they are
+  // done, by kFinishCompression
+  [kReleaseCompressor]() {
+    const compressor = this[kCompressor];
+    if (compressor !== undefined && !compressor.busy) {
+      this[kCompressor] = undefined;
+      this[kCompression].release(compressor);
+    }
+  }
+
+  // Keeps each chunk written while the response may still be cached, and
+  // gives up once the response is too large for the cache
+  [kCacheWrite](chunk) {
+    this[kCacheLength] += chunk.length;
+    if (this[kCacheLength] > this[kResponseCache].maxEntrySize) {
+      this[kCacheChunks] = undefined;
+      return;
+    }
+    this[kCacheChunks].push(chunk);
+  }
+
   [kBeginSend]() {
     debug(`Http2Outgoing::kBeginSend [${this.stream.id}]`);
     if (!this[kHeadersSent]) {
       debug(`Http2Outgoing::kBeginSend [${this.stream.id}, SENDING HEADERS]`);
       this[kHeadersSent] = true;
       const stream = this.stream;
-      checkSuccessOrEmitError(
-          stream.session,
-          stream.respond(mapToHeaders(this[kHeaders]), this[kProvider]));
+      var headers = mapToHeaders(this[kHeaders]);
+      // The date header, if requested, is supplied by the native layer
+      const sendDate = Boolean(this.sendDate) && !this[kHeaders].has('date');
+      if (this[kCacheChunks] !== undefined)
+        this[kCacheHeaders] = headers;
+      // The cache keeps the identity response, while the client is sent
+      // the compressed one
+      const compressor = this[kCompressor];
+      if (compressor !== undefined)
+        headers = compressedHeaders(this[kHeaders], compressor.encoding);
+      checkHeadersOrThrow(
+          stream,
+          stream.respond(headers[0], headers[1], this[kProvider],
+                         this[kHeaderTemplate], sendDate));
     }
   }
 
@@ -711,9 +1121,10 @@ class Http2Outgoing extends Writable {
       debug(`Http2Outgoing::kEndStream [${this.stream.id}, HAS TRAILERS]`);
       flags[constants.FLAG_NOENDSTREAM] = true;
       const stream = this.stream;
-      checkSuccessOrEmitError(
-          stream.session,
-          stream.sendTrailers(mapToHeaders(this[kTrailers])));
+      const trailers = mapToHeaders(this[kTrailers]);
+      checkHeadersOrResetStream(
+          stream,
+          stream.sendTrailers(trailers[0], trailers[1]));
     } else {
       flags[constants.FLAG_ENDSTREAM] = true;
     }
@@ -774,13 +1185,165 @@ class Http2ServerResponse extends Http2Outgoing {
     return new Http2PushResponse(this);
   }
 
-  [kBeginSend]() {
-    if (!this[kHeadersSent] && this.sendDate)
-      this.setHeader('date', utcDate());
-    super[kBeginSend]();
+  /**
+   * Responds with options.length bytes of the file descriptor fd, starting
+   * at options.offset. The data is read on the libuv threadpool straight
+   * into DATA frames, as the peer's flow control windows allow. offset
+   * defaults to 0 and length to the rest of the file. Headers set on the
+   * response are sent along with a content-length header. The file
+   * descriptor is not closed.
+   **/
+  respondWithFD(fd, options) {
+    if (!Number.isInteger(fd) || fd < 0)
+      throw new TypeError('fd must be a file descriptor');
+    if (this.headersSent)
+      throw new Error('Cannot respond after the headers are sent');
+    options = options || {};
+    const offset = options.offset === undefined ? 0 : options.offset;
+    if (!Number.isInteger(offset) || offset < 0)
+      throw new RangeError('offset must be a non-negative integer');
+    const length = options.length;
+    if (length !== undefined && (!Number.isInteger(length) || length < 0))
+      throw new RangeError('length must be a non-negative integer');
+    this[kHeadersSent] = true;
+    this[kFinished] = true;
+    if (length !== undefined) {
+      this[kRespondWithFD](fd, offset, length, false);
+      return this;
+    }
+    fs.fstat(fd, (err, stat) => {
+      if (err) {
+        this.emit('error', err);
+        return;
+      }
+      this[kRespondWithFD](fd, offset, Math.max(stat.size - offset, 0), false);
+    });
+    return this;
+  }
+
+  /**
+   * Responds with the contents of the file at path, in the same way as
+   * respondWithFD(). Unless options.range is false, a single byte range
+   * requested with a range header is served as a 206 response, and a range
+   * that cannot be satisfied is answered with a 416. If the file cannot be
+   * opened, 'error' is emitted and the response may still be used.
+   **/
+  respondWithFile(path, options) {
+    if (this.headersSent)
+      throw new Error('Cannot respond after the headers are sent');
+    options = options || {};
+    this[kHeadersSent] = true;
+    const fail = (err, fd) => {
+      if (fd !== undefined)
+        fs.close(fd, () => {});
+      this[kHeadersSent] = false;
+      this.emit('error', err);
+    };
+    fs.open(path, 'r', (err, fd) => {
+      if (err)
+        return fail(err);
+      fs.fstat(fd, (err, stat) => {
+        if (err)
+          return fail(err, fd);
+        if (!stat.isFile()) {
+          const err = new Error(`Not a regular file: ${path}`);
+          err.code = 'EISDIR';
+          return fail(err, fd);
+        }
+        const size = stat.size;
+        var offset = 0;
+        var length = size;
+        const request = this.stream[kRequest];
+        const range = options.range !== false && request ?
+            parseRange(request.headers.get('range'), size) : undefined;
+        this.setHeader('accept-ranges', 'bytes');
+        if (range === null) {
+          this.statusCode = constants.HTTP_STATUS_RANGE_NOT_SATISFIABLE;
+          this.setHeader('content-range', `bytes */${size}`);
+          length = 0;
+        } else if (range !== undefined) {
+          this.statusCode = constants.HTTP_STATUS_PARTIAL_CONTENT;
+          this.setHeader('content-range',
+                         `bytes ${range[0]}-${range[1]}/${size}`);
+          offset = range[0];
+          length = range[1] - range[0] + 1;
+        }
+        this[kFinished] = true;
+        this[kRespondWithFD](fd, offset, length, true);
+      });
+    });
+    return this;
+  }
+
+  [kRespondWithFD](fd, offset, length, closeFd) {
+    const stream = this.stream;
+    const session = stream.session;
+    const state = stream.fields[STREAM_FIELD_STATE];
+    if (this.socket.destroyed ||
+        state === constants.NGHTTP2_STREAM_STATE_CLOSED ||
+        state === constants.NGHTTP2_STREAM_STATE_HALF_CLOSED_LOCAL) {
+      debug(`Http2ServerResponse::respondWithFD CLOSED [${stream.id}]`);
+      if (closeFd)
+        fs.close(fd, () => {});
+      return;
+    }
+    debug(`Http2ServerResponse::respondWithFD [${stream.id}, ${fd}, ` +
+          `${offset}, ${length}]`);
+    this[kHeaders].set('content-length', String(length));
+    const headers = mapToHeaders(this[kHeaders]);
+    const sendDate = Boolean(this.sendDate) && !this[kHeaders].has('date');
+    const request = stream[kRequest];
+    if (length === 0 ||
+        (request && request.method === 'HEAD')) {
+      // There is no body to send
+      if (closeFd)
+        fs.close(fd, () => {});
+      checkHeadersOrResetStream(
+          stream,
+          stream.respond(headers[0], headers[1], undefined,
+                         this[kHeaderTemplate], sendDate));
+    } else {
+      checkHeadersOrResetStream(
+          stream,
+          stream.respondWithFD(headers[0], headers[1], fd, offset, length,
+                               this[kHeaderTemplate], sendDate, closeFd));
+    }
+    session.sendData();
   }
 }
 
+// Parses the value of a range header for a resource of size bytes. Returns
+// the first and last byte of a single satisfiable range, null if the range
+// cannot be satisfied, or undefined if the header is absent or is to be
+// ignored, as it is when more than one range is requested.
+function parseRange(value, size) {
+  if (typeof value !== 'string')
+    return undefined;
+  const match = /^\s*bytes\s*=\s*(\d*)\s*-\s*(\d*)\s*$/i.exec(value);
+  if (match === null || (match[1] === '' && match[2] === ''))
+    return undefined;
+  var first;
+  var last;
+  if (match[1] === '') {
+    // A suffix range of the final bytes
+    const suffix = Number(match[2]);
+    if (suffix === 0)
+      return null;
+    first = Math.max(size - suffix, 0);
+    last = size - 1;
+  } else {
+    first = Number(match[1]);
+    last = match[2] === '' ? size - 1 : Number(match[2]);
+    // A last byte before the first makes the range invalid
+    if (last < first)
+      return undefined;
+    last = Math.min(last, size - 1);
+  }
+  if (first >= size)
+    return null;
+  return [first, last];
+}
+
 class Http2PushResponse extends EventEmitter {
   constructor(response) {
     super();
@@ -834,7 +1397,8 @@ class Http2PushResponse extends EventEmitter {
       throw new TypeError('callback must be a function');
     const parent = this[kResponse].stream;
     debug(`Http2PushResponse::push [${parent.id}, ${this[kHeaders]}]`);
-    const ret = parent.sendPushPromise(mapToHeaders(this[kHeaders]));
+    const headers = mapToHeaders(this[kHeaders]);
+    const ret = parent.sendPushPromise(headers[0], headers[1]);
     if (!isNaN(ret)) {
       // If the return value is a number, it is an error
       checkSuccessOrEmitError(parent.session, ret);
@@ -843,7 +1407,7 @@ class Http2PushResponse extends EventEmitter {
     debug(`Http2PushResponse::push [${parent.id}, CREATED ${ret.id}]`);
     Object.defineProperty(ret, 'session', {
       enumerable: true,
-      configurable: false,
+      configurable: true,
       value: parent.session
     });
     ret[kRequest] =
@@ -855,137 +1419,808 @@ class Http2PushResponse extends EventEmitter {
   }
 }
 
-// TODO(jasnell): improve performance on these
 // The HTTP/2 spec forbids request pseudo-headers from appearing within
 // responses, and response pseudo-headers from appearing with requests.
-// Improper use must be handled as malformed messages.
+// Improper use must be handled as malformed messages. The pseudo-headers
+// that are sent are set by this module, so user supplied names starting
+// with ':' are rejected before they reach the native layer.
 function isPseudoHeader(name) {
-  return String(name)[0] === ':';
+  return name.charCodeAt(0) === 58;  // ':'
 }
 
-// HTTP/2 strictly forbids the use of connection specific headers. In
-// particular, Connection, Upgrade and HTTP2-Settings must not be used
-// within HTTP/2 requests or response messages. Their use must be handled
-// as malformed messages.
-// TODO(jasnell): improve performance on this.
-function isIllegalConnectionSpecificHeader(name, value) {
-  if (/^(?:connection|upgrade|http2-settings)$/i.test(name))
-    return true;
-  if (/^te$/i.test(name) && !/^trailers$/i.test(value))
-    return true;
-  return false;
+// A header block rejected by the native layer only concerns the stream it
+// was submitted on, which is reset rather than failing the whole session.
+function checkHeadersOrResetStream(stream, rv) {
+  if (rv === constants.HTTP2_ERR_INVALID_HEADER_NAME ||
+      rv === constants.HTTP2_ERR_CONNECTION_SPECIFIC_HEADER) {
+    debug(`Invalid header block [${stream.id}, ` +
+          `${http2.nghttp2ErrorString(rv)}]`);
+    checkSuccessOrEmitError(
+        stream.session,
+        stream.sendRstStream(constants.NGHTTP2_INTERNAL_ERROR));
+    return false;
+  }
+  return checkSuccessOrEmitError(stream.session, rv);
+}
+
+// Like checkHeadersOrResetStream(), for a header block submitted while the
+// code that set the headers is still on the stack. An invalid or
+// connection-specific (RFC 7540, Section 8.1.2.2) header name is also
+// thrown, with the native error code as err.code.
+function checkHeadersOrThrow(stream, rv) {
+  if (checkHeadersOrResetStream(stream, rv) ||
+      (rv !== constants.HTTP2_ERR_INVALID_HEADER_NAME &&
+       rv !== constants.HTTP2_ERR_CONNECTION_SPECIFIC_HEADER)) {
+    return;
+  }
+  const err = new Error(http2.nghttp2ErrorString(rv));
+  err.code = rv;
+  err.errno = rv;
+  throw err;
 }
 
-// Converts a Map objects to an array of Http2Header objects for serialization.
-// TODO(jasnell): need to determine if this is the best approach. It may not
-// performant enough to represent each header pair as a separate object like
-// this. The reason to do so currently is because nghttp2 represents each as a
-// separate struct, and for each instance, a decision must be made with regards
-// to how the individual header is handled with regards to HPACK.
+// Packs a Map of headers into a single string of NUL-terminated names and
+// values for submission to the native layer. Returns the packed block along
+// with the number of name-value pairs it contains. Repeated headers are
+// stored in the Map as an Array of values and emit one pair per value.
+// Values are stringified here, while the names are checked, and lowercased,
+// only by the native layer in a single pass over the block.
 function mapToHeaders(map) {
-  const ret = [];
+  var block = '';
+  var count = 0;
   if (!(map instanceof Map))
-    return ret;
+    return [block, count];
   for (const v of map) {
     const key = v[0];
     const value = v[1];
     if (Array.isArray(value)) {
-      for (const item of value)
-        ret.push(new http2.Http2Header(key, String(item)));
+      for (const item of value) {
+        block += `${key}\0${item}\0`;
+        count++;
+      }
     } else {
-      ret.push(new http2.Http2Header(key, String(value)));
+      block += `${key}\0${value}\0`;
+      count++;
     }
   }
-  return ret;
+  return [block, count];
 }
 
 
-// class Http2ClientRequest extends Http2Outgoing {
-//   constructor(stream, socket) {
-//     super(stream, socket);
-//   }
-// }
-
-// Copies data from the given chunks to the buffer, up to buffer.length,
-// Removes the written data from chunks. Returns the total number of
-// bytes copied. This method is called when chunking data into individual
-// HTTP/2 data frames. The buffer represents the total amount of data that
-// can be included in the frame, chunks is the data pending to write to
-// those data frames.
-// TODO(jasnell): Improve performance on this
-function copyBuffers(buffer, chunks, offset) {
-  if (chunks.length === 0) return 0;
-  var current = chunks[0];
-  offset |= 0;
-  if (current.length <= buffer.length - offset) {
-    var copied = current.copy(buffer, offset, 0);
-    chunks.shift();
-    if (chunks.length > 0)
-      copied += copyBuffers(buffer, chunks, offset + copied);
-    return copied;
-  } else {
-    const len = buffer.length - offset;
-    current.copy(buffer, offset, 0, len);
-    chunks[0] = current.slice(len);
-    return len;
+// The request headers are submitted along with the stream by
+// Http2ClientSession.request(), so only the body is written through the
+// Http2ClientRequest. The response is delivered by the 'response' event.
+class Http2ClientRequest extends Http2Outgoing {
+  constructor(stream, socket, provider) {
+    super(stream, socket, provider);
+    this[kHeadersSent] = true;
   }
 }
 
-// The HTTP/2 Server Connection Listener. This is used for both the TLS and
-// non-TLS variants. For every socket, there is exactly one Http2Session.
-// TODO(jasnell): Currently, a new Http2Session instance is created for every
-// socket. We should investigate whether it would be possible to use pooling
-// like we do with http-parser instances currently. It might not be possible
-// due to long term connection state management, but it's worth investigating
-// for performance.
-function connectionListener(socket) {
-  debug('New HTTP2 Server Connection');
-  const options = this[kOptions];
+// Removes up to length bytes worth of data from the front of chunks and
+// returns it as an array of Buffers. A chunk that does not fit entirely is
+// split using slice(), so no data is copied. This method is called when
+// chunking data into individual HTTP/2 data frames. The length represents
+// the total amount of data that can be included in the frame, chunks is the
+// data pending to write to those data frames.
+function takeBuffers(length, chunks) {
+  const ret = [];
+  while (length > 0 && chunks.length > 0) {
+    const current = chunks[0];
+    if (current.length <= length) {
+      ret.push(current);
+      chunks.shift();
+      length -= current.length;
+    } else {
+      ret.push(current.slice(0, length));
+      chunks[0] = current.slice(length);
+      length = 0;
+    }
+  }
+  return ret;
+}
 
-  // Create the Http2Session instance that is unique to this socket.
-  debug('Creating and associating Http2Session');
-  const session =
-      socket[kSession] =
-        createServerSession(socket, options);
-  debug(`Created Http2Session [UID: ${session._handle.uid}]`);
+// A resource registered with server.addPush(). Everything that does not
+// depend on the request is prepared once, when the resource is registered:
+// the PUSH_PROMISE and response header blocks are packed, and the body is
+// held as a Buffer or as an open file descriptor. HPACK state belongs to a
+// connection, so the response headers are registered as a header template
+// on each session the first time the resource is pushed on it.
+class Http2PushBundle {
+  constructor(path, options) {
+    if (typeof path !== 'string' || path[0] !== '/')
+      throw new TypeError('path must be a string starting with "/"');
+    options = options || {};
+    const interval = options.interval === undefined ?
+        kDefaultPushInterval : options.interval;
+    if (typeof interval !== 'number' || !(interval >= 0))
+      throw new RangeError('interval must be a non-negative number');
+    this.path = path;
+    this.interval = interval;
+    this.fd = -1;
+    this.body = undefined;
+    // The file descriptor is shared by every stream the file is being sent
+    // on, each of which holds a reference, as does the server until it
+    // closes. It is closed once the last reference is dropped.
+    this.refs = 1;
+    this.closed = false;
+
+    const map = new Map();
+    map.set(constants.HTTP2_HEADER_STATUS, constants.HTTP_STATUS_OK);
+    const headers = options.headers;
+    if (headers) {
+      const keys = headers instanceof Map ?
+          Array.from(headers.keys()) : Object.keys(headers);
+      for (var key of keys) {
+        const value = headers instanceof Map ? headers.get(key) : headers[key];
+        const name = String(key).toLowerCase();
+        if (isPseudoHeader(name))
+          throw new Error('Cannot set HTTP/2 pseudo-headers');
+        if (value !== undefined && value !== null)
+          map.set(name, value);
+      }
+    }
 
-  // `outgoingData` is an approximate amount of bytes queued through all
-  // inactive responses. If more data than the high watermark is queued - we
-  // need to pause TCP socket/HTTP parser, and wait until the data will be
-  // sent to the client.
-  socket[kOutgoingData] = 0;
-  // TODO(jasnell): Complete this
-  // function updateOutgoingData(delta) {
-  //   socket[kOutgoingData] += delta;
-  //   if (socket._paused &&
-  //       socket[kOutgoingData] < socket._writableState.highWaterMark) {
-  //     return socketOnDrain(socket);
-  //   }
-  // }
+    if (options.file !== undefined) {
+      const fd = fs.openSync(options.file, 'r');
+      const stat = fs.fstatSync(fd);
+      if (!stat.isFile()) {
+        fs.closeSync(fd);
+        const err = new Error(`Not a regular file: ${options.file}`);
+        err.code = 'EISDIR';
+        throw err;
+      }
+      this.fd = fd;
+      this.length = stat.size;
+    } else {
+      var body = options.body;
+      if (typeof body === 'string')
+        body = Buffer.from(body);
+      else if (body === undefined)
+        body = Buffer.alloc(0);
+      if (!Buffer.isBuffer(body))
+        throw new TypeError('body must be a Buffer or a string');
+      this.body = body;
+      this.length = body.length;
+    }
+    map.set('content-length', String(this.length));
+
+    this.headers = mapToHeaders(map);
+    // Preceded by :scheme and :authority, which are taken from the request
+    this.promise = `:method\0GET\0:path\0${path}\0`;
+  }
+
+  // Submits the response on the pushed stream
+  respond(session, stream) {
+    var templates = session[kPushTemplates];
+    if (templates === undefined)
+      templates = session[kPushTemplates] = new Map();
+    var id = templates.get(this);
+    var block = '';
+    var count = 0;
+    if (id === undefined) {
+      id = session._handle.createHeaderTemplate(this.headers[0],
+                                                this.headers[1]);
+      if (id === constants.HTTP2_ERR_TOO_MANY_HEADER_TEMPLATES) {
+        // The session has no room for another template, so the headers
+        // are submitted on their own
+        id = undefined;
+        block = this.headers[0];
+        count = this.headers[1];
+      } else if (id < 0) {
+        return id;
+      } else {
+        templates.set(this, id);
+      }
+    }
+    if (this.length === 0)
+      return stream.respond(block, count, undefined, id, true);
+    if (this.fd >= 0) {
+      var streams = session[kPushStreams];
+      if (streams === undefined)
+        streams = session[kPushStreams] = new Map();
+      streams.set(stream, this);
+      this.refs++;
+      return stream.respondWithFD(block, count, this.fd, 0, this.length, id,
+                                  true, false);
+    }
+    return stream.respondWithBuffer(block, count, this.body, id, true);
+  }
 
-  // Set up the timeout listener
-  if (this.timeout)
-    socket.setTimeout(this.timeout);
-  socket.on('timeout', () => {
-    debug(`Socket Timeout for Http2Session [UID: ${session._handle.uid}]`);
-    if (!this.emit('timeout', socket)) {
-      debug('Socket Timeout not handled, destroying socket');
-      // Session timed out, attempt a graceful exit
-      session.gracefulTerminate(() => socket.destroy());
+  unref() {
+    if (--this.refs === 0 && this.fd >= 0) {
+      fs.close(this.fd, noop);
+      this.fd = -1;
     }
-  });
+  }
 
-  // Destroy the session if the socket is destroyed
-  const destroySocket = socket.destroy;
-  socket.destroy = function(error) {
-    if (session._handle) {
-      debug(`Destroying socket and Http2Session [UID: ${session._handle.uid}]`);
-      session.destroy();
+  // Drops the reference held by the server
+  close() {
+    if (!this.closed) {
+      this.closed = true;
+      this.unref();
     }
-    destroySocket.call(socket, error);
-  };
+  }
+}
 
-  socket.once('error', (error) => {
+// Drops the reference to the file of a push bundle held by stream, once the
+// stream has closed, or by every stream of session, once it is destroyed.
+function releasePushStreams(session, stream) {
+  const streams = session[kPushStreams];
+  if (streams === undefined)
+    return;
+  if (stream === undefined) {
+    for (const bundle of streams.values())
+      bundle.unref();
+    streams.clear();
+    return;
+  }
+  const bundle = streams.get(stream);
+  if (bundle !== undefined) {
+    streams.delete(stream);
+    bundle.unref();
+  }
+}
+
+/**
+ * Registers a resource to push whenever a GET request for the path
+ * trigger is received, as if requested with a GET request for path.
+ * options.body is the body as a Buffer or string, or options.file the
+ * name of a file to send, which is opened straight away and kept open
+ * until the server has closed and no stream is sending it. Neither may
+ * change once registered.
+ * options.headers holds the response headers; the status is 200 and the
+ * content-length is added. A resource is not pushed again on the same
+ * session for options.interval milliseconds (one minute by default).
+ * Shared by both server classes.
+ **/
+function addPush(server, trigger, path, options) {
+  if (typeof trigger !== 'string' || trigger[0] !== '/')
+    throw new TypeError('trigger must be a string starting with "/"');
+  const bundle = new Http2PushBundle(path, options);
+  var manifest = server[kPushManifest];
+  if (manifest === undefined) {
+    manifest = server[kPushManifest] = new Map();
+    server.once('close', () => {
+      for (const bundles of manifest.values()) {
+        for (const bundle of bundles)
+          bundle.close();
+      }
+      manifest.clear();
+    });
+  }
+  const bundles = manifest.get(trigger);
+  if (bundles === undefined)
+    manifest.set(trigger, [bundle]);
+  else
+    bundles.push(bundle);
+  return server;
+}
+
+// Pushes the resources registered for the path of a GET request. Called
+// before the request is passed to the 'request' listeners, so that the
+// PUSH_PROMISE frames are sent ahead of the response. Nothing is pushed
+// once the peer has disabled push, and a resource pushed on the session
+// within its interval is not pushed again.
+function pushResources(manifest, session, stream, headers) {
+  if (headers.get(constants.HTTP2_HEADER_METHOD) !== 'GET')
+    return;
+  var path = headers.get(constants.HTTP2_HEADER_PATH);
+  if (path === undefined)
+    return;
+  const query = path.indexOf('?');
+  if (query !== -1)
+    path = path.slice(0, query);
+  const bundles = manifest.get(path);
+  const handle = session._handle;
+  if (bundles === undefined || !handle ||
+      handle.fields[SESSION_FIELD_REMOTE_ENABLE_PUSH] === 0) {
+    return;
+  }
+  const scheme = headers.get(constants.HTTP2_HEADER_SCHEME);
+  const authority = headers.get(constants.HTTP2_HEADER_AUTHORITY) ||
+                    headers.get('host');
+  if (scheme === undefined || authority === undefined)
+    return;
+  const origin = `:scheme\0${scheme}\0:authority\0${authority}\0`;
+
+  var pushed = session[kPushed];
+  if (pushed === undefined)
+    pushed = session[kPushed] = new Map();
+  const now = Date.now();
+  for (const bundle of bundles) {
+    const last = pushed.get(bundle);
+    if (last !== undefined && now - last < bundle.interval)
+      continue;
+    const ret = stream.sendPushPromise(origin + bundle.promise, 4);
+    if (typeof ret === 'number') {
+      // For instance, the peer has disabled push or allows no more streams
+      debug(`Http2Server: push of ${bundle.path} failed [${stream.id}, ` +
+            `${ret}]`);
+      return;
+    }
+    debug(`Http2Server: pushing ${bundle.path} [${stream.id}, ${ret.id}]`);
+    pushed.set(bundle, now);
+    Object.defineProperty(ret, 'session', {
+      enumerable: true,
+      configurable: true,
+      value: session
+    });
+    checkHeadersOrResetStream(ret, bundle.respond(session, ret));
+  }
+}
+
+function noop() {}
+
+// A zlib context that compresses response bodies, one at a time, on the
+// threadpool. Once a body is complete the context is reset and returned to
+// the pool of the server (see Http2Compression), so that the deflate state
+// of a context is only allocated once.
+class Http2Compressor {
+  constructor(encoding, level) {
+    this.encoding = encoding;
+    this.busy = false;
+    this.callback = null;
+    this.output = Buffer.allocUnsafe(zlibConstants.Z_DEFAULT_CHUNK);
+    this.offset = 0;
+    this.handle = new zlib.Zlib(encoding === 'gzip' ?
+        zlibConstants.GZIP : zlibConstants.DEFLATE);
+    // An error leaves the context unusable, so it is closed rather than
+    // returned to the pool
+    this.handle.onerror = (message, errno) => {
+      const callback = this.callback;
+      this.callback = null;
+      this.busy = false;
+      this.handle.close();
+      this.handle = null;
+      const err = new Error(message);
+      err.errno = errno;
+      if (callback !== null)
+        callback(err);
+    };
+    this.handle.init(zlibConstants.Z_DEFAULT_WINDOWBITS,
+                     level,
+                     zlibConstants.Z_DEFAULT_MEMLEVEL,
+                     zlibConstants.Z_DEFAULT_STRATEGY);
+  }
+
+  // Compresses input, or only flushes if input is null, then calls
+  // callback(err, output) with a Buffer holding whatever compressed data
+  // zlib has produced. Output is taken from a shared Buffer that is only
+  // replaced once full, so it is not copied unless zlib produces more than
+  // fits in the rest of it.
+  write(input, flush, callback) {
+    const handle = this.handle;
+    const chunks = [];
+    var inOff = 0;
+    var inLen = input === null ? 0 : input.length;
+    var outLen;
+    const step = () => {
+      outLen = this.output.length - this.offset;
+      handle.write(flush, input, inOff, inLen,
+                   this.output, this.offset, outLen);
+      handle.buffer = input;
+      handle.callback = after;
+    };
+    const after = (availIn, availOut) => {
+      const have = outLen - availOut;
+      if (have > 0) {
+        chunks.push(this.output.slice(this.offset, this.offset + have));
+        this.offset += have;
+      }
+      if (availOut === 0 || this.offset >= this.output.length) {
+        this.output = Buffer.allocUnsafe(zlibConstants.Z_DEFAULT_CHUNK);
+        this.offset = 0;
+      }
+      if (availOut === 0) {
+        // The output Buffer was filled before all of the input was consumed
+        inOff += inLen - availIn;
+        inLen = availIn;
+        return step();
+      }
+      handle.buffer = null;
+      handle.callback = null;
+      this.callback = null;
+      this.busy = false;
+      callback(null, chunks.length === 1 ? chunks[0] : Buffer.concat(chunks));
+    };
+    this.busy = true;
+    this.callback = callback;
+    step();
+  }
+
+  reset() {
+    this.handle.reset();
+  }
+
+  close() {
+    if (this.handle !== null) {
+      this.handle.close();
+      this.handle = null;
+    }
+  }
+}
+
+// Transparent compression of response bodies, enabled with the compression
+// server option. Bodies of compressible responses are compressed with gzip
+// or deflate, as negotiated with the accept-encoding request header, using
+// a pool of Http2Compressor objects for each content coding.
+class Http2Compression {
+  constructor(options) {
+    options = options || {};
+    this.level = options.level === undefined ?
+        zlibConstants.Z_DEFAULT_COMPRESSION : options.level;
+    if (typeof this.level !== 'number' ||
+        this.level < zlibConstants.Z_MIN_LEVEL ||
+        this.level > zlibConstants.Z_MAX_LEVEL) {
+      throw new RangeError(`Invalid compression level: ${this.level}`);
+    }
+    this.threshold = options.threshold === undefined ?
+        1024 : options.threshold;
+    this.poolSize = options.poolSize === undefined ? 8 : options.poolSize;
+    for (const name of ['threshold', 'poolSize']) {
+      if (typeof this[name] !== 'number' || !(this[name] >= 0))
+        throw new RangeError(`compression.${name} must be a ` +
+                             'non-negative number');
+    }
+    this.types = options.types === undefined ?
+        /^text\/|^application\/(json|javascript|xml)|\+(json|xml)\b|svg/i :
+        options.types;
+    if (!(this.types instanceof RegExp))
+      throw new TypeError('compression.types must be a RegExp');
+    this.pools = { gzip: [], deflate: [] };
+  }
+
+  // Returns the content coding to compress with for a request with the
+  // given accept-encoding header, preferring gzip, or undefined
+  negotiate(accept) {
+    if (typeof accept !== 'string')
+      return;
+    var gzip = -1;
+    var deflate = -1;
+    var any = -1;
+    const items = accept.split(',');
+    for (var n = 0; n < items.length; n++) {
+      const params = items[n].split(';');
+      const coding = params[0].trim().toLowerCase();
+      var q = 1;
+      for (var i = 1; i < params.length; i++) {
+        const param = params[i].trim();
+        if (param.startsWith('q='))
+          q = Number(param.slice(2)) || 0;
+      }
+      if (coding === 'gzip' || coding === 'x-gzip')
+        gzip = q;
+      else if (coding === 'deflate')
+        deflate = q;
+      else if (coding === '*')
+        any = q;
+    }
+    if (gzip < 0)
+      gzip = any;
+    if (deflate < 0)
+      deflate = any;
+    if (gzip > 0 && gzip >= deflate)
+      return 'gzip';
+    if (deflate > 0)
+      return 'deflate';
+  }
+
+  // Returns true if a response with the given headers, and a body of length
+  // bytes if known, is compressed
+  compressible(headers, length) {
+    const status = Number(headers.get(constants.HTTP2_HEADER_STATUS));
+    if (status < 200 || status >= 300 ||
+        status === constants.HTTP_STATUS_NO_CONTENT ||
+        status === constants.HTTP_STATUS_PARTIAL_CONTENT ||
+        headers.has('content-encoding') ||
+        /no-transform/i.test(headers.get('cache-control')) ||
+        !this.types.test(headers.get('content-type'))) {
+      return false;
+    }
+    if (headers.has('content-length'))
+      length = Number(headers.get('content-length'));
+    return length === undefined || length >= this.threshold;
+  }
+
+  acquire(encoding) {
+    const pool = this.pools[encoding];
+    if (pool.length > 0)
+      return pool.pop();
+    return new Http2Compressor(encoding, this.level);
+  }
+
+  release(compressor) {
+    if (compressor.handle === null)
+      return;
+    const pool = this.pools[compressor.encoding];
+    if (pool.length >= this.poolSize)
+      return compressor.close();
+    compressor.reset();
+    pool.push(compressor);
+  }
+
+  // Compresses a complete body on the threadpool, calling
+  // callback(err, body) once it is done
+  compress(encoding, body, callback) {
+    const compressor = this.acquire(encoding);
+    compressor.write(body, zlibConstants.Z_FINISH, (err, output) => {
+      this.release(compressor);
+      callback(err, output);
+    });
+  }
+
+  close() {
+    for (const encoding of Object.keys(this.pools)) {
+      const pool = this.pools[encoding];
+      for (var n = 0; n < pool.length; n++)
+        pool[n].close();
+      pool.length = 0;
+    }
+  }
+}
+
+// Adds accept-encoding to the vary header of a Map of response headers
+function varyAcceptEncoding(map) {
+  const vary = map.get('vary');
+  if (vary === undefined)
+    map.set('vary', 'accept-encoding');
+  else if (/(^|,)\s*accept-encoding\s*(,|$)/i.test(String(vary)))
+    return;
+  else if (Array.isArray(vary))
+    map.set('vary', vary.concat('accept-encoding'));
+  else
+    map.set('vary', `${vary}, accept-encoding`);
+}
+
+// Packs the headers of a response whose body is compressed with encoding.
+// The content-length of the identity body is left out.
+function compressedHeaders(headers, encoding) {
+  const map = new Map(headers);
+  map.delete('content-length');
+  map.set('content-encoding', encoding);
+  varyAcceptEncoding(map);
+  return mapToHeaders(map);
+}
+
+// An in-process cache of complete responses to GET requests, enabled with
+// the responseCache server option. Entries are keyed by the :scheme,
+// :authority and :path of the request and the values of the configured vary
+// request headers, and are kept for maxAge milliseconds. A hit is answered with the
+// packed header block and the body Buffer of the entry using
+// stream.respondWithBuffer(), before any request or response object is
+// created, so it never enters user code. Entries are evicted, least
+// recently used first, while they total more than maxSize bytes.
+class Http2ResponseCache {
+  constructor(options) {
+    options = options || {};
+    this.maxAge = options.maxAge === undefined ? 1000 : options.maxAge;
+    this.maxSize =
+        options.maxSize === undefined ? 16 * 1024 * 1024 : options.maxSize;
+    this.maxEntrySize =
+        options.maxEntrySize === undefined ? 1024 * 1024 :
+                                             options.maxEntrySize;
+    for (const name of ['maxAge', 'maxSize', 'maxEntrySize']) {
+      if (typeof this[name] !== 'number' || !(this[name] >= 0))
+        throw new RangeError(`responseCache.${name} must be a ` +
+                             'non-negative number');
+    }
+    this.vary = (options.vary || []).map((name) => String(name).toLowerCase());
+    this.entries = new Map();
+    this.size = 0;
+  }
+
+  // Returns the key of a request that may be answered from the cache, or
+  // undefined. Requests carrying credentials are only cached if the
+  // credentials are part of the key.
+  key(headers) {
+    if (headers.get(constants.HTTP2_HEADER_METHOD) !== 'GET')
+      return;
+    if (headers.has('authorization') && !this.vary.includes('authorization'))
+      return;
+    if (headers.has('cookie') && !this.vary.includes('cookie'))
+      return;
+    const authority = headers.get(constants.HTTP2_HEADER_AUTHORITY) ||
+                      headers.get('host');
+    var key = `${headers.get(constants.HTTP2_HEADER_SCHEME)}\0${authority}` +
+              `\0${headers.get(constants.HTTP2_HEADER_PATH)}`;
+    for (var n = 0; n < this.vary.length; n++) {
+      const value = headers.get(this.vary[n]);
+      key += value === undefined ? '\0' : `\0${value}`;
+    }
+    return key;
+  }
+
+  // Returns the entry stored for key unless it has expired
+  lookup(key) {
+    const entry = this.entries.get(key);
+    if (entry === undefined)
+      return;
+    this.entries.delete(key);
+    if (Date.now() >= entry.expires) {
+      this.size -= entry.size;
+      return;
+    }
+    // Most recently used entries are kept at the end of the Map
+    this.entries.set(key, entry);
+    return entry;
+  }
+
+  // Answers a request with entry, or with its variant compressed with
+  // encoding once there is one
+  respond(session, stream, entry, compression, encoding) {
+    if (encoding !== undefined && entry.headers !== undefined) {
+      const variant = entry.variants[encoding];
+      if (variant)
+        entry = variant;
+      else if (variant === undefined)
+        this.compress(entry, compression, encoding);
+    }
+    debug(`Http2Server: responding from cache [${stream.id}]`);
+    const rv = entry.body.length > 0 ?
+        stream.respondWithBuffer(entry.block, entry.count, entry.body,
+                                 undefined, entry.sendDate) :
+        stream.respond(entry.block, entry.count, undefined, undefined,
+                       entry.sendDate);
+    checkSuccessOrEmitError(session, rv);
+    session.sendData();
+  }
+
+  // Compresses the body of entry on the threadpool. The identity variant is
+  // sent until it is done, and from then on if compression does not make
+  // the body any smaller.
+  compress(entry, compression, encoding) {
+    entry.variants[encoding] = null;
+    compression.compress(encoding, entry.body, (err, body) => {
+      if (err || body.length >= entry.body.length)
+        return;
+      const headers = compressedHeaders(entry.headers, encoding);
+      const variant = {
+        block: headers[0] + `content-length\0${body.length}\0`,
+        count: headers[1] + 1,
+        body,
+        sendDate: entry.sendDate
+      };
+      entry.variants[encoding] = variant;
+      if (this.entries.get(entry.key) === entry) {
+        const size = variant.block.length + body.length;
+        entry.size += size;
+        this.size += size;
+        this.evict();
+      }
+    });
+  }
+
+  evict() {
+    for (const [oldest, value] of this.entries) {
+      if (this.size <= this.maxSize)
+        break;
+      this.entries.delete(oldest);
+      this.size -= value.size;
+    }
+  }
+
+  // Called once the response has been written in full. Stores it unless
+  // it is not a plain 200 response, has trailers, which are not replayed
+  // from the cache, or tells caches not to store it.
+  store(response) {
+    const key = response[kCacheKey];
+    const chunks = response[kCacheChunks];
+    var packed = response[kCacheHeaders];
+    const headers = response[kHeaders];
+    response[kCacheChunks] = undefined;
+    if (chunks === undefined || packed === undefined ||
+        response[kHeaderTemplate] !== undefined ||
+        response[kTrailers].size > 0 ||
+        Number(headers.get(constants.HTTP2_HEADER_STATUS)) !==
+            constants.HTTP_STATUS_OK ||
+        headers.has('set-cookie') ||
+        /no-store|no-cache|private/i.test(headers.get('cache-control'))) {
+      return;
+    }
+    const vary = headers.get('vary');
+    if (vary !== undefined) {
+      for (const name of String(vary).split(',')) {
+        if (!this.vary.includes(name.trim().toLowerCase()))
+          return;
+      }
+    }
+
+    const body = Buffer.concat(chunks, response[kCacheLength]);
+    // The headers are kept to pack those of compressed variants
+    const compression = response[kCompression];
+    const compressible = compression !== undefined &&
+                         compression.compressible(headers, body.length);
+    // The identity variant of a compressible entry is also sent to clients
+    // that accept a compressed one, so caches must be told that it varies
+    if (compressible) {
+      const map = new Map(headers);
+      varyAcceptEncoding(map);
+      packed = mapToHeaders(map);
+    }
+    var block = packed[0];
+    var count = packed[1];
+    if (!headers.has('content-length')) {
+      block += `content-length\0${body.length}\0`;
+      count++;
+    }
+    const entry = {
+      key,
+      block,
+      count,
+      body,
+      sendDate: Boolean(response.sendDate) && !headers.has('date'),
+      expires: Date.now() + this.maxAge,
+      size: block.length + body.length,
+      headers: compressible ? headers : undefined,
+      variants: compressible ? { gzip: undefined, deflate: undefined } :
+                               undefined
+    };
+    if (entry.size > this.maxEntrySize)
+      return;
+    const previous = this.entries.get(key);
+    if (previous !== undefined) {
+      this.entries.delete(key);
+      this.size -= previous.size;
+    }
+    this.entries.set(key, entry);
+    this.size += entry.size;
+    this.evict();
+  }
+}
+
+function storeInCache() {
+  this[kResponseCache].store(this);
+}
+
+// The HTTP/2 Server Connection Listener. This is used for both the TLS and
+// non-TLS variants. For every socket, there is exactly one Http2Session.
+// A new Http2Session instance is created for every socket. Unlike
+// http-parser instances, sessions are not pooled: an nghttp2_session cannot
+// be reset, and a session lives as long as its connection, so its cost is
+// spread over every stream on it. The Http2Stream objects, which are created
+// for every request, are freed as soon as the stream closes (see
+// releaseStream()).
+function connectionListener(socket) {
+  debug('New HTTP2 Server Connection');
+  const options = this[kOptions];
+
+  // Create the Http2Session instance that is unique to this socket.
+  debug('Creating and associating Http2Session');
+  const session =
+      socket[kSession] =
+        createServerSession(options);
+  debug(`Created Http2Session [UID: ${session._handle.uid}]`);
+
+  // `outgoingData` is an approximate amount of bytes queued through all
+  // inactive responses. If more data than the high watermark is queued - we
+  // need to pause TCP socket/HTTP parser, and wait until the data will be
+  // sent to the client. See updateOutgoingData().
+  socket[kOutgoingData] = 0;
+
+  // Set up the timeout listener
+  if (this.timeout)
+    socket.setTimeout(this.timeout);
+  socket.on('timeout', () => {
+    debug(`Socket Timeout for Http2Session [UID: ${session._handle.uid}]`);
+    if (!this.emit('timeout', socket)) {
+      debug('Socket Timeout not handled, destroying socket');
+      // Session timed out, attempt a graceful exit
+      session.gracefulTerminate(() => socket.destroy());
+    }
+  });
+
+  // Destroy the session if the socket is destroyed
+  const destroySocket = socket.destroy;
+  socket.destroy = function(error) {
+    if (session._handle) {
+      debug(`Destroying socket and Http2Session [UID: ${session._handle.uid}]`);
+      session.destroy();
+    }
+    destroySocket.call(socket, error);
+  };
+
+  socket.once('error', (error) => {
     // If the socket experiences an error, there's not much that
     // we're going to be able to do as the error could have a
     // fatal impact on any number of open in-flight requests.
@@ -1003,56 +2238,10 @@ function connectionListener(socket) {
     }
   });
   //socket.on('end', () => {});
-  socket.on('data', (data) => {
-    // Pass data on to the session, then automatically send any
-    // buffered data waiting to be sent.
-    assert(Buffer.isBuffer(data));
-    debug(`Socket::data [UID: ${session._handle.uid}, ${data.length}]`);
-    session.receiveData(data);
-    session.sendData();
-  });
-  socket.on('resume', () => {
-    debug(`Socket::resume [UID: ${session._handle.uid}]`);
-    if (socket._paused) {
-      socket.pause();
-      return;
-    }
-    if (socket._handle && !socket._handle.reading) {
-      socket._handle.reading = true;
-      socket._handle.readStart();
-    }
-  });
-  socket.on('pause', () => {
-    debug(`Socket::pause [UID: ${session._handle.uid}]`);
-    if (socket._handle && socket._handle.reading) {
-      socket._handle.reading = false;
-      socket._handle.readStop();
-    }
-  });
-  socket.on('drain', () => socketOnDrain(socket));
 
-  // Wire the Http2Session events up.
-  session.on('send', (data) => {
-    if (!socket.destroyed) {
-      debug(`Http2Server::send [UID: ${session._handle.uid}, ${data.length}]`);
-      socket.write(data);
-    }
-  });
+  bindSocket(session, socket);
 
-  session.on('begin-headers', (stream, category) => {
-    // Each time this is called, a new block of header pairs
-    // is being processed. Create a new headers map to store
-    // them in.
-    debug('Http2Server::begin-headers [NEW HEADERS MAP]');
-    stream[kHeaders] = new Headers(category);
-  });
-  session.on('header', (stream, name, value) => {
-    assert(stream[kHeaders]);
-    stream[kHeaders].set(name, value);
-  });
-  session.on('headers-complete', (stream, finished) => {
-    const headers = stream[kHeaders];
-    assert(headers);
+  session.on('headers-complete', (stream, finished, headers) => {
     // This is a server, so the only header categories supported are
     // NGHTTP2_HCAT_REQUEST and NGHGTTP2_HCAT_HEADERS. Other categories
     // must result in a Protocol error per the spec.
@@ -1062,8 +2251,37 @@ function connectionListener(socket) {
         debug(
           `Http2Server: Initialize new request for Http2Stream [${stream.id}]`);
         assert(!stream[kRequest]);
+        const cache = this[kResponseCache];
+        const compression = this[kCompression];
+        const encoding = compression !== undefined ?
+            compression.negotiate(headers.get('accept-encoding')) : undefined;
+        var cacheKey;
+        if (cache !== undefined && finished) {
+          cacheKey = cache.key(headers);
+          const entry = cacheKey !== undefined ?
+              cache.lookup(cacheKey) : undefined;
+          if (entry !== undefined) {
+            if (this[kPushManifest] !== undefined)
+              pushResources(this[kPushManifest], session, stream, headers);
+            cache.respond(session, stream, entry, compression, encoding);
+            break;
+          }
+        }
         stream[kRequest] = new Http2ServerRequest(stream, headers, socket);
         stream[kResponse] = new Http2ServerResponse(stream, socket);
+        if (cacheKey !== undefined) {
+          const response = stream[kResponse];
+          response[kResponseCache] = cache;
+          response[kCacheKey] = cacheKey;
+          response[kCacheChunks] = [];
+          response.once('finish', storeInCache);
+        }
+        if (compression !== undefined) {
+          const response = stream[kResponse];
+          response[kCompression] = compression;
+          if (headers.get(constants.HTTP2_HEADER_METHOD) !== 'HEAD')
+            response[kAcceptEncoding] = encoding;
+        }
         // finished will be true if the header block included flags to end
         // the stream (such as when sending a GET request). In such cases,
         // mark the kRequest stream finished so no data will be read.
@@ -1114,6 +2332,8 @@ function connectionListener(socket) {
             break;
           }
         }
+        if (this[kPushManifest] !== undefined)
+          pushResources(this[kPushManifest], session, stream, headers);
         debug(`Http2Server: Emit request for Http2Stream [${stream.id}]`);
         process.nextTick(() => {
           this.emit('request', stream[kRequest], stream[kResponse]);
@@ -1153,21 +2373,12 @@ function connectionListener(socket) {
     }
     debug('Http2Server: Data-chunk for Http2Stream ' +
           `[${stream.id}, ${chunk.length}]`);
-    // TODO(jasnell): to properly handle padding, we should actually buffer
-    // this data and not write it to the request until the data-end event is
-    // emitted. See below.
     request.write(chunk);
   });
-  session.on('data-end', (stream, finished, padding) => {
-    // TODO: How to handle padding???? data-end will be triggered after the
-    // completion of each individual data frame. The spec allows each data
-    // frame to contain additional padding bytes that must be stripped from
-    // the data before passing on to the user. This means that we should not
-    // actually pass the data on to the request until data-end and the padding
-    // can be stripped. To accomplish this, the data-chunk event and this
-    // event need to be modified to buffer the data and strip the padding.
+  session.on('data-end', (stream, finished) => {
+    // Padding has already been removed from the data by nghttp2
     debug('Http2Server: Complete data frame received for Http2Stream ' +
-          `[${stream.id}, ${finished}, ${padding}]`);
+          `[${stream.id}, ${finished}]`);
     const request = stream[kRequest];
     assert(request);
     if (finished) {
@@ -1187,13 +2398,160 @@ function connectionListener(socket) {
       stream[kRequest].end();
       stream[kResponse][kFinished] = true;
     }
+    if (stream[kResponse])
+      stream[kResponse][kReleaseData]();
+    if (stream.fields[STREAM_FIELD_TIMED_OUT])
+      emitStreamTimeout(stream);
+    releasePushStreams(session, stream);
+    // Once every 'stream-close' listener has run
+    process.nextTick(releaseStream, stream);
   });
   session.localSettings = options.settings;
 }
 
+// Stands in for a stream that has been released, for the request and
+// response objects that still refer to it. It reports the stream as
+// closed, and anything submitted on it is ignored.
+// Fields of a ReleasedStream: closed, with no window left
+const kReleasedStreamFields = new Float64Array(STREAM_FIELD_COUNT);
+kReleasedStreamFields[STREAM_FIELD_STATE] =
+    constants.NGHTTP2_STREAM_STATE_CLOSED;
+
+class ReleasedStream {
+  constructor(stream) {
+    this.id = stream.id;
+    this.session = stream.session;
+    this.fields = kReleasedStreamFields;
+  }
+
+  get state() {
+    return constants.NGHTTP2_STREAM_STATE_CLOSED;
+  }
+
+  get localWindowSize() {
+    return 0;
+  }
+
+  get remoteWindowSize() {
+    return 0;
+  }
+
+  sendPushPromise() {
+    return constants.NGHTTP2_ERR_STREAM_CLOSED;
+  }
+}
+
+const kReleasedStreamMethods = [
+  'changeStreamPriority', 'queueData', 'respond', 'respondWithBuffer',
+  'respondWithFD', 'resumeData', 'sendContinue', 'sendPriority',
+  'sendRstStream', 'sendTrailers', 'setIdleTimeout', 'setPriority'
+];
+for (const name of kReleasedStreamMethods)
+  ReleasedStream.prototype[name] = () => 0;
+
+// Called when a stream has been reset because one of its deadlines passed
+function emitStreamTimeout(stream) {
+  debug(`Http2Stream timed out [${stream.id}]`);
+  if (stream[kRequest])
+    stream[kRequest].emit('timeout');
+  if (stream[kResponse])
+    stream[kResponse].emit('timeout');
+}
+
+// Called once a stream has closed and its request and response have been
+// brought to an end. The native stream is freed, so that its JS object can
+// be collected, and the request and response are given a ReleasedStream in
+// its place.
+function releaseStream(stream) {
+  const released = new ReleasedStream(stream);
+  const request = stream[kRequest];
+  const response = stream[kResponse];
+  if (request)
+    request[kStream] = released;
+  if (response)
+    response[kStream] = released;
+  stream[kRequest] = undefined;
+  stream[kResponse] = undefined;
+  delete stream.session;
+  stream.release();
+}
+
+// Connects an Http2Session to its socket, for both servers and clients.
+function bindSocket(session, socket) {
+  // Whenever possible, let the native Http2Session read from and write to
+  // the socket directly. The 'data' and 'send' handlers below are only used
+  // for sockets that do not expose a native stream handle.
+  session.consumeSocket(socket);
+  socket.on('data', (data) => {
+    // Pass data on to the session, then automatically send any
+    // buffered data waiting to be sent.
+    assert(Buffer.isBuffer(data));
+    debug(`Socket::data [UID: ${session._handle.uid}, ${data.length}]`);
+    session.receiveData(data);
+    session.sendData();
+    // Stop reading while the peer is not taking the frames already queued
+    const handle = session._handle;
+    if (handle &&
+        handle.fields[SESSION_FIELD_OUTBOUND_QUEUE_SIZE] >
+            kMaxOutboundQueueSize &&
+        !socket._paused) {
+      socket._paused = true;
+      socket.pause();
+    }
+  });
+  socket.on('resume', () => {
+    debug(`Socket::resume [UID: ${session._handle.uid}]`);
+    if (socket._paused) {
+      socket.pause();
+      return;
+    }
+    if (socket._handle && !socket._handle.reading) {
+      socket._handle.reading = true;
+      socket._handle.readStart();
+    }
+  });
+  socket.on('pause', () => {
+    debug(`Socket::pause [UID: ${session._handle.uid}]`);
+    if (socket._handle && socket._handle.reading) {
+      socket._handle.reading = false;
+      socket._handle.readStop();
+    }
+  });
+  socket.on('drain', () => {
+    socketOnDrain(socket);
+    session.sendData();
+  });
+
+  session.on('send', (data) => {
+    if (!socket.destroyed) {
+      debug(`Http2Session::send [UID: ${session._handle.uid}, ${data.length}]`);
+      socket.write(data);
+    }
+  });
+}
+
+function updateOutgoingData(socket, delta) {
+  socket[kOutgoingData] += delta;
+  const highWaterMark = socket._writableState.highWaterMark;
+  if (socket[kOutgoingData] > highWaterMark) {
+    if (!socket._paused) {
+      debug('Pausing socket, too much outgoing data queued');
+      socket._paused = true;
+      socket.pause();
+    }
+  } else if (socket._paused) {
+    socketOnDrain(socket);
+  }
+}
+
 function socketOnDrain(socket) {
   debug('Draining socket');
-  const needPause = socket[kOutgoingData] > socket._writableState.highWaterMark;
+  const session = socket[kSession];
+  const needPause =
+      socket[kOutgoingData] > socket._writableState.highWaterMark ||
+      (session && session._handle &&
+       session._handle.fields[SESSION_FIELD_OUTBOUND_QUEUE_SIZE] >
+           kMaxOutboundQueueSize);
   if (socket._paused && !needPause) {
     socket._paused = false;
     socket.resume();
@@ -1208,9 +2566,39 @@ function initializeOptions(options) {
     throw new TypeError(
         'options.settings must be an instance of Http2Settings');
   }
+  if (typeof options.schedulingPolicy === 'string') {
+    const policy = kSchedulingPolicies[options.schedulingPolicy];
+    if (policy === undefined) {
+      throw new TypeError(
+          `Unknown schedulingPolicy: ${options.schedulingPolicy}`);
+    }
+    options.schedulingPolicy = policy;
+  }
+  const quantum = options.schedulingQuantum;
+  if (quantum !== undefined && quantum !== 0 &&
+      !(quantum >= constants.HTTP2_MIN_SCHEDULING_QUANTUM)) {
+    throw new RangeError('schedulingQuantum must be 0 or at least ' +
+                         `${constants.HTTP2_MIN_SCHEDULING_QUANTUM}`);
+  }
   return options;
 }
 
+function createResponseCache(options) {
+  const cache = options.responseCache;
+  if (!cache)
+    return undefined;
+  return new Http2ResponseCache(cache === true ? {} : cache);
+}
+
+function createCompression(server, options) {
+  if (!options.compression)
+    return undefined;
+  const compression = new Http2Compression(
+      options.compression === true ? {} : options.compression);
+  server.once('close', () => compression.close());
+  return compression;
+}
+
 function initializeTLSOptions(options) {
   options = initializeOptions(options);
   options.ALPNProtocols = ['hc', 'h2'];
@@ -1222,6 +2610,8 @@ class Http2SecureServerSession extends TLSServer {
   constructor(options, requestListener) {
     super(initializeTLSOptions(options), connectionListener);
     this[kOptions] = options;
+    this[kResponseCache] = createResponseCache(this[kOptions]);
+    this[kCompression] = createCompression(this, this[kOptions]);
     this.timeout = kDefaultSocketTimeout;
     if (typeof requestListener === 'function')
       this.on('request', requestListener);
@@ -1231,6 +2621,11 @@ class Http2SecureServerSession extends TLSServer {
     });
   }
 
+  // See addPush()
+  addPush(trigger, path, options) {
+    return addPush(this, trigger, path, options);
+  }
+
   setTimeout(msecs, callback) {
     this.timeout = msecs;
     if (callback)
@@ -1243,11 +2638,18 @@ class Http2ServerSession extends NETServer {
   constructor(options, requestListener) {
     super(connectionListener);
     this[kOptions] = initializeOptions(options);
+    this[kResponseCache] = createResponseCache(this[kOptions]);
+    this[kCompression] = createCompression(this, this[kOptions]);
     this.timeout = kDefaultSocketTimeout;
     if (typeof requestListener === 'function')
       this.on('request', requestListener);
   }
 
+  // See addPush()
+  addPush(trigger, path, options) {
+    return addPush(this, trigger, path, options);
+  }
+
   setTimeout(msecs, callback) {
     this.timeout = msecs;
     if (callback)
@@ -1256,23 +2658,355 @@ class Http2ServerSession extends NETServer {
   }
 }
 
-class Http2ClientSession {
+// The client side of a single HTTP/2 connection. Any number of requests
+// may be made on one Http2ClientSession, each on its own stream. Requests
+// made before the socket connects are queued and sent once it does.
+class Http2ClientSession extends EventEmitter {
   constructor(options, callback) {
-    this[kOptions] = initializeOptions(options);
-    this[kSession] = createClientSession(options);
+    super();
+    options = initializeOptions(options);
+    this[kOptions] = options;
+    const session = this[kSession] = createClientSession(options);
+    const secure = options.protocol === 'https:';
+    const host = options.host || options.hostname || 'localhost';
+    const port = options.port || (secure ? 443 : 80);
+    this.authority = options.authority ||
+                     (port === (secure ? 443 : 80) ? host : `${host}:${port}`);
+    this.scheme = secure ? 'https' : 'http';
+    this[kStreams] = new Set();
+    this[kGoaway] = false;
+    session[kConnecting] = true;
+
+    debug(`Http2ClientSession::constructor [${this.scheme}://` +
+          `${this.authority}]`);
+    var socket = options.socket;
+    if (!socket) {
+      if (secure) {
+        socket = tls.connect(Object.assign({
+          host,
+          port,
+          servername: host,
+          ALPNProtocols: ['h2'],
+          NPNProtocols: ['h2']
+        }, options));
+      } else {
+        socket = net.connect({ host, port });
+      }
+    }
+    this[kSocket] = socket;
+    socket[kSession] = session;
+    socket[kOutgoingData] = 0;
+
+    if (typeof callback === 'function')
+      this.once('connect', callback);
+
+    const onConnect = () => {
+      debug('Http2ClientSession::connect');
+      session[kConnecting] = false;
+      bindSocket(session, socket);
+      session.sendData();
+      this.emit('connect', this);
+    };
+    if (options.socket && !socket.connecting)
+      process.nextTick(onConnect);
+    else
+      socket.once(secure ? 'secureConnect' : 'connect', onConnect);
+
+    socket.on('error', (error) => {
+      debug(`Http2ClientSession::socket-error [${error.message}]`);
+      this.emit('error', error);
+    });
+    socket.on('close', () => {
+      debug('Http2ClientSession::close');
+      this[kGoaway] = true;
+      session.destroy();
+      for (const stream of this[kStreams])
+        clientStreamClosed(this, stream, constants.NGHTTP2_CANCEL);
+      this.emit('close');
+    });
+
+    session.on('error', (error) => this.emit('error', error));
+    session.on('goaway', (code, lastStreamID) => {
+      debug(`Http2ClientSession::goaway [${code}, ${lastStreamID}]`);
+      this[kGoaway] = true;
+      this.emit('goaway', code, lastStreamID);
+    });
+    session.on('headers-complete', (stream, finished, headers) => {
+      clientHeadersComplete(this, stream, finished, headers);
+    });
+    session.on('data-chunk', (stream, chunk) => {
+      const response = stream[kResponse];
+      if (!response) {
+        checkSuccessOrEmitError(
+            session, stream.sendRstStream(constants.NGHTTP2_PROTOCOL_ERROR));
+        return;
+      }
+      response.write(chunk);
+    });
+    session.on('data-end', (stream, finished) => {
+      const response = stream[kResponse];
+      if (response && finished) {
+        response[kFinished] = true;
+        response.end();
+      }
+    });
+    session.on('stream-close', (stream, code) => {
+      debug(`Http2ClientSession::stream-close [${stream.id}, ${code}]`);
+      clientStreamClosed(this, stream, code);
+    });
+    session.localSettings = options.settings;
+  }
+
+  get socket() {
+    return this[kSocket];
+  }
+
+  get session() {
+    return this[kSession];
+  }
+
+  // The number of requests currently in progress on this session
+  get activeStreams() {
+    return this[kStreams].size;
+  }
+
+  // The number of requests the peer allows to be in progress at once
+  get maxConcurrentStreams() {
+    const settings = this[kSession].remoteSettings;
+    return settings ? settings.maxConcurrentStreams : 0;
+  }
+
+  // True if another request may be made on this session without waiting
+  // for one in progress to complete
+  get available() {
+    return !this[kGoaway] && this[kSession]._handle !== null &&
+           this.activeStreams < this.maxConcurrentStreams;
+  }
+
+  /**
+   * Submits a new request and returns its Http2ClientRequest. headers may
+   * be a Map or an object and may include the :method, :path, :scheme and
+   * :authority pseudo-headers, which default to GET, /, and the scheme and
+   * authority of the session. Unless options.endStream says otherwise, GET
+   * and HEAD requests are sent without a body and any other request is
+   * sent with the data written to the Http2ClientRequest.
+   **/
+  request(headers, options) {
+    options = options || {};
+    const session = this[kSession];
+    if (!session._handle || this[kGoaway])
+      throw new Error('The Http2ClientSession is closed');
+    const map = new Map();
+    map.set(constants.HTTP2_HEADER_METHOD, 'GET');
+    map.set(constants.HTTP2_HEADER_PATH, '/');
+    map.set(constants.HTTP2_HEADER_SCHEME, this.scheme);
+    map.set(constants.HTTP2_HEADER_AUTHORITY, this.authority);
+    if (headers) {
+      const keys = headers instanceof Map ?
+          Array.from(headers.keys()) : Object.keys(headers);
+      for (var key of keys) {
+        const value = headers instanceof Map ? headers.get(key) : headers[key];
+        if (value !== undefined && value !== null)
+          map.set(String(key).toLowerCase(), value);
+      }
+    }
+    const method = map.get(constants.HTTP2_HEADER_METHOD);
+    const endStream = options.endStream !== undefined ?
+        Boolean(options.endStream) : method === 'GET' || method === 'HEAD';
+
+    const provider = endStream ? undefined : new http2.Http2DataProvider();
+    const packed = mapToHeaders(map);
+    const stream = session._handle.request(packed[0], packed[1], provider);
+    if (typeof stream === 'number')
+      throw new Error(`HTTP2Error: ${http2.nghttp2ErrorString(stream)}`);
+    debug(`Http2ClientSession::request [${stream.id}, ${method}]`);
+    Object.defineProperty(stream, 'session', {
+      enumerable: true,
+      configurable: true,
+      value: session
+    });
+    const request = new Http2ClientRequest(stream, this[kSocket], provider);
+    stream[kRequest] = request;
+    this[kStreams].add(stream);
+    if (endStream)
+      request.end();
+    session.sendData();
+    return request;
+  }
+
+  // Stops new requests on the session and closes the socket once the
+  // requests in progress have completed.
+  close(callback) {
+    debug('Http2ClientSession::close');
+    this[kGoaway] = true;
+    if (typeof callback === 'function')
+      this.once('close', callback);
+    if (this.activeStreams === 0)
+      this[kSocket].end();
+  }
+
+  destroy(error) {
+    this[kGoaway] = true;
+    this[kSocket].destroy(error);
+  }
+}
+
+function clientHeadersComplete(client, stream, finished, headers) {
+  const session = client[kSession];
+  const request = stream[kRequest];
+  switch (headers[kType]) {
+    case constants.NGHTTP2_HCAT_RESPONSE:
+    case constants.NGHTTP2_HCAT_HEADERS:
+      if (!request) {
+        checkSuccessOrEmitError(
+            session, stream.sendRstStream(constants.NGHTTP2_PROTOCOL_ERROR));
+        return;
+      }
+      if (!stream[kResponse]) {
+        const status = headers.get(constants.HTTP2_HEADER_STATUS) | 0;
+        if (status >= 100 && status < 200) {
+          // Informational responses are followed by the final response
+          debug(`Http2ClientSession: Informational response [${stream.id}]`);
+          if (status === 100)
+            request.emit('continue');
+          return;
+        }
+        const response =
+            stream[kResponse] =
+              new Http2ClientResponse(stream, headers, client[kSocket]);
+        if (finished) {
+          response[kFinished] = true;
+          response.end();
+        }
+        debug(`Http2ClientSession: Emit response [${stream.id}, ${status}]`);
+        request.emit('response', response);
+      } else if (finished) {
+        // Trailing headers
+        stream[kResponse][kTrailers] = headers;
+      } else {
+        checkSuccessOrEmitError(
+            session, stream.sendRstStream(constants.NGHTTP2_PROTOCOL_ERROR));
+      }
+      break;
+    default:
+      // Pushed streams are not supported by the client
+      debug(`Http2ClientSession: Refusing stream [${stream.id}]`);
+      checkSuccessOrEmitError(
+          session, stream.sendRstStream(constants.NGHTTP2_REFUSED_STREAM));
+  }
+}
+
+function clientStreamClosed(client, stream, code) {
+  if (!client[kStreams].delete(stream))
+    return;
+  const request = stream[kRequest];
+  const response = stream[kResponse];
+  if (request) {
+    request[kReleaseData]();
+    request[kFinished] = true;
+  }
+  if (response) {
+    if (!response.complete) {
+      response[kFinished] = true;
+      response.end();
+    }
+  } else if (request) {
+    const err = new Error(`HTTP2Error: Stream closed with code ${code}`);
+    err.code = code;
+    request.emit('error', err);
+  }
+  if (stream.fields[STREAM_FIELD_TIMED_OUT])
+    emitStreamTimeout(stream);
+  client.emit('stream-close', stream, code);
+  process.nextTick(releaseStream, stream);
+  if (client[kGoaway] && client[kStreams].size === 0 &&
+      !client[kSocket].destroyed) {
+    client[kSocket].end();
   }
 }
 
 // There are several differences between this and _http_agent. Namely,
 // sockets are always assumed to be long lived and always have an associated
-// Http2Session.
-// class Http2Agent extends EventEmitter {
-//   constructor(options) {
-//     super();
-//     this[kSockets] = new WeakMap();
-//     this.on('free', (socket, options) => {});
-//   }
-// }
+// Http2Session. Each origin has one Http2ClientSession that all requests
+// are multiplexed over. A further session to the same origin is only opened
+// while each of the existing ones has as many requests in progress as the
+// peer's MAX_CONCURRENT_STREAMS setting allows.
+class Http2Agent extends EventEmitter {
+  constructor(options) {
+    super();
+    this[kOptions] = options || {};
+    this[kSessions] = new Map();
+  }
+
+  // The sessions currently open, keyed by origin
+  get sessions() {
+    return this[kSessions];
+  }
+
+  getName(options) {
+    const secure = options.protocol === 'https:';
+    const host = options.host || options.hostname || 'localhost';
+    const port = options.port || (secure ? 443 : 80);
+    return `${secure ? 'https:' : 'http:'}//${host}:${port}`;
+  }
+
+  // Returns a session for the origin of options that can take another
+  // request, opening a new one if there is none.
+  getSession(options) {
+    const name = this.getName(options);
+    var list = this[kSessions].get(name);
+    if (list !== undefined) {
+      for (var n = 0; n < list.length; n++) {
+        if (list[n].available)
+          return list[n];
+      }
+    } else {
+      list = [];
+      this[kSessions].set(name, list);
+    }
+    debug(`Http2Agent::getSession [${name}, NEW SESSION ${list.length}]`);
+    const client =
+        new Http2ClientSession(Object.assign({}, this[kOptions], options));
+    list.push(client);
+    const remove = () => {
+      const index = list.indexOf(client);
+      if (index !== -1)
+        list.splice(index, 1);
+      if (list.length === 0 && this[kSessions].get(name) === list)
+        this[kSessions].delete(name);
+    };
+    client.once('goaway', remove);
+    client.once('close', remove);
+    // Errors are reported through the requests on the session
+    client.on('error', (error) => this.emit('error', error, client));
+    this.emit('session', client);
+    return client;
+  }
+
+  request(options, headers) {
+    const client = this.getSession(options);
+    const map = new Map();
+    if (options.method)
+      map.set(constants.HTTP2_HEADER_METHOD, String(options.method));
+    if (options.path)
+      map.set(constants.HTTP2_HEADER_PATH, String(options.path));
+    if (headers) {
+      for (const key of Object.keys(headers))
+        map.set(key, headers[key]);
+    }
+    return client.request(map, options);
+  }
+
+  destroy() {
+    for (const list of this[kSessions].values()) {
+      for (const client of list.slice())
+        client.destroy();
+    }
+    this[kSessions].clear();
+  }
+}
+
+const globalAgent = new Http2Agent();
 
 function createServerSession(options) {
   return new Http2Session(constants.SESSION_TYPE_SERVER, options);
@@ -1306,9 +3040,29 @@ function createClient(options, callback) {
   return new Http2ClientSession(options, callback);
 }
 
+// Makes a request using options.agent, or the global Http2Agent, which
+// keeps one connection per origin open for all requests.
+function request(options, callback) {
+  options = options || {};
+  const agent = options.agent || globalAgent;
+  const req = agent.request(options, options.headers);
+  if (typeof callback === 'function')
+    req.once('response', callback);
+  return req;
+}
+
+function get(options, callback) {
+  options = Object.assign({}, options, { method: 'GET' });
+  return request(options, callback);
+}
+
 module.exports.Http2Header = http2.Http2Header;
 module.exports.Http2Settings = http2.Http2Settings;
+module.exports.Http2Agent = Http2Agent;
+module.exports.globalAgent = globalAgent;
 module.exports.createClient = createClient;
+module.exports.request = request;
+module.exports.get = get;
 module.exports.createServer = createServer;
 module.exports.createSecureServer = createSecureServer;
 module.exports.createServerSession = createServerSession;
@@ -160,6 +160,7 @@
         'src/node_contextify.cc',
         'src/node_file.cc',
         'src/node_http2.cc',
+        'src/node_http2_core.cc',
         'src/node_http_parser.cc',
         'src/node_javascript.cc',
         'src/node_main.cc',
@@ -200,6 +201,7 @@
         'src/node_buffer.h',
         'src/node_constants.h',
         'src/node_file.h',
+        'src/node_http2_core.h',
         'src/node_http_parser.h',
         'src/node_internals.h',
         'src/node_javascript.h',
@@ -859,10 +861,14 @@
     {
       'target_name': 'cctest',
       'type': 'executable',
-      'dependencies': [ 'deps/gtest/gtest.gyp:gtest' ],
+      'dependencies': [
+        'deps/gtest/gtest.gyp:gtest',
+        'deps/nghttp2/nghttp2.gyp:nghttp2'
+      ],
       'include_dirs': [
         'src',
-        'deps/v8/include'
+        'deps/v8/include',
+        'deps/nghttp2/lib/includes'
       ],
       'defines': [
         # gtest's ASSERT macros conflict with our own.
@@ -875,7 +881,9 @@
         'NODE_WANT_INTERNALS=1',
       ],
       'sources': [
+        'src/node_http2_core.cc',
         'test/cctest/util.cc',
+        'test/cctest/test_http2_loopback.cc',
       ],
 
       'conditions': [
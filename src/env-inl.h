@@ -178,6 +178,8 @@ inline Environment::Environment(IsolateData* isolate_data,
 #endif
       handle_cleanup_waiting_(0),
       http_parser_buffer_(nullptr),
+      http2_date_cache_(nullptr),
+      http2_timer_wheel_(nullptr),
       context_(context->GetIsolate(), context) {
   // We'll be creating new objects so make sure we've entered the context.
   v8::HandleScope handle_scope(isolate());
@@ -331,6 +333,23 @@ inline void Environment::set_http_parser_buffer(char* buffer) {
   http_parser_buffer_ = buffer;
 }
 
+inline http2::Http2DateCache* Environment::http2_date_cache() const {
+  return http2_date_cache_;
+}
+
+inline void Environment::set_http2_date_cache(http2::Http2DateCache* cache) {
+  http2_date_cache_ = cache;
+}
+
+inline http2::Http2TimerWheel* Environment::http2_timer_wheel() const {
+  return http2_timer_wheel_;
+}
+
+inline void Environment::set_http2_timer_wheel(
+    http2::Http2TimerWheel* wheel) {
+  http2_timer_wheel_ = wheel;
+}
+
 inline Environment* Environment::from_cares_timer_handle(uv_timer_t* handle) {
   return ContainerOf(&Environment::cares_timer_handle_, handle);
 }
@@ -240,6 +240,7 @@ namespace node {
   V(domains_stack_array, v8::Array)                                           \
   V(fs_stats_constructor_function, v8::Function)                              \
   V(generic_internal_field_template, v8::ObjectTemplate)                      \
+  V(http2header_names_array, v8::Array)                                       \
   V(http2settings_constructor_template, v8::FunctionTemplate)                 \
   V(http2stream_constructor_template, v8::FunctionTemplate)                   \
   V(jsstream_constructor_template, v8::FunctionTemplate)                      \
@@ -261,6 +262,11 @@ namespace node {
 
 class Environment;
 
+namespace http2 {
+class Http2DateCache;
+class Http2TimerWheel;
+}  // namespace http2
+
 struct node_ares_task {
   Environment* env;
   ares_socket_t sock;
@@ -474,6 +480,12 @@ class Environment {
   inline char* http_parser_buffer() const;
   inline void set_http_parser_buffer(char* buffer);
 
+  inline http2::Http2DateCache* http2_date_cache() const;
+  inline void set_http2_date_cache(http2::Http2DateCache* cache);
+
+  inline http2::Http2TimerWheel* http2_timer_wheel() const;
+  inline void set_http2_timer_wheel(http2::Http2TimerWheel* wheel);
+
   inline void ThrowError(const char* errmsg);
   inline void ThrowTypeError(const char* errmsg);
   inline void ThrowRangeError(const char* errmsg);
@@ -579,6 +591,8 @@ class Environment {
   uint32_t* heap_space_statistics_buffer_ = nullptr;
 
   char* http_parser_buffer_;
+  http2::Http2DateCache* http2_date_cache_;
+  http2::Http2TimerWheel* http2_timer_wheel_;
 
 #define V(PropertyName, TypeName)                                             \
   v8::Persistent<TypeName> PropertyName ## _;
@@ -7,16 +7,25 @@
 #include "async-wrap-inl.h"
 #include "env.h"
 #include "env-inl.h"
+#include "stream_base.h"
+#include "stream_base-inl.h"
 #include "util.h"
 #include "util-inl.h"
 #include "v8.h"
 
+#include <stdio.h>
+#include <time.h>
+#include <algorithm>
 #include <vector>
 
 namespace node {
 
 using v8::Array;
+using v8::ArrayBuffer;
 using v8::Context;
+using v8::Exception;
+using v8::External;
+using v8::Float64Array;
 using v8::Function;
 using v8::FunctionCallbackInfo;
 using v8::FunctionTemplate;
@@ -30,6 +39,7 @@ using v8::Name;
 using v8::Number;
 using v8::Object;
 using v8::ObjectTemplate;
+using v8::PropertyAttribute;
 using v8::PropertyCallbackInfo;
 using v8::String;
 using v8::Value;
@@ -52,18 +62,81 @@ inline int32_t GetStreamID(Local<Value> val) {
 }
 
 
-inline void GetHeaders(Local<Value> obj, std::vector<nghttp2_nv>* vector) {
-  if (obj->IsArray()) {
-    Local<Array> headers = obj.As<Array>();
-    for (size_t i = 0; i < headers->Length(); i++) {
-      Local<Value> val = headers->Get(i);
-      if (val->IsObject()) {
-        Http2Header* header;
-        ASSIGN_OR_RETURN_UNWRAP(&header, val.As<Object>());
-        vector->push_back(**header);
-      }
+// Defines a read-only fields property on object holding a Float64Array of
+// count zeroed fields, and returns its backing store. The store is owned by
+// the ArrayBuffer, which the property keeps alive as long as object.
+inline double* CreateFields(Environment* env,
+                            Local<Object> object,
+                            size_t count) {
+  Isolate* isolate = env->isolate();
+  Local<ArrayBuffer> buffer = ArrayBuffer::New(isolate, count * sizeof(double));
+  Local<Float64Array> fields = Float64Array::New(buffer, 0, count);
+  object->DefineOwnProperty(
+      env->context(),
+      FIXED_ONE_BYTE_STRING(isolate, "fields"),
+      fields,
+      static_cast<PropertyAttribute>(v8::ReadOnly | v8::DontDelete))
+          .FromJust();
+  double* data = static_cast<double*>(buffer->GetContents().Data());
+  memset(data, 0, count * sizeof(double));
+  return data;
+}
+
+
+struct StaticHeaderName {
+  const char* name;
+  size_t length;
+};
+
+static const StaticHeaderName static_header_names[] = {
+#define V(name) { name, sizeof(name) - 1 },
+  HTTP2_STATIC_HEADER_NAMES(V)
+#undef V
+};
+
+// Returns the index of name within HTTP2_STATIC_HEADER_NAMES, or -1
+inline int FindStaticHeaderName(const uint8_t* name, size_t length) {
+  for (size_t n = 0; n < arraysize(static_header_names); n++) {
+    if (static_header_names[n].length == length &&
+        memcmp(static_header_names[n].name, name, length) == 0) {
+      return n;
     }
   }
+  return -1;
+}
+
+// Converts the collected header fields of a stream into a flat array of
+// alternating names and values.
+inline Local<Array> CollectHeaders(
+    Environment* env, const std::vector<Http2HeaderField>& fields) {
+  Isolate* isolate = env->isolate();
+  Local<Context> context = env->context();
+  Local<Array> names = env->http2header_names_array();
+  Local<Array> headers = Array::New(isolate);
+  Local<Function> fn = env->push_values_to_array_function();
+  Local<Value> argv[NODE_PUSH_VAL_TO_ARRAY_MAX];
+  size_t idx = 0;
+
+  for (const Http2HeaderField& field : fields) {
+    nghttp2_vec name = nghttp2_rcbuf_get_buf(field.name);
+    nghttp2_vec value = nghttp2_rcbuf_get_buf(field.value);
+    int index = FindStaticHeaderName(name.base, name.len);
+    if (index >= 0)
+      argv[idx] = names->Get(context, index).ToLocalChecked();
+    else
+      argv[idx] = OneByteString(isolate, name.base, name.len);
+    argv[idx + 1] = OneByteString(isolate, value.base, value.len);
+    idx += 2;
+    if (idx >= arraysize(argv)) {
+      fn->Call(context, headers, idx, argv).ToLocalChecked();
+      idx = 0;
+    }
+  }
+
+  if (idx > 0)
+    fn->Call(context, headers, idx, argv).ToLocalChecked();
+
+  return headers;
 }
 
 // Http2Options statics
@@ -74,9 +147,23 @@ inline void GetHeaders(Local<Value> obj, std::vector<nghttp2_nv>* vector) {
   V(obj, "maxSendHeaderBlockLength", SetMaxSendHeaderBlockLength, Uint32)     \
   V(obj, "peerMaxConcurrentStreams", SetPeerMaxConcurrentStreams, Uint32)     \
   V(obj, "noHttpMessaging", SetNoHttpMessaging, Boolean)                      \
-  V(obj, "noRecvClientMagic", SetNoRecvClientMagic, Boolean)
-
-Http2Options::Http2Options(Environment* env, Local<Value> options) {
+  V(obj, "noRecvClientMagic", SetNoRecvClientMagic, Boolean)                  \
+  V(obj, "maxSessionMemory", SetMaxSessionMemory, Number)                     \
+  V(obj, "schedulingPolicy", SetSchedulingPolicy, Uint32)                     \
+  V(obj, "schedulingQuantum", SetSchedulingQuantum, Uint32)                   \
+  V(obj, "maxAutoWindowSize", SetMaxAutoWindowSize, Uint32)                   \
+  V(obj, "streamHeadersTimeout", SetStreamHeadersTimeout, Uint32)             \
+  V(obj, "streamBodyTimeout", SetStreamBodyTimeout, Uint32)                   \
+  V(obj, "streamIdleTimeout", SetStreamIdleTimeout, Uint32)
+
+Http2Options::Http2Options(Environment* env, Local<Value> options)
+    : max_session_memory_(0),
+      scheduling_policy_(HTTP2_SCHEDULING_PRIORITY_TREE),
+      scheduling_quantum_(0),
+      max_auto_window_size_(0),
+      stream_headers_timeout_(0),
+      stream_body_timeout_(0),
+      stream_idle_timeout_(0) {
   nghttp2_option_new(&options_);
   if (options->IsObject()) {
     Local<Object> opts = options.As<Object>();
@@ -84,7 +171,7 @@ Http2Options::Http2Options(Environment* env, Local<Value> options) {
 #define V(obj, name, fn, type)                                                \
   {                                                                           \
     Local<Value> val = obj->Get(FIXED_ONE_BYTE_STRING(env->isolate(), name)); \
-    if (!val.IsEmpty()) fn(val->type##Value());                               \
+    if (!val.IsEmpty() && !val->IsUndefined()) fn(val->type##Value());        \
   }
     OPTIONS(opts, V)
 #undef V
@@ -321,10 +408,11 @@ void Http2DataProvider::New(const FunctionCallbackInfo<Value>& args) {
   if (!args.IsConstructCall())
     return env->ThrowTypeError("Class constructor Http2DataProvider cannot "
                                "be invoked without 'new'");
-  if (args.Length() < 1)
-    return env->ThrowTypeError("'stream' argument is required");
-  Http2Stream* stream;
-  ASSIGN_OR_RETURN_UNWRAP(&stream, args[0].As<Object>());
+  // A provider for a client request is created before its stream exists
+  // and is bound to the stream by Http2Session::SubmitRequest.
+  Http2Stream* stream = nullptr;
+  if (args.Length() > 0 && !args[0]->IsUndefined())
+    ASSIGN_OR_RETURN_UNWRAP(&stream, args[0].As<Object>());
   new Http2DataProvider(env, args.This(), stream);
 }
 
@@ -338,6 +426,8 @@ ssize_t Http2DataProvider::on_read(nghttp2_session* session,
   Http2DataProvider* provider =
     reinterpret_cast<Http2DataProvider*>(source->ptr);
   Http2Stream* stream = provider->stream();
+  if (stream->session()->DeferForPriority(stream))
+    return NGHTTP2_ERR_DEFERRED;
   Local<Object> provider_obj = provider->object();
   Local<Object> stream_obj = stream->object();
   Environment* env = stream->env();
@@ -348,11 +438,8 @@ ssize_t Http2DataProvider::on_read(nghttp2_session* session,
 
   Local<Object> retFlags = Object::New(isolate);
 
-  Local<Object> buffer =
-      Buffer::New(env, reinterpret_cast<char*>(buf), length,
-                  &FreeCallbackNonop, nullptr).ToLocalChecked();
   Local<Value> argv[] {
-    buffer,
+    Integer::NewFromUnsigned(isolate, length),
     retFlags
   };
   Environment::AsyncCallbackScope callback_scope(env);
@@ -361,7 +448,7 @@ ssize_t Http2DataProvider::on_read(nghttp2_session* session,
                                              arraysize(argv),
                                              argv);
   CHECK(!ret.IsEmpty());
-  int32_t val = ret.ToLocalChecked()->Int32Value();
+  Local<Value> result = ret.ToLocalChecked();
 
   // TODO(jasnell): There's likely a better, more elegant way of doing this.
   if (retFlags->Get(FLAG_ENDSTREAM)->BooleanValue())
@@ -371,7 +458,223 @@ ssize_t Http2DataProvider::on_read(nghttp2_session* session,
   if (retFlags->Get(FLAG_NOENDSTREAM)->BooleanValue())
     *flags |= NGHTTP2_DATA_FLAG_NO_END_STREAM;
 
-  return val;
+  if (!result->IsArray())
+    return result->Int32Value();
+
+  // The _read callback hands back the Buffers making up the frame payload.
+  // Large payloads are written straight from those Buffers by
+  // Http2Session::send_data, small ones are copied into the frame buffer.
+  Local<Array> chunks = result.As<Array>();
+  size_t total = 0;
+  for (uint32_t i = 0; i < chunks->Length(); i++) {
+    Local<Value> chunk = chunks->Get(i);
+    CHECK(Buffer::HasInstance(chunk));
+    total += Buffer::Length(chunk);
+  }
+  CHECK_LE(total, length);
+  stream->session()->DequeueData(stream, total);
+
+  if (total >= HTTP2_MIN_NO_COPY_LENGTH) {
+    provider->pending_.Reset(isolate, chunks);
+    *flags |= NGHTTP2_DATA_FLAG_NO_COPY;
+    return total;
+  }
+
+  for (uint32_t i = 0; i < chunks->Length(); i++) {
+    Local<Value> chunk = chunks->Get(i);
+    size_t len = Buffer::Length(chunk);
+    memcpy(buf, Buffer::Data(chunk), len);
+    buf += len;
+  }
+  return total;
+}
+
+// Http2FileSource statics
+
+Http2FileSource::Http2FileSource(Http2Stream* stream,
+                                 int fd,
+                                 int64_t offset,
+                                 int64_t length,
+                                 bool close_fd) :
+                                 stream_(stream),
+                                 env_(stream->env()),
+                                 fd_(fd),
+                                 close_fd_(close_fd),
+                                 offset_(offset),
+                                 remaining_(length),
+                                 current_(0),
+                                 target_(0),
+                                 reading_(false),
+                                 deferred_(false),
+                                 closed_(false),
+                                 error_(0) {
+  provider_.read_callback = on_read;
+  provider_.source.ptr = this;
+  req_.data = this;
+  length_[0] = length_[1] = 0;
+  pos_[0] = pos_[1] = 0;
+}
+
+Http2FileSource::~Http2FileSource() {
+  if (close_fd_) {
+    // Closing may block, so it is left to the threadpool like the reads
+    uv_fs_t* req = new uv_fs_t;
+    if (uv_fs_close(env_->event_loop(), req, fd_, OnClose) < 0)
+      delete req;
+  }
+}
+
+void Http2FileSource::OnClose(uv_fs_t* req) {
+  uv_fs_req_cleanup(req);
+  delete req;
+}
+
+void Http2FileSource::Close() {
+  stream_ = nullptr;
+  closed_ = true;
+  if (!reading_)
+    delete this;
+}
+
+void Http2FileSource::ReadAhead() {
+  if (reading_ || remaining_ == 0 || error_ != 0)
+    return;
+  // Read into the buffer not being sent from, or into the current one
+  // once everything in it has been sent.
+  int target;
+  if (length_[current_] == pos_[current_])
+    target = current_;
+  else if (length_[1 - current_] == pos_[1 - current_])
+    target = 1 - current_;
+  else
+    return;
+  length_[target] = pos_[target] = 0;
+  target_ = target;
+  reading_ = true;
+  uv_buf_t buf =
+      uv_buf_init(buffers_[target],
+                  MIN(remaining_, static_cast<int64_t>(HTTP2_FILE_CHUNK_SIZE)));
+  int err = uv_fs_read(env_->event_loop(), &req_, fd_, &buf, 1, offset_,
+                       OnRead);
+  if (err < 0) {
+    reading_ = false;
+    error_ = err;
+  }
+}
+
+void Http2FileSource::OnRead(uv_fs_t* req) {
+  Http2FileSource* file = static_cast<Http2FileSource*>(req->data);
+  ssize_t result = req->result;
+  uv_fs_req_cleanup(req);
+  file->reading_ = false;
+  if (file->closed_) {
+    delete file;
+    return;
+  }
+
+  if (result > 0) {
+    file->length_[file->target_] = result;
+    file->offset_ += result;
+    file->remaining_ -= result;
+    file->ReadAhead();
+  } else {
+    // A file shorter than the range would leave the response short of its
+    // content-length, so the stream is reset instead.
+    file->error_ = result < 0 ? result : static_cast<int>(UV_EOF);
+  }
+
+  Http2Stream* stream = file->stream_;
+  Http2Session* session = stream->session();
+  if (!file->deferred_ || !**session)
+    return;
+  file->deferred_ = false;
+  Environment* env = file->env_;
+  HandleScope handle_scope(env->isolate());
+  Context::Scope context_scope(env->context());
+  nghttp2_session_resume_data(**session, stream->id());
+  int rv = session->SendPendingData();
+  if (rv < 0)
+    session->EmitError(rv);
+}
+
+ssize_t Http2FileSource::on_read(nghttp2_session* session,
+                                 int32_t stream_id,
+                                 uint8_t* buf,
+                                 size_t length,
+                                 uint32_t* flags,
+                                 nghttp2_data_source* source,
+                                 void* user_data) {
+  Http2FileSource* file = static_cast<Http2FileSource*>(source->ptr);
+  if (file->stream_->session()->DeferForPriority(file->stream_))
+    return NGHTTP2_ERR_DEFERRED;
+  // Resets the stream with INTERNAL_ERROR
+  if (file->error_ != 0)
+    return NGHTTP2_ERR_TEMPORAL_CALLBACK_FAILURE;
+
+  int current = file->current_;
+  if (file->pos_[current] == file->length_[current]) {
+    int other = 1 - current;
+    if (file->pos_[other] < file->length_[other]) {
+      file->current_ = current = other;
+    } else if (file->finished()) {
+      *flags |= NGHTTP2_DATA_FLAG_EOF;
+      return 0;
+    } else {
+      file->ReadAhead();
+      file->deferred_ = true;
+      return NGHTTP2_ERR_DEFERRED;
+    }
+  }
+
+  size_t amount =
+      MIN(length, file->length_[current] - file->pos_[current]);
+  memcpy(buf, file->buffers_[current] + file->pos_[current], amount);
+  file->pos_[current] += amount;
+  file->ReadAhead();
+  if (file->finished())
+    *flags |= NGHTTP2_DATA_FLAG_EOF;
+  return amount;
+}
+
+// Http2BufferSource statics
+
+void Http2BufferSource::Set(Http2Stream* stream, Local<Object> buffer) {
+  stream_ = stream;
+  buffer_.Reset(stream->env()->isolate(), buffer);
+  offset_ = 0;
+  pending_ = 0;
+}
+
+ssize_t Http2BufferSource::on_read(nghttp2_session* session,
+                                   int32_t stream_id,
+                                   uint8_t* buf,
+                                   size_t length,
+                                   uint32_t* flags,
+                                   nghttp2_data_source* source,
+                                   void* user_data) {
+  Http2BufferSource* body = static_cast<Http2BufferSource*>(source->ptr);
+  Http2Stream* stream = body->stream_;
+  if (stream->session()->DeferForPriority(stream))
+    return NGHTTP2_ERR_DEFERRED;
+  Local<Object> buffer =
+      PersistentToLocal(stream->env()->isolate(), body->buffer_);
+  size_t amount = MIN(length, Buffer::Length(buffer) - body->offset_);
+  if (amount >= HTTP2_MIN_NO_COPY_LENGTH) {
+    body->pending_ = body->offset_;
+    *flags |= NGHTTP2_DATA_FLAG_NO_COPY;
+  } else {
+    memcpy(buf, Buffer::Data(buffer) + body->offset_, amount);
+  }
+  body->offset_ += amount;
+  if (body->offset_ == Buffer::Length(buffer))
+    *flags |= NGHTTP2_DATA_FLAG_EOF;
+  return amount;
+}
+
+void Http2BufferSource::Send(Http2Session* session, size_t length) {
+  Local<Object> buffer =
+      PersistentToLocal(stream_->env()->isolate(), buffer_);
+  session->AppendExternal(buffer, pending_, length);
 }
 
 // Http2Header statics
@@ -462,18 +765,197 @@ Http2Stream::Http2Stream(Environment* env,
                          Http2Session* session,
                          int32_t stream_id) :
                          AsyncWrap(env, wrap, AsyncWrap::PROVIDER_HTTP2STREAM),
+                         queued_data_(0),
+                         refused_(false),
+                         priority_(HTTP2_DEFAULT_PRIORITY),
+                         file_source_(nullptr),
+                         closed_(false),
+                         fields_dirty_(false),
+                         headers_deadline_(0),
+                         body_deadline_(0),
+                         idle_timeout_(0),
+                         last_activity_(0),
+                         timed_out_(false),
                          session_(session),
                          stream_id_(stream_id) {
   Wrap(object(), this);
+  deadline_timer_ = { nullptr, nullptr, 0, this };
+  fields_ = CreateFields(env, object(), STREAM_FIELD_COUNT);
   prev_ = nullptr;
   next_ = nullptr;
   stream_ = nghttp2_session_find_stream(**session, stream_id);
 }
 
-// TODO(jasnell): Implement these. The Add Stream and Remove Stream methods
-// are used as part of the HTTP/2 stream prioritization grouping.
-void Http2Stream::RemoveStream(Http2Stream* stream) {}
-void Http2Stream::AddStream(Http2Stream* stream, Http2Session* session) {}
+// nghttp2 only creates the nghttp2_stream for a client request once its
+// HEADERS frame is sent, so it is looked up again until it exists.
+nghttp2_stream* Http2Stream::operator*() {
+  if (stream_ == nullptr && session_ != nullptr && **session_ != nullptr)
+    stream_ = nghttp2_session_find_stream(**session_, stream_id_);
+  return stream_;
+}
+
+void Http2Stream::UpdateFields() {
+  nghttp2_session* session = session_ != nullptr ? **session_ : nullptr;
+  fields_[STREAM_FIELD_QUEUED_DATA] = queued_data_;
+  fields_[STREAM_FIELD_TIMED_OUT] = timed_out_;
+  if (closed_ || session == nullptr) {
+    fields_[STREAM_FIELD_STATE] = NGHTTP2_STREAM_STATE_CLOSED;
+    fields_[STREAM_FIELD_LOCAL_WINDOW_SIZE] = 0;
+    fields_[STREAM_FIELD_REMOTE_WINDOW_SIZE] = 0;
+    return;
+  }
+  nghttp2_stream* stream = **this;
+  fields_[STREAM_FIELD_STATE] =
+      stream != nullptr ? nghttp2_stream_get_state(stream)
+                        : NGHTTP2_STREAM_STATE_IDLE;
+  fields_[STREAM_FIELD_LOCAL_WINDOW_SIZE] =
+      nghttp2_session_get_stream_local_window_size(session, stream_id_);
+  fields_[STREAM_FIELD_REMOTE_WINDOW_SIZE] =
+      nghttp2_session_get_stream_remote_window_size(session, stream_id_);
+}
+
+// Called by JS once nothing uses a closed stream any longer. The stream is
+// detached from its session and deleted, which lets its JS object be
+// collected. Does nothing for a stream that nghttp2 has not closed.
+void Http2Stream::Release(const FunctionCallbackInfo<Value>& args) {
+  Http2Stream* stream;
+  ASSIGN_OR_RETURN_UNWRAP(&stream, args.Holder());
+  if (!stream->closed_)
+    return;
+  // The session has already been deleted if it is unset
+  if (stream->session_ != nullptr) {
+    stream->CancelDeadline();
+    if (stream->fields_dirty_) {
+      std::vector<Http2Stream*>& dirty = stream->session_->dirty_streams_;
+      dirty.erase(std::find(dirty.begin(), dirty.end(), stream));
+      stream->fields_dirty_ = false;
+    }
+    RemoveStream(stream);
+  }
+  stream->session_ = nullptr;
+  ClearWrap(stream->object());
+  delete stream;
+}
+
+void Http2Stream::StartDeadlines(uint32_t headers_timeout,
+                                 uint32_t body_timeout,
+                                 uint32_t idle_timeout) {
+  if (headers_timeout == 0 && body_timeout == 0 && idle_timeout == 0)
+    return;
+  uint64_t now = uv_now(env()->event_loop());
+  headers_deadline_ = headers_timeout > 0 ? now + headers_timeout : 0;
+  body_deadline_ = body_timeout > 0 ? now + body_timeout : 0;
+  idle_timeout_ = idle_timeout;
+  last_activity_ = now;
+  ScheduleDeadline();
+}
+
+// The entry is not moved as deadlines are cleared or pushed back; it is
+// cancelled once the stream has no deadline left, and otherwise finds out
+// when it expires.
+void Http2Stream::OnFrameReceived(uint8_t type, uint8_t flags) {
+  if (deadline_timer_.pprev == nullptr)
+    return;
+  if (idle_timeout_ > 0)
+    last_activity_ = uv_now(env()->event_loop());
+  if (type == NGHTTP2_HEADERS)
+    headers_deadline_ = 0;
+  if ((type == NGHTTP2_HEADERS || type == NGHTTP2_DATA) &&
+      (flags & NGHTTP2_FLAG_END_STREAM)) {
+    body_deadline_ = 0;
+  }
+  if (NextDeadline() == 0)
+    CancelDeadline();
+}
+
+uint64_t Http2Stream::NextDeadline() const {
+  uint64_t deadline = 0;
+  if (headers_deadline_ > 0)
+    deadline = headers_deadline_;
+  if (body_deadline_ > 0 && (deadline == 0 || body_deadline_ < deadline))
+    deadline = body_deadline_;
+  if (idle_timeout_ > 0) {
+    uint64_t idle = last_activity_ + idle_timeout_;
+    if (deadline == 0 || idle < deadline)
+      deadline = idle;
+  }
+  return deadline;
+}
+
+void Http2Stream::ScheduleDeadline() {
+  uint64_t deadline = NextDeadline();
+  if (deadline == 0)
+    return CancelDeadline();
+  if (deadline_timer_.pprev == nullptr)
+    session_->timed_streams_.push_back(this);
+  Http2TimerWheel::Get(env())->Schedule(&deadline_timer_, deadline);
+}
+
+void Http2Stream::CancelDeadline() {
+  // An entry is only ever scheduled on the existing wheel
+  if (deadline_timer_.pprev == nullptr)
+    return;
+  env()->http2_timer_wheel()->Cancel(&deadline_timer_);
+  std::vector<Http2Stream*>& timed = session_->timed_streams_;
+  timed.erase(std::remove(timed.begin(), timed.end(), this), timed.end());
+}
+
+void Http2Stream::OnDeadline(uint64_t now) {
+  Http2Session* session = session_;
+  std::vector<Http2Stream*>& timed = session->timed_streams_;
+  timed.erase(std::remove(timed.begin(), timed.end(), this), timed.end());
+  uint64_t deadline = NextDeadline();
+  if (deadline == 0 || closed_ || !**session)
+    return;
+  if (deadline > now)
+    return ScheduleDeadline();
+  timed_out_ = true;
+  headers_deadline_ = 0;
+  body_deadline_ = 0;
+  idle_timeout_ = 0;
+  nghttp2_submit_rst_stream(**session, NGHTTP2_FLAG_NONE,
+                            stream_id_, NGHTTP2_CANCEL);
+  session->MarkFieldsDirty(this);
+  int rv = session->SendPendingData();
+  if (rv < 0)
+    session->EmitError(rv);
+}
+
+// Sets the idle deadline of the stream, which is restarted each time a
+// frame is received or sent on it. A timeout of zero removes it.
+void Http2Stream::SetIdleTimeout(const FunctionCallbackInfo<Value>& args) {
+  Http2Stream* stream;
+  ASSIGN_OR_RETURN_UNWRAP(&stream, args.Holder());
+  Http2Session* session = stream->session();
+  SESSION_OR_RETURN(session);
+  if (stream->closed_)
+    return;
+  double timeout = args[0]->NumberValue();
+  stream->idle_timeout_ = timeout > 0 ? static_cast<uint64_t>(timeout) : 0;
+  stream->last_activity_ = uv_now(stream->env()->event_loop());
+  stream->ScheduleDeadline();
+}
+
+// Links the streams of a session together, so that the session can detach
+// them before its nghttp2_session is deleted.
+void Http2Stream::RemoveStream(Http2Stream* stream) {
+  if (stream->prev_ != nullptr)
+    stream->prev_->next_ = stream->next_;
+  else
+    stream->session_->streams_ = stream->next_;
+  if (stream->next_ != nullptr)
+    stream->next_->prev_ = stream->prev_;
+  stream->prev_ = nullptr;
+  stream->next_ = nullptr;
+}
+
+void Http2Stream::AddStream(Http2Stream* stream, Http2Session* session) {
+  stream->prev_ = nullptr;
+  stream->next_ = session->streams_;
+  if (session->streams_ != nullptr)
+    session->streams_->prev_ = stream;
+  session->streams_ = stream;
+}
 
 void Http2Stream::GetUid(Local<String> property,
                          const PropertyCallbackInfo<Value>& args) {
@@ -494,6 +976,8 @@ void Http2Stream::GetState(Local<String> property,
                            const PropertyCallbackInfo<Value>& args) {
   Http2Stream* stream;
   ASSIGN_OR_RETURN_UNWRAP(&stream, args.Holder());
+  if (**stream == nullptr)
+    return args.GetReturnValue().Set(NGHTTP2_STREAM_STATE_IDLE);
   args.GetReturnValue().Set(nghttp2_stream_get_state(**stream));
 }
 
@@ -502,6 +986,8 @@ void Http2Stream::GetSumDependencyWeight(
     const PropertyCallbackInfo<Value>& args) {
   Http2Stream* stream;
   ASSIGN_OR_RETURN_UNWRAP(&stream, args.Holder());
+  if (**stream == nullptr)
+    return args.GetReturnValue().Set(0);
   args.GetReturnValue().Set(nghttp2_stream_get_sum_dependency_weight(**stream));
 }
 
@@ -509,6 +995,8 @@ void Http2Stream::GetWeight(Local<String> property,
                             const PropertyCallbackInfo<Value>& args) {
   Http2Stream* stream;
   ASSIGN_OR_RETURN_UNWRAP(&stream, args.Holder());
+  if (**stream == nullptr)
+    return args.GetReturnValue().Set(NGHTTP2_DEFAULT_WEIGHT);
   args.GetReturnValue().Set(nghttp2_stream_get_weight(**stream));
 }
 
@@ -522,6 +1010,17 @@ void Http2Stream::GetLocalWindowSize(Local<String> property,
       nghttp2_session_get_stream_local_window_size(**session, stream->id()));
 }
 
+void Http2Stream::GetRemoteWindowSize(
+    Local<String> property,
+    const PropertyCallbackInfo<Value>& info) {
+  Http2Stream* stream;
+  ASSIGN_OR_RETURN_UNWRAP(&stream, info.Holder());
+  Http2Session* session = stream->session();
+  SESSION_OR_RETURN(session);
+  info.GetReturnValue().Set(
+      nghttp2_session_get_stream_remote_window_size(**session, stream->id()));
+}
+
 void Http2Stream::SetLocalWindowSize(Local<String> property,
                                      Local<Value> value,
                                      const PropertyCallbackInfo<void>& info) {
@@ -531,6 +1030,8 @@ void Http2Stream::SetLocalWindowSize(Local<String> property,
   SESSION_OR_RETURN(session);
   nghttp2_session_set_local_window_size(
       **session, NGHTTP2_FLAG_NONE, stream->id(), value->Int32Value());
+  stream->UpdateFields();
+  session->UpdateFields();
 }
 
 void Http2Stream::GetStreamLocalClose(
@@ -561,11 +1062,12 @@ void Http2Stream::SendTrailers(const FunctionCallbackInfo<Value>& args) {
   ASSIGN_OR_RETURN_UNWRAP(&stream, args.Holder());
   Http2Session* session = stream->session();
   SESSION_OR_RETURN(session);
-  std::vector<nghttp2_nv> headers;
-  GetHeaders(args[0], &headers);
+  ssize_t count = session->ParseHeaders(args[0], args[1]);
+  if (count < 0)
+    return args.GetReturnValue().Set(static_cast<int32_t>(count));
   args.GetReturnValue().Set(
       nghttp2_submit_trailer(**session, stream->id(),
-                             &headers[0], headers.size()));
+                             session->headers(), count));
 }
 
 void Http2Stream::ResumeData(const FunctionCallbackInfo<Value>& args) {
@@ -582,6 +1084,35 @@ void Http2Stream::ResumeData(const FunctionCallbackInfo<Value>& args) {
   }
 }
 
+// Called by JS as outgoing DATA is queued on the stream. If the session
+// would exceed its memory limit, the stream is reset with
+// ENHANCE_YOUR_CALM instead and NGHTTP2_ERR_NOMEM is returned.
+void Http2Stream::QueueData(const FunctionCallbackInfo<Value>& args) {
+  Http2Stream* stream;
+  ASSIGN_OR_RETURN_UNWRAP(&stream, args.Holder());
+  Http2Session* session = stream->session();
+  SESSION_OR_RETURN(session);
+  if (session->QueueData(stream, args[0]->Uint32Value()))
+    return args.GetReturnValue().Set(0);
+  nghttp2_submit_rst_stream(**session, NGHTTP2_FLAG_NONE,
+                            stream->id(), NGHTTP2_ENHANCE_YOUR_CALM);
+  args.GetReturnValue().Set(NGHTTP2_ERR_NOMEM);
+}
+
+// Sets the priority hint used by the session's scheduling policy, from 0
+// (most urgent) to HTTP2_PRIORITY_LEVELS - 1. Has no effect on the order
+// in which DATA is sent under the default policy.
+void Http2Stream::SetPriority(const FunctionCallbackInfo<Value>& args) {
+  Http2Stream* stream;
+  ASSIGN_OR_RETURN_UNWRAP(&stream, args.Holder());
+  Http2Session* session = stream->session();
+  SESSION_OR_RETURN(session);
+  stream->priority_ = MIN(args[0]->Uint32Value(),
+                          static_cast<uint32_t>(HTTP2_PRIORITY_LEVELS - 1));
+  session->ApplySchedulingPolicy(stream);
+  session->ScheduleResume();
+}
+
 void Http2Stream::SendContinue(const FunctionCallbackInfo<Value>& args) {
   Http2Stream* stream;
   ASSIGN_OR_RETURN_UNWRAP(&stream, args.Holder());
@@ -594,6 +1125,20 @@ void Http2Stream::SendContinue(const FunctionCallbackInfo<Value>& args) {
           nullptr, &headers[0], 1, nullptr));
 }
 
+// Parses the header block and count passed as the first two arguments,
+// then appends the date header if args[first + 1] is true and the header
+// template with the id args[first].
+static ssize_t ParseResponseHeaders(Http2Session* session,
+                                    const FunctionCallbackInfo<Value>& args,
+                                    int first) {
+  ssize_t count = session->ParseHeaders(args[0], args[1]);
+  if (count >= 0 && args[first + 1]->BooleanValue())
+    count = session->AppendDateHeader(count);
+  if (count >= 0 && args[first]->IsInt32())
+    count = session->AppendHeaderTemplate(count, args[first]->Int32Value());
+  return count;
+}
+
 void Http2Stream::Respond(const FunctionCallbackInfo<Value>& args) {
   Environment* env = Environment::GetCurrent(args);
   Http2Stream* stream;
@@ -601,19 +1146,80 @@ void Http2Stream::Respond(const FunctionCallbackInfo<Value>& args) {
   Http2Session* session = stream->session();
   SESSION_OR_RETURN(session);
   nghttp2_data_provider* provider = nullptr;
-  std::vector<nghttp2_nv> headers;
-  GetHeaders(args[0], &headers);
-  if (args.Length() > 1) {
-    if (!args[1]->IsObject())
+  if (args.Length() > 2 && !args[2]->IsUndefined()) {
+    if (!args[2]->IsObject())
       return env->ThrowTypeError(
-        "Second argument must be an Http2DataProvider object");
+        "Third argument must be an Http2DataProvider object");
     Http2DataProvider* dataProvider;
-    ASSIGN_OR_RETURN_UNWRAP(&dataProvider, args[1].As<Object>());
+    ASSIGN_OR_RETURN_UNWRAP(&dataProvider, args[2].As<Object>());
     provider = **dataProvider;
   }
+  ssize_t count = ParseResponseHeaders(session, args, 3);
+  if (count < 0)
+    return args.GetReturnValue().Set(static_cast<int32_t>(count));
   args.GetReturnValue().Set(
       nghttp2_submit_response(
-          **session, stream->id(), &headers[0], headers.size(), provider));
+          **session, stream->id(), session->headers(), count, provider));
+}
+
+// Responds with length bytes read from the file descriptor fd, starting at
+// offset. The arguments are the header block, count, fd, offset, length,
+// template, sendDate and closeFd. If closeFd is true, the file descriptor
+// is closed once the stream no longer needs it, or straight away if the
+// response cannot be submitted.
+void Http2Stream::RespondWithFD(const FunctionCallbackInfo<Value>& args) {
+  Http2Stream* stream;
+  ASSIGN_OR_RETURN_UNWRAP(&stream, args.Holder());
+  Http2Session* session = stream->session();
+  SESSION_OR_RETURN(session);
+  if (stream->file_source_ != nullptr || stream->buffer_source_.active())
+    return args.GetReturnValue().Set(NGHTTP2_ERR_INVALID_STATE);
+  int fd = args[2]->Int32Value();
+  int64_t offset = args[3]->IntegerValue();
+  int64_t length = args[4]->IntegerValue();
+  if (fd < 0)
+    return args.GetReturnValue().Set(NGHTTP2_ERR_INVALID_ARGUMENT);
+
+  Http2FileSource* file =
+      new Http2FileSource(stream, fd, offset, length, args[7]->IsTrue());
+  ssize_t count = ParseResponseHeaders(session, args, 5);
+  int rv = count < 0 ?
+      count : static_cast<ssize_t>(NGHTTP2_ERR_INVALID_ARGUMENT);
+  if (count >= 0 && offset >= 0 && length >= 0) {
+    rv = nghttp2_submit_response(**session, stream->id(),
+                                 session->headers(), count, **file);
+  }
+  if (rv < 0) {
+    file->Close();
+    return args.GetReturnValue().Set(rv);
+  }
+  stream->file_source_ = file;
+  session->file_sources_.push_back(file);
+  args.GetReturnValue().Set(rv);
+}
+
+// Responds with the contents of a Buffer. The arguments are the header
+// block, count, buffer, template and sendDate. The Buffer must not be
+// modified until the stream has closed.
+void Http2Stream::RespondWithBuffer(const FunctionCallbackInfo<Value>& args) {
+  Http2Stream* stream;
+  ASSIGN_OR_RETURN_UNWRAP(&stream, args.Holder());
+  Http2Session* session = stream->session();
+  SESSION_OR_RETURN(session);
+  if (stream->file_source_ != nullptr || stream->buffer_source_.active())
+    return args.GetReturnValue().Set(NGHTTP2_ERR_INVALID_STATE);
+  if (!Buffer::HasInstance(args[2]))
+    return args.GetReturnValue().Set(NGHTTP2_ERR_INVALID_ARGUMENT);
+  ssize_t count = ParseResponseHeaders(session, args, 3);
+  if (count < 0)
+    return args.GetReturnValue().Set(static_cast<int32_t>(count));
+  stream->buffer_source_.Set(stream, args[2].As<Object>());
+  int rv = nghttp2_submit_response(**session, stream->id(),
+                                   session->headers(), count,
+                                   *stream->buffer_source_);
+  if (rv < 0)
+    stream->buffer_source_.Clear();
+  args.GetReturnValue().Set(rv);
 }
 
 void Http2Stream::SendDataFrame(const FunctionCallbackInfo<Value>& args) {
@@ -684,13 +1290,14 @@ void Http2Stream::SendPushPromise(const FunctionCallbackInfo<Value>& args) {
   if (nghttp2_session_check_server_session(**session) == 0) {
     return env->ThrowError("Client Http2Session instances cannot use push");
   }
-  std::vector<nghttp2_nv> headers;
-  GetHeaders(args[0], &headers);
+  ssize_t count = session->ParseHeaders(args[0], args[1]);
+  if (count < 0)
+    return args.GetReturnValue().Set(static_cast<int32_t>(count));
   int32_t ret =
       nghttp2_submit_push_promise(**session,
                                   NGHTTP2_FLAG_NONE,
                                   stream->id(),
-                                  &headers[0], headers.size(),
+                                  session->headers(), count,
                                   stream);
   if (ret > 0) {
     args.GetReturnValue().Set(
@@ -700,40 +1307,584 @@ void Http2Stream::SendPushPromise(const FunctionCallbackInfo<Value>& args) {
   }
 }
 
+// Http2DateCache statics
+
+Http2DateCache::Http2DateCache(Environment* env) : env_(env),
+                                                   active_(false),
+                                                   used_(false) {
+  uv_timer_init(env->event_loop(), &timer_);
+  uv_unref(reinterpret_cast<uv_handle_t*>(&timer_));
+  timer_.data = this;
+  env->RegisterHandleCleanup(reinterpret_cast<uv_handle_t*>(&timer_),
+                             Cleanup,
+                             this);
+}
+
+Http2DateCache* Http2DateCache::Get(Environment* env) {
+  Http2DateCache* cache = env->http2_date_cache();
+  if (cache == nullptr) {
+    cache = new Http2DateCache(env);
+    env->set_http2_date_cache(cache);
+  }
+  return cache;
+}
+
+nghttp2_nv Http2DateCache::nv() {
+  if (!active_) {
+    Update();
+    uv_timer_start(&timer_, OnTimer, 1000, 1000);
+    active_ = true;
+  }
+  used_ = true;
+  static uint8_t name[] = "date";
+  return {
+    name,
+    reinterpret_cast<uint8_t*>(value_),
+    sizeof(name) - 1,
+    HTTP2_DATE_LENGTH,
+    NGHTTP2_NV_FLAG_NO_COPY_NAME | NGHTTP2_NV_FLAG_NO_COPY_VALUE
+  };
+}
+
+// Formats the current time as an IMF-fixdate (RFC 7231, Section 7.1.1.1).
+// strftime() is not used because day and month names are locale-sensitive.
+void Http2DateCache::Update() {
+  static const char days[][4] = {
+    "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"
+  };
+  static const char months[][4] = {
+    "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+    "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+  };
+  time_t now = time(nullptr);
+  struct tm tm;
+#ifdef _WIN32
+  gmtime_s(&tm, &now);
+#else
+  gmtime_r(&now, &tm);
+#endif
+  snprintf(value_, sizeof(value_), "%s, %02d %s %04d %02d:%02d:%02d GMT",
+           days[tm.tm_wday], tm.tm_mday, months[tm.tm_mon],
+           tm.tm_year + 1900, tm.tm_hour, tm.tm_min, tm.tm_sec);
+}
+
+void Http2DateCache::OnTimer(uv_timer_t* handle) {
+  Http2DateCache* cache = static_cast<Http2DateCache*>(handle->data);
+  if (!cache->used_) {
+    uv_timer_stop(handle);
+    cache->active_ = false;
+    return;
+  }
+  cache->used_ = false;
+  cache->Update();
+}
+
+void Http2DateCache::Cleanup(Environment* env,
+                             uv_handle_t* handle,
+                             void* arg) {
+  uv_close(handle, [](uv_handle_t* handle) {
+    Http2DateCache* cache = static_cast<Http2DateCache*>(handle->data);
+    Environment* env = cache->env_;
+    env->set_http2_date_cache(nullptr);
+    delete cache;
+    env->FinishHandleCleanup(handle);
+  });
+}
+
+// Http2TimerWheel statics
+
+Http2TimerWheel::Http2TimerWheel(Environment* env) : env_(env), count_(0) {
+  current_ = uv_now(env->event_loop()) / HTTP2_TIMER_TICK;
+  memset(slots_, 0, sizeof(slots_));
+  uv_timer_init(env->event_loop(), &timer_);
+  uv_unref(reinterpret_cast<uv_handle_t*>(&timer_));
+  timer_.data = this;
+  env->RegisterHandleCleanup(reinterpret_cast<uv_handle_t*>(&timer_),
+                             Cleanup,
+                             this);
+}
+
+Http2TimerWheel* Http2TimerWheel::Get(Environment* env) {
+  Http2TimerWheel* wheel = env->http2_timer_wheel();
+  if (wheel == nullptr) {
+    wheel = new Http2TimerWheel(env);
+    env->set_http2_timer_wheel(wheel);
+  }
+  return wheel;
+}
+
+void Http2TimerWheel::Link(Http2Timer** slot, Http2Timer* timer) {
+  timer->next = *slot;
+  if (*slot != nullptr)
+    (*slot)->pprev = &timer->next;
+  *slot = timer;
+  timer->pprev = slot;
+}
+
+void Http2TimerWheel::Unlink(Http2Timer* timer) {
+  *timer->pprev = timer->next;
+  if (timer->next != nullptr)
+    timer->next->pprev = timer->pprev;
+  timer->next = nullptr;
+  timer->pprev = nullptr;
+}
+
+void Http2TimerWheel::Schedule(Http2Timer* timer, uint64_t when) {
+  uint64_t expiry = (when + HTTP2_TIMER_TICK - 1) / HTTP2_TIMER_TICK;
+  if (timer->pprev != nullptr) {
+    if (timer->expiry <= expiry)
+      return;
+    Unlink(timer);
+  } else if (count_++ == 0) {
+    Start();
+  }
+  timer->expiry = expiry;
+  Insert(timer);
+}
+
+void Http2TimerWheel::Cancel(Http2Timer* timer) {
+  if (timer->pprev == nullptr)
+    return;
+  Unlink(timer);
+  if (--count_ == 0)
+    uv_timer_stop(&timer_);
+}
+
+// An entry goes into the lowest level whose slots, taken together, span
+// its distance from the current tick. Entries beyond the highest level are
+// kept in its furthest slot, and placed again once that slot is reached.
+void Http2TimerWheel::Insert(Http2Timer* timer) {
+  static const uint64_t range =
+      uint64_t{1} << (HTTP2_TIMER_SLOT_BITS * HTTP2_TIMER_LEVELS);
+  uint64_t expiry = std::max(timer->expiry, current_ + 1);
+  uint64_t delta = std::min(expiry - current_, range - 1);
+  expiry = current_ + delta;
+  int level = 0;
+  while (delta >> (HTTP2_TIMER_SLOT_BITS * (level + 1)) != 0)
+    level++;
+  size_t slot =
+      (expiry >> (HTTP2_TIMER_SLOT_BITS * level)) & (HTTP2_TIMER_SLOTS - 1);
+  Link(&slots_[level][slot], timer);
+}
+
+void Http2TimerWheel::Advance(uint64_t now) {
+  while (current_ < now && count_ > 0) {
+    current_++;
+    // Once the slots of the levels below have all been passed, the entries
+    // in the next slot of a level are placed again, into lower levels
+    for (int level = 1; level < HTTP2_TIMER_LEVELS; level++) {
+      int shift = HTTP2_TIMER_SLOT_BITS * level;
+      if ((current_ & ((uint64_t{1} << shift) - 1)) != 0)
+        break;
+      Cascade(level, (current_ >> shift) & (HTTP2_TIMER_SLOTS - 1));
+    }
+    Expire(current_ & (HTTP2_TIMER_SLOTS - 1));
+  }
+  if (count_ == 0)
+    current_ = now;
+}
+
+void Http2TimerWheel::Cascade(int level, size_t slot) {
+  Http2Timer* timer = slots_[level][slot];
+  slots_[level][slot] = nullptr;
+  while (timer != nullptr) {
+    Http2Timer* next = timer->next;
+    timer->next = nullptr;
+    timer->pprev = nullptr;
+    Insert(timer);
+    timer = next;
+  }
+}
+
+// The expired entries are moved to a list of their own before any stream is
+// called. Resetting a stream may close others, which cancel their entries,
+// and streams may schedule their entries again, which cannot place them in
+// the slot being expired.
+void Http2TimerWheel::Expire(size_t slot) {
+  Http2Timer* expired = slots_[0][slot];
+  if (expired == nullptr)
+    return;
+  slots_[0][slot] = nullptr;
+  expired->pprev = &expired;
+  uint64_t now = uv_now(env_->event_loop());
+  while (expired != nullptr) {
+    Http2Timer* timer = expired;
+    Unlink(timer);
+    if (--count_ == 0)
+      uv_timer_stop(&timer_);
+    timer->stream->OnDeadline(now);
+  }
+}
+
+void Http2TimerWheel::Start() {
+  current_ = uv_now(env_->event_loop()) / HTTP2_TIMER_TICK;
+  uv_timer_start(&timer_, OnTimer, HTTP2_TIMER_TICK, HTTP2_TIMER_TICK);
+}
+
+void Http2TimerWheel::OnTimer(uv_timer_t* handle) {
+  Http2TimerWheel* wheel = static_cast<Http2TimerWheel*>(handle->data);
+  Environment* env = wheel->env_;
+  HandleScope handle_scope(env->isolate());
+  Context::Scope context_scope(env->context());
+  wheel->Advance(uv_now(env->event_loop()) / HTTP2_TIMER_TICK);
+}
+
+void Http2TimerWheel::Cleanup(Environment* env,
+                              uv_handle_t* handle,
+                              void* arg) {
+  Http2TimerWheel* wheel = static_cast<Http2TimerWheel*>(arg);
+  // Streams that outlive the wheel must find their entries unscheduled, and
+  // their sessions no longer list them as timed
+  for (int level = 0; level < HTTP2_TIMER_LEVELS; level++) {
+    for (size_t slot = 0; slot < HTTP2_TIMER_SLOTS; slot++) {
+      while (wheel->slots_[level][slot] != nullptr)
+        wheel->slots_[level][slot]->stream->CancelDeadline();
+    }
+  }
+  CHECK_EQ(wheel->count_, 0);
+  uv_close(handle, [](uv_handle_t* handle) {
+    Http2TimerWheel* wheel = static_cast<Http2TimerWheel*>(handle->data);
+    Environment* env = wheel->env_;
+    env->set_http2_timer_wheel(nullptr);
+    delete wheel;
+    env->FinishHandleCleanup(handle);
+  });
+}
+
 // Http2Session Statics
 
+void Http2Session::CancelDeadlines() {
+  std::vector<Http2Stream*> timed;
+  timed.swap(timed_streams_);
+  // Without a wheel, as after it has been cleaned up, nothing is scheduled
+  Http2TimerWheel* wheel = env()->http2_timer_wheel();
+  if (wheel == nullptr)
+    return;
+  for (Http2Stream* stream : timed)
+    wheel->Cancel(&stream->deadline_timer_);
+}
+
+bool Http2Session::QueueData(Http2Stream* stream, size_t length) {
+  if (IsOverMemoryLimit(length))
+    return false;
+  if (stream->queued_data_ == 0 && length > 0)
+    sending_streams_.push_back(stream);
+  stream->queued_data_ += length;
+  queued_data_ += length;
+  MarkFieldsDirty(stream);
+  return true;
+}
+
+void Http2Session::DequeueData(Http2Stream* stream, size_t length) {
+  if (stream->queued_data_ == 0)
+    return;
+  if (length > stream->queued_data_)
+    length = stream->queued_data_;
+  stream->queued_data_ -= length;
+  queued_data_ -= length;
+  MarkFieldsDirty(stream);
+  if (stream->queued_data_ == 0) {
+    sending_streams_.erase(
+        std::find(sending_streams_.begin(), sending_streams_.end(), stream));
+    ScheduleResume();
+  }
+}
+
+void Http2Session::DetachStreams() {
+  for (Http2Stream* stream = streams_;
+       stream != nullptr;
+       stream = stream->next_) {
+    stream->ClearHeaders();
+    stream->closed_ = true;
+    stream->fields_dirty_ = false;
+    stream->UpdateFields();
+    stream->stream_ = nullptr;
+  }
+  dirty_streams_.clear();
+}
+
+void Http2Session::CloseFileSources() {
+  for (Http2FileSource* file : file_sources_)
+    file->Close();
+  file_sources_.clear();
+}
+
+void Http2Session::UpdateFields() {
+  if (session_ != nullptr) {
+    fields_[SESSION_FIELD_EFFECTIVE_LOCAL_WINDOW_SIZE] =
+        nghttp2_session_get_effective_local_window_size(session_);
+    fields_[SESSION_FIELD_EFFECTIVE_RECV_DATA_LENGTH] =
+        nghttp2_session_get_effective_recv_data_length(session_);
+    fields_[SESSION_FIELD_NEXT_STREAM_ID] =
+        nghttp2_session_get_next_stream_id(session_);
+    fields_[SESSION_FIELD_LOCAL_WINDOW_SIZE] =
+        nghttp2_session_get_local_window_size(session_);
+    fields_[SESSION_FIELD_LAST_PROC_STREAM_ID] =
+        nghttp2_session_get_last_proc_stream_id(session_);
+    fields_[SESSION_FIELD_REMOTE_WINDOW_SIZE] =
+        nghttp2_session_get_remote_window_size(session_);
+    fields_[SESSION_FIELD_OUTBOUND_QUEUE_SIZE] =
+        nghttp2_session_get_outbound_queue_size(session_);
+    fields_[SESSION_FIELD_DEFLATE_DYNAMIC_TABLE_SIZE] =
+        nghttp2_session_get_hd_deflate_dynamic_table_size(session_);
+    fields_[SESSION_FIELD_INFLATE_DYNAMIC_TABLE_SIZE] =
+        nghttp2_session_get_hd_inflate_dynamic_table_size(session_);
+    fields_[SESSION_FIELD_REMOTE_ENABLE_PUSH] =
+        nghttp2_session_get_remote_settings(session_,
+                                            NGHTTP2_SETTINGS_ENABLE_PUSH);
+  }
+  fields_[SESSION_FIELD_QUEUED_DATA] = queued_data_;
+  for (Http2Stream* stream : dirty_streams_) {
+    stream->fields_dirty_ = false;
+    stream->UpdateFields();
+  }
+  dirty_streams_.clear();
+}
+
+// Weights given to each priority level by the weighted-fair policy
+static const int32_t kPriorityWeights[HTTP2_PRIORITY_LEVELS] = {
+  256, 128, 64, 32, 16, 8, 4, 2
+};
+
+void Http2Session::ApplySchedulingPolicy(Http2Stream* stream) {
+  if (scheduling_policy_ == HTTP2_SCHEDULING_PRIORITY_TREE ||
+      **stream == nullptr) {
+    return;
+  }
+  // Every stream depends directly on the root. The strict policy decides
+  // between priority levels itself, so within a level, as under the
+  // round-robin policy, streams share the connection equally.
+  int32_t weight = NGHTTP2_DEFAULT_WEIGHT;
+  if (scheduling_policy_ == HTTP2_SCHEDULING_WEIGHTED_FAIR)
+    weight = kPriorityWeights[stream->priority_];
+  nghttp2_priority_spec spec;
+  nghttp2_priority_spec_init(&spec, 0, weight, 0);
+  nghttp2_session_change_stream_priority(session_, stream->id(), &spec);
+}
+
+bool Http2Session::DeferForPriority(Http2Stream* stream) {
+  if (scheduling_policy_ != HTTP2_SCHEDULING_STRICT)
+    return false;
+  for (Http2Stream* other : sending_streams_) {
+    if (other->priority_ < stream->priority_ && **other != nullptr &&
+        nghttp2_session_get_stream_remote_window_size(session_,
+                                                      other->id()) > 0) {
+      if (std::find(deferred_streams_.begin(), deferred_streams_.end(),
+                    stream) == deferred_streams_.end()) {
+        deferred_streams_.push_back(stream);
+      }
+      return true;
+    }
+  }
+  return false;
+}
+
+// Limits each DATA frame to the session's scheduling quantum, so that
+// nghttp2 picks the next stream to send after that many bytes.
+ssize_t Http2Session::data_source_read_length(
+    nghttp2_session* session,
+    uint8_t frame_type,
+    int32_t stream_id,
+    int32_t session_remote_window_size,
+    int32_t stream_remote_window_size,
+    uint32_t remote_max_frame_size,
+    void* user_data) {
+  Http2Session* session_obj = static_cast<Http2Session*>(user_data);
+  return MIN(session_obj->scheduling_quantum_, remote_max_frame_size);
+}
+
+ssize_t Http2Session::AppendDateHeader(size_t count) {
+  header_nv_.resize(count);
+  header_nv_.push_back(Http2DateCache::Get(env())->nv());
+  return header_nv_.size();
+}
+
+ssize_t Http2Session::AppendHeaderTemplate(size_t count, int32_t id) {
+  if (id < 0 || static_cast<size_t>(id) >= header_templates_.size())
+    return NGHTTP2_ERR_INVALID_ARGUMENT;
+  const Http2HeaderTemplate* tmpl = header_templates_[id];
+  header_nv_.resize(count);
+  for (const nghttp2_nv& nv : tmpl->nva) {
+    bool overridden = false;
+    for (size_t n = 0; n < count; n++) {
+      if (header_nv_[n].namelen == nv.namelen &&
+          memcmp(header_nv_[n].name, nv.name, nv.namelen) == 0) {
+        overridden = true;
+        break;
+      }
+    }
+    if (!overridden)
+      header_nv_.push_back(nv);
+  }
+  return header_nv_.size();
+}
+
+
+// Maps each byte that may appear in a header field name (a token, see
+// RFC 7230, Section 3.2.6) to its lowercase form, and every other byte to 0
+static const uint8_t kHeaderNameChars[256] = {
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, '!', 0, '#', '$', '%', '&', '\'', 0, 0, '*', '+', 0, '-', '.', 0,
+  '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 0, 0, 0, 0, 0, 0,
+  0, 'a', 'b', 'c', 'd', 'e', 'f', 'g',
+  'h', 'i', 'j', 'k', 'l', 'm', 'n', 'o',
+  'p', 'q', 'r', 's', 't', 'u', 'v', 'w',
+  'x', 'y', 'z', 0, 0, 0, '^', '_',
+  '`', 'a', 'b', 'c', 'd', 'e', 'f', 'g',
+  'h', 'i', 'j', 'k', 'l', 'm', 'n', 'o',
+  'p', 'q', 'r', 's', 't', 'u', 'v', 'w',
+  'x', 'y', 'z', 0, '|', 0, '~', 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+};
+
+// Headers that apply to a single HTTP/1 connection, which RFC 7540,
+// Section 8.1.2.2 does not allow in HTTP/2. TE is permitted with the value
+// "trailers" only. name must already be lowercase.
+static bool IsConnectionSpecificHeader(const uint8_t* name, size_t namelen,
+                                       const uint8_t* value, size_t valuelen) {
+#define IS(str)                                                               \
+  (namelen == sizeof(str) - 1 && memcmp(name, str, namelen) == 0)
+  switch (namelen) {
+    case 2:
+      return IS("te") &&
+             !(valuelen == 8 &&
+               StringEqualNoCaseN(reinterpret_cast<const char*>(value),
+                                  "trailers", 8));
+    case 7:
+      return IS("upgrade");
+    case 10:
+      return IS("connection") || IS("keep-alive");
+    case 14:
+      return IS("http2-settings");
+    case 16:
+      return IS("proxy-connection");
+    case 17:
+      return IS("transfer-encoding");
+    default:
+      return false;
+  }
+#undef IS
+}
+
+ssize_t Http2Session::ParseHeaders(Local<Value> block, Local<Value> count) {
+  if (!block->IsString())
+    return NGHTTP2_ERR_INVALID_ARGUMENT;
+  Local<String> str = block.As<String>();
+  size_t length = str->Utf8Length();
+  // Every pair takes at least two bytes, its terminating NULs, so a count
+  // that cannot fit in the block is refused before any storage is sized
+  size_t expected = count->Uint32Value();
+  if (expected > length / 2)
+    return NGHTTP2_ERR_INVALID_ARGUMENT;
+  header_buffer_.resize(length);
+  char* data = header_buffer_.data();
+  str->WriteUtf8(data, length, nullptr, String::NO_NULL_TERMINATION);
+
+  header_nv_.resize(expected);
+  uint8_t* pos = reinterpret_cast<uint8_t*>(data);
+  uint8_t* end = pos + length;
+  for (size_t n = 0; n < expected; n++) {
+    // The name is checked and lowercased in the same pass that finds its
+    // end. Only pseudo-headers start with a colon.
+    uint8_t* name = pos;
+    uint8_t* name_end = name;
+    if (name_end < end && *name_end == ':')
+      name_end++;
+    uint8_t* first = name_end;
+    for (; name_end < end && *name_end != '\0'; name_end++) {
+      uint8_t c = kHeaderNameChars[*name_end];
+      if (c == 0)
+        return HTTP2_ERR_INVALID_HEADER_NAME;
+      *name_end = c;
+    }
+    if (name_end == end)
+      return NGHTTP2_ERR_INVALID_ARGUMENT;
+    if (name_end == first)
+      return HTTP2_ERR_INVALID_HEADER_NAME;
+    uint8_t* value = name_end + 1;
+    uint8_t* value_end =
+        static_cast<uint8_t*>(memchr(value, '\0', end - value));
+    if (value_end == nullptr)
+      return NGHTTP2_ERR_INVALID_ARGUMENT;
+    size_t namelen = name_end - name;
+    size_t valuelen = value_end - value;
+    if (IsConnectionSpecificHeader(name, namelen, value, valuelen))
+      return HTTP2_ERR_CONNECTION_SPECIFIC_HEADER;
+    header_nv_[n] = { name, value, namelen, valuelen, NGHTTP2_NV_FLAG_NONE };
+    pos = value_end + 1;
+  }
+  // Trailing data means a name or value contained an embedded NUL
+  if (pos != end)
+    return NGHTTP2_ERR_INVALID_ARGUMENT;
+  return expected;
+}
+
+
 // The Http2Session class wraps an individual nghttp2_session struct.
 Http2Session::Http2Session(Environment* env,
                            Local<Object> wrap,
                            enum http2_session_type type,
-                           Local<Value> options) :
+                           Local<Value> options,
+                           Local<Function> emit) :
                            AsyncWrap(env, wrap,
                                      AsyncWrap::PROVIDER_HTTP2SESSION),
-                           type_(type) {
+                           type_(type),
+                           stream_(nullptr),
+                           pending_head_(nullptr),
+                           pending_tail_(nullptr),
+                           pending_length_(0),
+                           slab_offset_(0),
+                           free_chunks_(nullptr),
+                           free_chunk_count_(0),
+                           write_queue_length_(0),
+                           reading_paused_(false),
+                           queued_data_(0),
+                           resume_deferred_(false),
+                           auto_window_size_(0),
+                           bdp_ping_pending_(false),
+                           bdp_ping_sent_(0),
+                           bdp_bytes_(0),
+                           bdp_max_bandwidth_(0),
+                           streams_(nullptr) {
   Wrap(object(), this);
+  emit_.Reset(env->isolate(), emit);
+  fields_ = CreateFields(env, object(), SESSION_FIELD_COUNT);
+  Http2Options opts(env, options);
+  max_session_memory_ = opts.max_session_memory();
+  scheduling_policy_ = opts.scheduling_policy();
+  scheduling_quantum_ = opts.scheduling_quantum();
+  max_auto_window_size_ = opts.max_auto_window_size();
+  stream_headers_timeout_ = opts.stream_headers_timeout();
+  stream_body_timeout_ = opts.stream_body_timeout();
+  stream_idle_timeout_ = opts.stream_idle_timeout();
   nghttp2_session_callbacks* cb;
   nghttp2_session_callbacks_new(&cb);
-  SET_SESSION_CALLBACK(cb, send)
-  SET_SESSION_CALLBACK(cb, on_frame_recv)
-  SET_SESSION_CALLBACK(cb, on_stream_close)
-  SET_SESSION_CALLBACK(cb, on_header)
-  SET_SESSION_CALLBACK(cb, on_begin_headers)
-  SET_SESSION_CALLBACK(cb, on_data_chunk_recv)
-  SET_SESSION_CALLBACK(cb, on_frame_send)
-  SET_SESSION_CALLBACK(cb, select_padding);
-  Http2Options opts(env, options);
+  SetSessionCallbacks<Http2Session>(cb);
+  if (scheduling_quantum_ > 0)
+    SET_SESSION_CALLBACK(cb, data_source_read_length);
   switch (type) {
     case SESSION_TYPE_CLIENT:
-      nghttp2_session_client_new2(&session_, cb, this, *opts);
+      nghttp2_session_client_new3(&session_, cb, this, *opts,
+                                  allocator_.mem());
       break;
     case SESSION_TYPE_SERVER:
       // Fallthrough
     default:
-      nghttp2_session_server_new2(&session_, cb, this, *opts);
+      nghttp2_session_server_new3(&session_, cb, this, *opts,
+                                  allocator_.mem());
       break;
   }
   nghttp2_session_callbacks_del(cb);
   root_ = create_stream(env, this, 0);
+  UpdateFields();
 }
 
 void Http2Session::GetUid(Local<String> property,
@@ -744,25 +1895,85 @@ void Http2Session::GetUid(Local<String> property,
   args.GetReturnValue().Set(Number::New(env->isolate(), session->get_uid()));
 }
 
-// The send callback is invoked by the nghttp library when there is outgoing
-// data to be sent to a connected peer. The user_data is a pointer to the
-// Http2Session wrapper.
-ssize_t Http2Session::send(nghttp2_session* session,
-                           const uint8_t* data,
-                           size_t length,
-                           int flags,
-                           void *user_data) {
-  Http2Session* session_obj =
-    reinterpret_cast<Http2Session*>(user_data);
-  Environment* env = session_obj->env();
+// Opaque data of the PING frames sent to sample the bandwidth-delay product
+static const uint8_t kBdpPingPayload[8] = {
+  'n', 'o', 'd', 'e', '-', 'b', 'd', 'p'
+};
+
+// The peer can never have more DATA in flight than the smaller of the
+// connection window and the initial window of its streams.
+uint32_t Http2Session::ReceiveWindowSize() {
+  int32_t connection =
+      nghttp2_session_get_effective_local_window_size(session_);
+  uint32_t stream =
+      nghttp2_session_get_local_settings(session_,
+                                         NGHTTP2_SETTINGS_INITIAL_WINDOW_SIZE);
+  uint32_t size = std::min(static_cast<uint32_t>(connection), stream);
+  // Windows that were just grown only take effect once the peer ACKs the
+  // SETTINGS frame
+  return std::max(size, auto_window_size_);
+}
+
+// Counts received DATA towards the current sample, and starts a new sample
+// if none is in progress.
+void Http2Session::SampleBdp(size_t length) {
+  if (max_auto_window_size_ == 0)
+    return;
+  bdp_bytes_ += length;
+  if (bdp_ping_pending_ || ReceiveWindowSize() >= max_auto_window_size_)
+    return;
+  if (nghttp2_submit_ping(session_, NGHTTP2_FLAG_NONE, kBdpPingPayload) == 0)
+    bdp_ping_pending_ = true;
+}
 
-  // Copy the data because we don't own it and cannot be sure
-  // exactly when it will be released by the nghttp2 library.
-  Local<Object> buffer =
-      Buffer::Copy(env, reinterpret_cast<const char*>(data),
-                   length).ToLocalChecked();
-  EMIT(env, session_obj, "send", buffer);
-  return length;
+// The sample covers the DATA received from the moment the PING is written
+// until its ACK arrives, that is, one round trip.
+void Http2Session::OnBdpPingSent() {
+  bdp_ping_sent_ = uv_hrtime();
+  bdp_bytes_ = 0;
+}
+
+// If the peer sent close to a full window within the round trip, and the
+// bandwidth has not dropped below the decayed peak of the earlier samples,
+// the windows are what limits the peer. Both the connection window and the
+// initial window of the streams are then grown to twice the sample.
+void Http2Session::OnBdpPingAck() {
+  if (!bdp_ping_pending_ || bdp_ping_sent_ == 0)
+    return;
+  bdp_ping_pending_ = false;
+  uint64_t rtt = uv_hrtime() - bdp_ping_sent_;
+  size_t sample = bdp_bytes_;
+  bdp_ping_sent_ = 0;
+  bdp_bytes_ = 0;
+  if (rtt == 0)
+    return;
+  double bandwidth = static_cast<double>(sample) * 1e9 / rtt;
+  bdp_max_bandwidth_ *= HTTP2_BDP_BANDWIDTH_DECAY;
+  if (bandwidth < bdp_max_bandwidth_)
+    return;
+  bdp_max_bandwidth_ = bandwidth;
+
+  uint32_t window = ReceiveWindowSize();
+  if (sample * 3 < static_cast<size_t>(window) * 2)
+    return;
+  uint32_t target = static_cast<uint32_t>(
+      std::min(sample * 2, static_cast<size_t>(max_auto_window_size_)));
+  if (target <= window)
+    return;
+
+  auto_window_size_ = target;
+  // Samples taken with the larger windows are compared among themselves
+  bdp_max_bandwidth_ = 0;
+  // Only one of the two windows may be too small
+  if (nghttp2_session_get_effective_local_window_size(session_) <
+          static_cast<int32_t>(target)) {
+    nghttp2_session_set_local_window_size(session_, NGHTTP2_FLAG_NONE,
+                                          0, target);
+  }
+  nghttp2_settings_entry entry = {
+    NGHTTP2_SETTINGS_INITIAL_WINDOW_SIZE, target
+  };
+  nghttp2_submit_settings(session_, NGHTTP2_FLAG_NONE, &entry, 1);
 }
 
 int Http2Session::on_rst_stream_frame(Http2Session* session,
@@ -770,7 +1981,7 @@ int Http2Session::on_rst_stream_frame(Http2Session* session,
                                       const nghttp2_frame_hd hd,
                                       const nghttp2_rst_stream rst) {
   Environment* env = session->env();
-  EMIT(env, session, "rst-stream",
+  EMIT(env, session, RST_STREAM,
        Integer::New(env->isolate(), id),
        Integer::NewFromUnsigned(env->isolate(), rst.error_code));
   return 0;
@@ -793,7 +2004,7 @@ int Http2Session::on_goaway_frame(Http2Session* session,
     opaque_data = Undefined(isolate);
   }
 
-  EMIT(env, session, "goaway",
+  EMIT(env, session, GOAWAY,
        Integer::NewFromUnsigned(isolate, goaway.error_code),
        Integer::New(isolate, goaway.last_stream_id),
        opaque_data);
@@ -806,13 +2017,8 @@ int Http2Session::on_data_frame(Http2Session* session,
                                 Http2Stream* stream,
                                 const nghttp2_frame_hd hd,
                                 const nghttp2_data data) {
-  Environment* env = session->env();
-  Isolate* isolate = env->isolate();
-  EMIT(env, session, "data",
-       stream->object(),
-       Integer::NewFromUnsigned(isolate, hd.flags),
-       Integer::New(isolate, hd.length),
-       Integer::New(isolate, data.padlen));
+  if (!stream->refused_)
+    session->AddDataEnd(stream, hd.flags);
   return 0;
 }
 
@@ -824,27 +2030,32 @@ int Http2Session::on_data_chunk_recv(nghttp2_session* session,
                                      void* user_data) {
   Http2Session* session_obj =
     reinterpret_cast<Http2Session*>(user_data);
-  Environment* env = session_obj->env();
-  Isolate* isolate = env->isolate();
-  const char* cdata = reinterpret_cast<const char*>(data);
   Http2Stream* stream =
       static_cast<Http2Stream*>(
         nghttp2_session_get_stream_user_data(session, stream_id));
-  EMIT(env, session_obj, "data-chunk",
-       stream->object(),
-       Integer::NewFromUnsigned(isolate, flags),
-       Buffer::Copy(env, cdata, len).ToLocalChecked());
+  if (!stream->refused_)
+    session_obj->AddDataChunk(stream, data, len);
+  session_obj->SampleBdp(len);
   return 0;
 }
 
+// Delivers the complete header block to JS in a single call, along with
+// the category recorded when the block began.
 int Http2Session::on_headers_frame(Http2Session* session,
                                    Http2Stream* stream,
                                    const nghttp2_frame_hd hd,
                                    const nghttp2_headers headers) {
+  if (stream->refused_)
+    return 0;
   Environment* env = session->env();
-  EMIT(env, session, "headers-complete",
+  Isolate* isolate = env->isolate();
+  Local<Array> fields = CollectHeaders(env, stream->current_headers_);
+  stream->ClearHeaders();
+  EMIT(env, session, HEADERS_COMPLETE,
        stream->object(),
-       Integer::NewFromUnsigned(env->isolate(), hd.flags));
+       Integer::NewFromUnsigned(isolate, hd.flags),
+       Integer::NewFromUnsigned(isolate, stream->current_headers_category_),
+       fields);
   return 0;
 }
 
@@ -855,6 +2066,25 @@ int Http2Session::on_frame_recv(nghttp2_session *session,
   Http2Session* session_obj =
     reinterpret_cast<Http2Session*>(user_data);
   Http2Stream* stream_data;
+  session_obj->fields_[SESSION_FIELD_FRAMES_RECEIVED]++;
+  if (frame->hd.stream_id != 0) {
+    stream_data =
+        reinterpret_cast<Http2Stream*>(
+            nghttp2_session_get_stream_user_data(session,
+                                                 frame->hd.stream_id));
+    if (stream_data != nullptr) {
+      session_obj->MarkFieldsDirty(stream_data);
+      stream_data->OnFrameReceived(frame->hd.type, frame->hd.flags);
+    }
+  } else if (frame->hd.type == NGHTTP2_SETTINGS) {
+    // SETTINGS_INITIAL_WINDOW_SIZE changes the window of every stream. Only
+    // those with data to send depend on it being current.
+    for (Http2Stream* stream : session_obj->sending_streams_)
+      session_obj->MarkFieldsDirty(stream);
+  }
+  // Received data must reach JS before any event that follows it
+  if (frame->hd.type != NGHTTP2_DATA)
+    session_obj->FlushDataChunks();
   // TODO(jasnell): This needs to handle the other frame types
   switch (frame->hd.type) {
   case NGHTTP2_RST_STREAM:
@@ -873,8 +2103,29 @@ int Http2Session::on_frame_recv(nghttp2_session *session,
     stream_data =
       reinterpret_cast<Http2Stream*>(
           nghttp2_session_get_stream_user_data(session, frame->hd.stream_id));
+    if (frame->headers.cat == NGHTTP2_HCAT_REQUEST)
+      session_obj->ApplySchedulingPolicy(stream_data);
     return on_headers_frame(session_obj, stream_data,
                             frame->hd, frame->headers);
+  case NGHTTP2_PRIORITY:
+    // Priorities sent by the peer are overridden by the scheduling policy
+    stream_data =
+      reinterpret_cast<Http2Stream*>(
+          nghttp2_session_get_stream_user_data(session, frame->hd.stream_id));
+    if (stream_data != nullptr)
+      session_obj->ApplySchedulingPolicy(stream_data);
+    return 0;
+  case NGHTTP2_WINDOW_UPDATE:
+    // A stream deferred for a higher priority one may now be able to send
+    session_obj->ScheduleResume();
+    return 0;
+  case NGHTTP2_PING:
+    if ((frame->hd.flags & NGHTTP2_FLAG_ACK) &&
+        memcmp(frame->ping.opaque_data, kBdpPingPayload,
+               sizeof(kBdpPingPayload)) == 0) {
+      session_obj->OnBdpPingAck();
+    }
+    return 0;
   default:
     return 0;
   }
@@ -895,7 +2146,25 @@ int Http2Session::on_stream_close(nghttp2_session *session,
         nghttp2_session_get_stream_user_data(session, stream_id));
   if (!stream_data)
     return 0;
-  EMIT(env, session_obj, "stream-close",
+  stream_data->closed_ = true;
+  session_obj->MarkFieldsDirty(stream_data);
+  stream_data->CancelDeadline();
+  stream_data->ClearHeaders();
+  session_obj->DequeueData(stream_data, stream_data->queued_data_);
+  std::vector<Http2Stream*>& deferred = session_obj->deferred_streams_;
+  deferred.erase(std::remove(deferred.begin(), deferred.end(), stream_data),
+                 deferred.end());
+  if (stream_data->file_source_ != nullptr) {
+    std::vector<Http2FileSource*>& files = session_obj->file_sources_;
+    files.erase(std::remove(files.begin(), files.end(),
+                            stream_data->file_source_),
+                files.end());
+    stream_data->file_source_->Close();
+    stream_data->file_source_ = nullptr;
+  }
+  stream_data->buffer_source_.Clear();
+  session_obj->FlushDataChunks();
+  EMIT(env, session_obj, STREAM_CLOSE,
        stream_data->object(),
        Integer::NewFromUnsigned(env->isolate(), error_code));
 
@@ -903,29 +2172,19 @@ int Http2Session::on_stream_close(nghttp2_session *session,
 }
 
 // Called when an individual header name+value pair is processed by nghttp2.
+// The pair is retained on the stream until the header block is complete.
 int Http2Session::on_header(nghttp2_session *session,
                             const nghttp2_frame *frame,
-                            const uint8_t *name,
-                            size_t namelen,
-                            const uint8_t *value,
-                            size_t valuelen,
+                            nghttp2_rcbuf *name,
+                            nghttp2_rcbuf *value,
                             uint8_t flags,
                             void *user_data) {
-  Http2Session* session_obj =
-    reinterpret_cast<Http2Session*>(user_data);
-  Environment* env = session_obj->env();
-  Isolate* isolate = env->isolate();
-
   Http2Stream* stream_data =
       reinterpret_cast<Http2Stream*>(
         nghttp2_session_get_stream_user_data(session, frame->hd.stream_id));
   CHECK(stream_data != nullptr);
-
-  EMIT(env, session_obj, "header",
-       stream_data->object(),
-       OneByteString(isolate, name, namelen),
-       OneByteString(isolate, value, valuelen));
-
+  if (!stream_data->refused_)
+    stream_data->AddHeader(name, value);
   return 0;
 }
 
@@ -943,10 +2202,21 @@ int Http2Session::on_begin_headers(nghttp2_session* session,
   if (stream_data == nullptr) {
     stream_data = create_stream(env, session_obj, frame->hd.stream_id);
   }
-
-  EMIT(env, session_obj, "begin-headers",
-       stream_data->object(),
-       Integer::NewFromUnsigned(env->isolate(), frame->headers.cat));
+  stream_data->ClearHeaders();
+  stream_data->current_headers_category_ = frame->headers.cat;
+
+  // Shed new streams rather than let the session grow past its limit
+  if (frame->headers.cat == NGHTTP2_HCAT_REQUEST &&
+      session_obj->IsOverMemoryLimit()) {
+    stream_data->refused_ = true;
+    nghttp2_submit_rst_stream(session, NGHTTP2_FLAG_NONE,
+                              frame->hd.stream_id,
+                              NGHTTP2_ENHANCE_YOUR_CALM);
+  } else if (frame->headers.cat == NGHTTP2_HCAT_REQUEST) {
+    stream_data->StartDeadlines(session_obj->stream_headers_timeout_,
+                                session_obj->stream_body_timeout_,
+                                session_obj->stream_idle_timeout_);
+  }
 
   return 0;
 }
@@ -960,7 +2230,23 @@ int Http2Session::on_frame_send(nghttp2_session* session,
     reinterpret_cast<Http2Session*>(user_data);
   Environment* env = session_obj->env();
   Isolate* isolate = env->isolate();
-  EMIT(env, session_obj, "frame-sent",
+  session_obj->fields_[SESSION_FIELD_FRAMES_SENT]++;
+  if (frame->hd.stream_id != 0) {
+    Http2Stream* stream =
+        reinterpret_cast<Http2Stream*>(
+            nghttp2_session_get_stream_user_data(session,
+                                                 frame->hd.stream_id));
+    if (stream != nullptr) {
+      session_obj->MarkFieldsDirty(stream);
+      stream->OnFrameSent();
+    }
+  } else if (frame->hd.type == NGHTTP2_PING &&
+             !(frame->hd.flags & NGHTTP2_FLAG_ACK) &&
+             memcmp(frame->ping.opaque_data, kBdpPingPayload,
+                    sizeof(kBdpPingPayload)) == 0) {
+    session_obj->OnBdpPingSent();
+  }
+  EMIT(env, session_obj, FRAME_SENT,
        Integer::NewFromUnsigned(isolate, frame->hd.stream_id),
        Integer::NewFromUnsigned(isolate, frame->hd.type),
        Integer::NewFromUnsigned(isolate, frame->hd.flags));
@@ -975,6 +2261,45 @@ ssize_t Http2Session::select_padding(nghttp2_session *session,
   return frame->hd.length;
 }
 
+// Called for DATA frames whose payload was supplied with
+// NGHTTP2_DATA_FLAG_NO_COPY. The frame header is copied into the pending
+// output, followed by references to the Buffers returned from _read.
+int Http2Session::send_data(nghttp2_session* session,
+                            nghttp2_frame* frame,
+                            const uint8_t* framehd,
+                            size_t length,
+                            nghttp2_data_source* source,
+                            void* user_data) {
+  Http2Session* session_obj =
+    reinterpret_cast<Http2Session*>(user_data);
+  Http2Stream* stream =
+      static_cast<Http2Stream*>(
+          nghttp2_session_get_stream_user_data(session, frame->hd.stream_id));
+  static const uint8_t padding[256] = { 0 };
+
+  session_obj->AppendOutput(framehd, 9);
+  if (frame->data.padlen > 0) {
+    uint8_t padlen = frame->data.padlen - 1;
+    session_obj->AppendOutput(&padlen, 1);
+  }
+
+  // Only Http2DataProvider and Http2BufferSource use NO_COPY
+  if (stream != nullptr && stream->buffer_source_.active()) {
+    stream->buffer_source_.Send(session_obj, length);
+  } else {
+    Http2DataProvider* provider =
+      reinterpret_cast<Http2DataProvider*>(source->ptr);
+    Local<Array> chunks = provider->TakePending();
+    CHECK(!chunks.IsEmpty());
+    for (uint32_t i = 0; i < chunks->Length(); i++)
+      session_obj->AppendExternal(chunks->Get(i).As<Object>());
+  }
+
+  if (frame->data.padlen > 1)
+    session_obj->AppendOutput(padding, frame->data.padlen - 1);
+  return 0;
+}
+
 Http2Stream* Http2Session::create_stream(Environment* env,
                                          Http2Session* session,
                                          uint32_t stream_id) {
@@ -988,6 +2313,7 @@ Http2Stream* Http2Session::create_stream(Environment* env,
   if (stream_id > 0)
     Http2Stream::AddStream(stream, session);
   nghttp2_session_set_stream_user_data(**session, stream_id, stream);
+  stream->UpdateFields();
   return stream;
 }
 
@@ -1000,8 +2326,9 @@ void Http2Session::New(const FunctionCallbackInfo<Value>& args) {
       static_cast<enum http2_session_type>(args[0]->Int32Value());
   if (type != SESSION_TYPE_SERVER && type != SESSION_TYPE_CLIENT)
     return env->ThrowTypeError("Invalid HTTP/2 session type");
+  CHECK(args[2]->IsFunction());
 
-  new Http2Session(env, args.This(), type, args[1]);
+  new Http2Session(env, args.This(), type, args[1], args[2].As<Function>());
 }
 
 
@@ -1074,6 +2401,7 @@ void Http2Session::SetNextStreamID(Local<String> property,
   SESSION_OR_RETURN(session);
   int32_t id = value->Int32Value();
   nghttp2_session_set_next_stream_id(**session, id);
+  session->UpdateFields();
 }
 
 
@@ -1093,6 +2421,7 @@ void Http2Session::SetLocalWindowSize(Local<String> property,
   SESSION_OR_RETURN(session);
   nghttp2_session_set_local_window_size(
       **session, NGHTTP2_FLAG_NONE, 0, value->Int32Value());
+  session->UpdateFields();
 }
 
 void Http2Session::GetLastProcStreamID(
@@ -1115,6 +2444,39 @@ void Http2Session::GetRemoteWindowSize(
 }
 
 
+void Http2Session::GetAllocatedMemory(
+    Local<String> property,
+    const PropertyCallbackInfo<Value>& info) {
+  Http2Session* session;
+  ASSIGN_OR_RETURN_UNWRAP(&session, info.Holder());
+  Environment* env = session->env();
+  info.GetReturnValue().Set(
+      Number::New(env->isolate(), session->allocator_.allocated()));
+}
+
+
+void Http2Session::GetPeakAllocatedMemory(
+    Local<String> property,
+    const PropertyCallbackInfo<Value>& info) {
+  Http2Session* session;
+  ASSIGN_OR_RETURN_UNWRAP(&session, info.Holder());
+  Environment* env = session->env();
+  info.GetReturnValue().Set(
+      Number::New(env->isolate(), session->allocator_.peak_allocated()));
+}
+
+
+void Http2Session::GetReservedMemory(
+    Local<String> property,
+    const PropertyCallbackInfo<Value>& info) {
+  Http2Session* session;
+  ASSIGN_OR_RETURN_UNWRAP(&session, info.Holder());
+  Environment* env = session->env();
+  info.GetReturnValue().Set(
+      Number::New(env->isolate(), session->allocator_.reserved()));
+}
+
+
 void Http2Session::GetOutboundQueueSize(
     Local<String> property,
     const PropertyCallbackInfo<Value>& info) {
@@ -1209,9 +2571,14 @@ void Http2Session::Destroy(const FunctionCallbackInfo<Value>& args) {
   Http2Session* session;
   ASSIGN_OR_RETURN_UNWRAP(&session, args.Holder());
   SESSION_OR_RETURN(session);
+  session->Unconsume();
+  session->CloseFileSources();
+  session->CancelDeadlines();
+  session->DetachStreams();
   nghttp2_session_del(session->session_);
   session->session_ = nullptr;
-  EMIT0(session->env(), session, "destroy");
+  session->UpdateFields();
+  EMIT0(session->env(), session, DESTROY);
 }
 
 
@@ -1228,7 +2595,7 @@ void Http2Session::Terminate(const FunctionCallbackInfo<Value>& args) {
     nghttp2_session_terminate_session(**session, error_code);
 
   if (rv == 0) {
-    rv = nghttp2_session_send(**session);
+    rv = session->SendPendingData();
   }
 
   args.GetReturnValue().Set(rv);
@@ -1241,7 +2608,7 @@ void Http2Session::GracefulTerminate(const FunctionCallbackInfo<Value>& args) {
 
   int rv = nghttp2_submit_shutdown_notice(**session);
   if (rv == 0) {
-    rv = nghttp2_session_send(**session);
+    rv = session->SendPendingData();
   }
 
   args.GetReturnValue().Set(rv);
@@ -1278,10 +2645,11 @@ void Http2Session::ReceiveData(const FunctionCallbackInfo<Value>& args) {
   SPREAD_BUFFER_ARG(args[0], ts_obj);
 
   uint8_t* data = reinterpret_cast<uint8_t*>(ts_obj_data);
-  ssize_t readlen = nghttp2_session_mem_recv(**session, data, ts_obj_length);
+  ssize_t readlen =
+      session->Receive(args[0].As<Object>(), data, ts_obj_length);
   args.GetReturnValue().Set(Integer::NewFromUnsigned(env->isolate(), readlen));
   if (!session->WantReadOrWrite())
-    EMIT0(env, session, "canClose");
+    EMIT0(env, session, CAN_CLOSE);
 }
 
 
@@ -1291,9 +2659,542 @@ void Http2Session::SendData(const FunctionCallbackInfo<Value>& args) {
   ASSIGN_OR_RETURN_UNWRAP(&session, args.Holder());
   if (!**session)
     return;
-  args.GetReturnValue().Set(nghttp2_session_send(**session));
+  args.GetReturnValue().Set(session->SendPendingData());
   if (!session->WantReadOrWrite())
-    EMIT0(env, session, "canClose");
+    EMIT0(env, session, CAN_CLOSE);
+}
+
+// Collects every frame nghttp2 currently has queued into the pending output,
+// then flushes it either to the consumed socket as one vectored write or to
+// JS as a single Buffer via the send event.
+int Http2Session::SendPendingData() {
+  // While the consumed socket is not keeping up, leave the frames queued in
+  // nghttp2. AfterWrite() resumes once the pending writes drain.
+  if (stream_ != nullptr &&
+      write_queue_length_ >= HTTP2_MAX_WRITE_QUEUE_LENGTH) {
+    UpdateFields();
+    return 0;
+  }
+
+  HandleScope scope(env()->isolate());
+  const uint8_t* data;
+  ssize_t len;
+  for (;;) {
+    while ((len = nghttp2_session_mem_send(session_, &data)) > 0)
+      AppendOutput(data, len);
+    // Streams deferred by the strict scheduling policy are resumed here
+    // rather than from within nghttp2's callbacks. Any that still cannot
+    // send are deferred again by the next pass.
+    if (len < 0 || !resume_deferred_)
+      break;
+    resume_deferred_ = false;
+    std::vector<Http2Stream*> deferred;
+    deferred.swap(deferred_streams_);
+    for (Http2Stream* stream : deferred)
+      nghttp2_session_resume_data(session_, stream->id());
+  }
+  fields_[SESSION_FIELD_BYTES_SENT] += pending_length_;
+  if (pending_length_ > 0)
+    FlushOutput();
+  pending_refs_.Reset();
+  UpdateFields();
+  return len < 0 ? len : 0;
+}
+
+// Copies data into the pending chunk list. The data returned by
+// nghttp2_session_mem_send() is only valid until the next call, so it must
+// be copied before more frames are serialized.
+void Http2Session::AppendOutput(const uint8_t* data, size_t length) {
+  while (length > 0) {
+    if (pending_tail_ == nullptr ||
+        pending_tail_->length == HTTP2_OUTPUT_CHUNK_SIZE) {
+      Http2OutputChunk* chunk = AllocateOutputChunk();
+      if (pending_tail_ == nullptr)
+        pending_head_ = chunk;
+      else
+        pending_tail_->next = chunk;
+      pending_tail_ = chunk;
+    }
+    size_t amount =
+        MIN(length, HTTP2_OUTPUT_CHUNK_SIZE - pending_tail_->length);
+    char* dest = pending_tail_->data + pending_tail_->length;
+    memcpy(dest, data, amount);
+    // Extend the previous segment if it ends exactly where this copy starts
+    if (!pending_bufs_.empty() &&
+        pending_bufs_.back().base + pending_bufs_.back().len == dest) {
+      pending_bufs_.back().len += amount;
+    } else {
+      pending_bufs_.push_back(uv_buf_init(dest, amount));
+    }
+    pending_tail_->length += amount;
+    pending_length_ += amount;
+    data += amount;
+    length -= amount;
+  }
+}
+
+// Adds a segment that references the contents of a Buffer instead of copying
+// it. The Buffer is kept alive until the data has been written.
+void Http2Session::AppendExternal(Local<Object> buffer) {
+  AppendExternal(buffer, 0, Buffer::Length(buffer));
+}
+
+// Appends length bytes of buffer, starting at offset, without copying them.
+// buffer is kept alive until the output has been written.
+void Http2Session::AppendExternal(Local<Object> buffer,
+                                  size_t offset,
+                                  size_t length) {
+  if (length == 0)
+    return;
+  Isolate* isolate = env()->isolate();
+  Local<Array> refs;
+  if (pending_refs_.IsEmpty()) {
+    refs = Array::New(isolate);
+    pending_refs_.Reset(isolate, refs);
+  } else {
+    refs = PersistentToLocal(isolate, pending_refs_);
+  }
+  refs->Set(refs->Length(), buffer);
+  pending_bufs_.push_back(uv_buf_init(Buffer::Data(buffer) + offset, length));
+  pending_length_ += length;
+}
+
+void Http2Session::FlushOutput() {
+  if (stream_ != nullptr)
+    return FlushOutputToSocket();
+
+  Environment* env = this->env();
+  Local<Object> buffer =
+      Buffer::New(env, pending_length_).ToLocalChecked();
+  char* dest = Buffer::Data(buffer);
+  for (const uv_buf_t& buf : pending_bufs_) {
+    memcpy(dest, buf.base, buf.len);
+    dest += buf.len;
+  }
+  ReleaseOutputChunks(pending_head_);
+  pending_head_ = pending_tail_ = nullptr;
+  pending_length_ = 0;
+  pending_bufs_.clear();
+  EMIT(env, this, SEND, buffer);
+}
+
+// The pending chunks are handed off to the write request and only returned
+// to the free list once libuv is done with them. Referenced Buffers, and the
+// session itself, which AfterWrite() returns the chunks to, are kept alive
+// by the write request object.
+void Http2Session::FlushOutputToSocket() {
+  Environment* env = this->env();
+  Http2OutputChunk* chunks = pending_head_;
+  pending_head_ = pending_tail_ = nullptr;
+  pending_length_ = 0;
+
+  MaybeStackBuffer<uv_buf_t, 16> bufs(pending_bufs_.size());
+  size_t count = pending_bufs_.size();
+  for (size_t n = 0; n < count; n++)
+    bufs[n] = pending_bufs_[n];
+  pending_bufs_.clear();
+
+  // Try writing immediately without allocating a write request
+  uv_buf_t* remaining = *bufs;
+  int err = stream_->DoTryWrite(&remaining, &count);
+  if (err != 0 || count == 0) {
+    ReleaseOutputChunks(chunks);
+    if (err != 0)
+      EmitError(NGHTTP2_ERR_CALLBACK_FAILURE);
+    return;
+  }
+
+  size_t length = 0;
+  for (size_t n = 0; n < count; n++)
+    length += remaining[n].len;
+
+  Local<Object> req_wrap_obj =
+      env->write_wrap_constructor_function()
+          ->NewInstance(env->context()).ToLocalChecked();
+  req_wrap_obj->Set(env->handle_string(), object());
+  if (!pending_refs_.IsEmpty()) {
+    req_wrap_obj->Set(env->buffer_string(),
+                      PersistentToLocal(env->isolate(), pending_refs_));
+  }
+  WriteWrap* req_wrap = WriteWrap::New(env,
+                                       req_wrap_obj,
+                                       stream_,
+                                       AfterWrite,
+                                       sizeof(Http2WriteData));
+  Http2WriteData* data = reinterpret_cast<Http2WriteData*>(req_wrap->Extra());
+  data->session = this;
+  data->chunks = chunks;
+  data->length = length;
+  err = stream_->DoWrite(req_wrap, remaining, count, nullptr);
+  if (err) {
+    req_wrap->Dispose();
+    ReleaseOutputChunks(chunks);
+    EmitError(NGHTTP2_ERR_CALLBACK_FAILURE);
+    return;
+  }
+  write_queue_length_ += length;
+}
+
+// Once a write completes, serialization resumes if it was held back by
+// SendPendingData(), and reading resumes if it was paused by OnReadImpl().
+void Http2Session::AfterWrite(WriteWrap* req_wrap, int status) {
+  // Write errors are reported through the socket itself
+  Http2WriteData* data = reinterpret_cast<Http2WriteData*>(req_wrap->Extra());
+  Http2Session* session = data->session;
+  session->ReleaseOutputChunks(data->chunks);
+  session->write_queue_length_ -= data->length;
+  req_wrap->Dispose();
+
+  if (status != 0 || session->stream_ == nullptr || !**session)
+    return;
+
+  if (session->write_queue_length_ < HTTP2_MAX_WRITE_QUEUE_LENGTH &&
+      nghttp2_session_want_write(**session)) {
+    int rv = session->SendPendingData();
+    if (rv < 0)
+      return session->EmitError(rv);
+  }
+
+  if (session->reading_paused_ &&
+      nghttp2_session_get_outbound_queue_size(**session) <=
+          HTTP2_MAX_OUTBOUND_QUEUE_SIZE / 2) {
+    session->reading_paused_ = false;
+    session->stream_->ReadStart();
+  }
+}
+
+Http2OutputChunk* Http2Session::AllocateOutputChunk() {
+  Http2OutputChunk* chunk = free_chunks_;
+  if (chunk != nullptr) {
+    free_chunks_ = chunk->next;
+    free_chunk_count_--;
+  } else {
+    chunk = new Http2OutputChunk;
+  }
+  chunk->next = nullptr;
+  chunk->length = 0;
+  return chunk;
+}
+
+void Http2Session::ReleaseOutputChunks(Http2OutputChunk* chunk) {
+  while (chunk != nullptr) {
+    Http2OutputChunk* next = chunk->next;
+    if (free_chunk_count_ < HTTP2_MAX_FREE_OUTPUT_CHUNKS) {
+      chunk->next = free_chunks_;
+      free_chunks_ = chunk;
+      free_chunk_count_++;
+    } else {
+      delete chunk;
+    }
+    chunk = next;
+  }
+}
+
+void Http2Session::EmitError(int rv) {
+  Environment* env = this->env();
+  Isolate* isolate = env->isolate();
+  Local<Object> err =
+      Exception::Error(OneByteString(isolate, nghttp2_strerror(rv)))
+          ->ToObject(isolate);
+  err->Set(env->code_string(), Integer::New(isolate, rv));
+  err->Set(env->errno_string(), Integer::New(isolate, rv));
+  EMIT(env, this, ERROR, err);
+}
+
+ssize_t Http2Session::Receive(Local<Object> buffer,
+                              const uint8_t* data,
+                              size_t len) {
+  recv_buffer_.Reset(env()->isolate(), buffer);
+  ssize_t ret = nghttp2_session_mem_recv(session_, data, len);
+  recv_buffer_.Reset();
+  FlushDataChunks();
+  if (ret > 0)
+    fields_[SESSION_FIELD_BYTES_RECEIVED] += ret;
+  // Refusing new streams does not help if the memory is held by nghttp2
+  // itself (for instance, by header blocks or the HPACK tables), so the
+  // whole session is terminated instead.
+  if (ret >= 0 && session_ != nullptr && max_session_memory_ > 0 &&
+      allocator_.allocated() > max_session_memory_) {
+    nghttp2_session_terminate_session(session_, NGHTTP2_ENHANCE_YOUR_CALM);
+  }
+  UpdateFields();
+  return ret;
+}
+
+// Queues a received chunk of DATA payload for delivery to JS. nghttp2 passes
+// payloads as pointers into the input being processed, so the chunk is
+// normally delivered as a slice of recv_buffer_ without being copied. When
+// the input was read from a consumed socket, the slice keeps the whole slab
+// it was read into alive for as long as JS holds on to it.
+void Http2Session::AddDataChunk(Http2Stream* stream,
+                                const uint8_t* data,
+                                size_t len) {
+  Environment* env = this->env();
+  Isolate* isolate = env->isolate();
+  Local<Object> chunk;
+
+  const char* cdata = reinterpret_cast<const char*>(data);
+  Local<Object> input;
+  const char* base = nullptr;
+  if (!recv_buffer_.IsEmpty()) {
+    input = PersistentToLocal(isolate, recv_buffer_);
+    base = Buffer::Data(input);
+  }
+  if (base != nullptr && cdata >= base &&
+      cdata + len <= base + Buffer::Length(input)) {
+    Local<v8::Uint8Array> view = input.As<v8::Uint8Array>();
+    chunk = Buffer::New(env,
+                        view->Buffer(),
+                        view->ByteOffset() + (cdata - base),
+                        len).ToLocalChecked();
+  } else {
+    chunk = Buffer::Copy(env, cdata, len).ToLocalChecked();
+  }
+  AddDataItem(stream, chunk);
+}
+
+// Queues the end of a received DATA frame, identified by its frame flags
+void Http2Session::AddDataEnd(Http2Stream* stream, uint8_t flags) {
+  AddDataItem(stream, Integer::NewFromUnsigned(env()->isolate(), flags));
+}
+
+// Appends a stream and its chunk or frame end to recv_chunks_
+void Http2Session::AddDataItem(Http2Stream* stream, Local<Value> item) {
+  Isolate* isolate = env()->isolate();
+  Local<Array> chunks;
+  if (recv_chunks_.IsEmpty()) {
+    chunks = Array::New(isolate);
+    recv_chunks_.Reset(isolate, chunks);
+  } else {
+    chunks = PersistentToLocal(isolate, recv_chunks_);
+  }
+  uint32_t index = chunks->Length();
+  chunks->Set(index, stream->object());
+  chunks->Set(index + 1, item);
+}
+
+// Delivers the queued DATA chunks and frame ends to JS in a single call
+void Http2Session::FlushDataChunks() {
+  if (recv_chunks_.IsEmpty())
+    return;
+  Environment* env = this->env();
+  Local<Array> chunks = PersistentToLocal(env->isolate(), recv_chunks_);
+  recv_chunks_.Reset();
+  EMIT(env, this, DATA_CHUNKS, chunks);
+}
+
+void Http2Session::OnAllocImpl(size_t suggested_size,
+                               uv_buf_t* buf,
+                               void* ctx) {
+  Http2Session* session = static_cast<Http2Session*>(ctx);
+  Environment* env = session->env();
+  Isolate* isolate = env->isolate();
+  HandleScope scope(isolate);
+
+  Local<Object> slab;
+  if (session->slab_.IsEmpty() ||
+      kAllocBufferSize - session->slab_offset_ < kMinAllocSize) {
+    slab = Buffer::New(env, kAllocBufferSize).ToLocalChecked();
+    session->slab_.Reset(isolate, slab);
+    session->slab_offset_ = 0;
+  } else {
+    slab = PersistentToLocal(isolate, session->slab_);
+  }
+
+  buf->base = Buffer::Data(slab) + session->slab_offset_;
+  buf->len = kAllocBufferSize - session->slab_offset_;
+}
+
+// Feeds data read from the consumed socket straight into nghttp2 and then
+// flushes any frames that became pending as a result. EOF and read errors are
+// passed on to the original read callback so the JS socket still sees them.
+void Http2Session::OnReadImpl(ssize_t nread,
+                              const uv_buf_t* buf,
+                              uv_handle_type pending,
+                              void* ctx) {
+  Http2Session* session = static_cast<Http2Session*>(ctx);
+  Environment* env = session->env();
+  HandleScope scope(env->isolate());
+
+  if (nread < 0) {
+    uv_buf_t tmp_buf;
+    tmp_buf.base = nullptr;
+    tmp_buf.len = 0;
+    session->prev_read_cb_.fn(nread,
+                              &tmp_buf,
+                              pending,
+                              session->prev_read_cb_.ctx);
+    return;
+  }
+
+  if (nread == 0 || !**session)
+    return;
+
+  // The data was read into the current slab (see OnAllocImpl)
+  Local<Object> slab = PersistentToLocal(env->isolate(), session->slab_);
+  CHECK_EQ(Buffer::Data(slab) + session->slab_offset_, buf->base);
+  session->slab_offset_ += nread;
+
+  uint8_t* data = reinterpret_cast<uint8_t*>(buf->base);
+  ssize_t ret = session->Receive(slab, data, nread);
+  if (ret < 0)
+    return session->EmitError(ret);
+
+  // The session may have been destroyed by one of the callbacks
+  if (!**session)
+    return;
+
+  int rv = session->SendPendingData();
+  if (rv < 0)
+    return session->EmitError(rv);
+
+  // Stop reading while the peer is not taking the frames already queued
+  if (nghttp2_session_get_outbound_queue_size(**session) >
+          HTTP2_MAX_OUTBOUND_QUEUE_SIZE) {
+    session->reading_paused_ = true;
+    session->stream_->ReadStop();
+  }
+
+  if (!session->WantReadOrWrite())
+    EMIT0(env, session, CAN_CLOSE);
+}
+
+void Http2Session::ConsumeSocket(const FunctionCallbackInfo<Value>& args) {
+  Http2Session* session;
+  ASSIGN_OR_RETURN_UNWRAP(&session, args.Holder());
+  SESSION_OR_RETURN(session);
+  CHECK(args[0]->IsExternal());
+  CHECK_EQ(session->stream_, nullptr);
+  Local<External> stream_obj = args[0].As<External>();
+  StreamBase* stream = static_cast<StreamBase*>(stream_obj->Value());
+  CHECK_NE(stream, nullptr);
+
+  stream->Consume();
+
+  session->stream_ = stream;
+  session->prev_alloc_cb_ = stream->alloc_cb();
+  session->prev_read_cb_ = stream->read_cb();
+
+  stream->set_alloc_cb({ OnAllocImpl, session });
+  stream->set_read_cb({ OnReadImpl, session });
+}
+
+// Registers a packed header block (see ParseHeaders) as a template that
+// Http2Stream::Respond can reference by id. The names and values are copied
+// into storage owned by the session so that they can be submitted without
+// nghttp2 copying them again. Returns the template id, or a negative error
+// code if the block is malformed or the session already holds
+// HTTP2_MAX_HEADER_TEMPLATES templates.
+void Http2Session::CreateHeaderTemplate(
+    const FunctionCallbackInfo<Value>& args) {
+  Http2Session* session;
+  ASSIGN_OR_RETURN_UNWRAP(&session, args.Holder());
+  SESSION_OR_RETURN(session);
+  if (session->header_templates_.size() >= HTTP2_MAX_HEADER_TEMPLATES) {
+    return args.GetReturnValue().Set(
+        static_cast<int32_t>(HTTP2_ERR_TOO_MANY_HEADER_TEMPLATES));
+  }
+  ssize_t count = session->ParseHeaders(args[0], args[1]);
+  if (count < 0)
+    return args.GetReturnValue().Set(static_cast<int32_t>(count));
+
+  const nghttp2_nv* nva = session->headers();
+  size_t length = 0;
+  for (ssize_t n = 0; n < count; n++)
+    length += nva[n].namelen + nva[n].valuelen;
+
+  Http2HeaderTemplate* tmpl = new Http2HeaderTemplate();
+  tmpl->data.resize(length);
+  tmpl->nva.resize(count);
+  uint8_t* pos = reinterpret_cast<uint8_t*>(tmpl->data.data());
+  for (ssize_t n = 0; n < count; n++) {
+    nghttp2_nv& nv = tmpl->nva[n];
+    nv.name = pos;
+    nv.namelen = nva[n].namelen;
+    memcpy(pos, nva[n].name, nv.namelen);
+    pos += nv.namelen;
+    nv.value = pos;
+    nv.valuelen = nva[n].valuelen;
+    memcpy(pos, nva[n].value, nv.valuelen);
+    pos += nv.valuelen;
+    nv.flags = NGHTTP2_NV_FLAG_NO_COPY_NAME | NGHTTP2_NV_FLAG_NO_COPY_VALUE;
+  }
+
+  session->header_templates_.push_back(tmpl);
+  args.GetReturnValue().Set(
+      static_cast<uint32_t>(session->header_templates_.size() - 1));
+}
+
+// Submits a client request. The arguments are the packed header block, the
+// number of headers and, if the request has a body, an Http2DataProvider
+// that is bound to the new stream. Returns the Http2Stream for the request
+// or a negative nghttp2 error code.
+void Http2Session::SubmitRequest(const FunctionCallbackInfo<Value>& args) {
+  Environment* env = Environment::GetCurrent(args);
+  Http2Session* session;
+  ASSIGN_OR_RETURN_UNWRAP(&session, args.Holder());
+  SESSION_OR_RETURN(session);
+  if (nghttp2_session_check_server_session(**session) != 0)
+    return env->ThrowError("Server Http2Session instances cannot "
+                           "submit requests");
+  Http2DataProvider* provider = nullptr;
+  if (args.Length() > 2 && !args[2]->IsUndefined()) {
+    if (!args[2]->IsObject())
+      return env->ThrowTypeError(
+        "Third argument must be an Http2DataProvider object");
+    ASSIGN_OR_RETURN_UNWRAP(&provider, args[2].As<Object>());
+  }
+  ssize_t count = session->ParseHeaders(args[0], args[1]);
+  if (count < 0)
+    return args.GetReturnValue().Set(static_cast<int32_t>(count));
+
+  // The stream id is assigned by nghttp2_submit_request, which takes the
+  // Http2Stream as its user data, so the id it will use is read up front
+  // and the stream is deleted again if the submission fails.
+  uint32_t id = nghttp2_session_get_next_stream_id(**session);
+  if (id > INT32_MAX)
+    return args.GetReturnValue().Set(NGHTTP2_ERR_STREAM_ID_NOT_AVAILABLE);
+  Http2Stream* stream = create_stream(env, session, id);
+  if (provider != nullptr)
+    provider->set_stream(stream);
+  int32_t ret = nghttp2_submit_request(**session, nullptr,
+                                       session->headers(), count,
+                                       provider != nullptr ? **provider
+                                                           : nullptr,
+                                       stream);
+  if (ret < 0) {
+    if (provider != nullptr)
+      provider->set_stream(nullptr);
+    Http2Stream::RemoveStream(stream);
+    ClearWrap(stream->object());
+    delete stream;
+    return args.GetReturnValue().Set(ret);
+  }
+  CHECK_EQ(static_cast<uint32_t>(ret), id);
+  args.GetReturnValue().Set(stream->object());
+}
+
+void Http2Session::UnconsumeSocket(const FunctionCallbackInfo<Value>& args) {
+  Http2Session* session;
+  ASSIGN_OR_RETURN_UNWRAP(&session, args.Holder());
+  session->Unconsume();
+}
+
+void Http2Session::Unconsume() {
+  // Already unconsumed
+  if (stream_ == nullptr)
+    return;
+
+  stream_->set_alloc_cb(prev_alloc_cb_);
+  stream_->set_read_cb(prev_read_cb_);
+  if (reading_paused_) {
+    reading_paused_ = false;
+    stream_->ReadStart();
+  }
+
+  prev_alloc_cb_.clear();
+  prev_read_cb_.clear();
+  stream_ = nullptr;
 }
 
 void Http2Session::GetStream(const FunctionCallbackInfo<Value>& args) {
@@ -1314,8 +3215,19 @@ void Http2Session::GetStream(const FunctionCallbackInfo<Value>& args) {
 
 void HttpErrorString(const FunctionCallbackInfo<Value>& args) {
   Environment* env = Environment::GetCurrent(args);
-  args.GetReturnValue().Set(
-      OneByteString(env->isolate(), nghttp2_strerror(args[0]->Uint32Value())));
+  int code = args[0]->Int32Value();
+  const char* message;
+  switch (code) {
+#define V(name, _, description)                                               \
+    case HTTP2_ERR_##name:                                                    \
+      message = description;                                                  \
+      break;
+    HEADER_ERRORS(V)
+#undef V
+    default:
+      message = nghttp2_strerror(code);
+  }
+  args.GetReturnValue().Set(OneByteString(env->isolate(), message));
 }
 
 
@@ -1330,6 +3242,20 @@ void Initialize(Local<Object> target,
   // Method to fetch the nghttp2 string description of an nghttp2 error code
   env->SetMethod(target, "nghttp2ErrorString", HttpErrorString);
 
+  // Internalized strings for the HPACK static table header names
+  if (env->http2header_names_array().IsEmpty()) {
+    Local<Array> names = Array::New(isolate);
+    uint32_t n = 0;
+#define V(name)                                                               \
+    names->Set(n++, String::NewFromOneByte(                                   \
+        isolate, reinterpret_cast<const uint8_t*>(name),                      \
+        v8::NewStringType::kInternalized,                                     \
+        sizeof(name) - 1).ToLocalChecked());
+    HTTP2_STATIC_HEADER_NAMES(V)
+#undef V
+    env->set_http2header_names_array(names);
+  }
+
   Local<String> http2DataProviderClassName =
      FIXED_ONE_BYTE_STRING(isolate, "Http2DataProvider");
   Local<String> http2HeaderClassName =
@@ -1406,6 +3332,13 @@ void Initialize(Local<Object> target,
     Local<Value>(),
     v8::DEFAULT,
     v8::DontDelete);
+  stream_template->SetAccessor(
+    FIXED_ONE_BYTE_STRING(isolate, "remoteWindowSize"),
+    Http2Stream::GetRemoteWindowSize,
+    nullptr,
+    Local<Value>(),
+    v8::DEFAULT,
+    v8::DontDelete);
   env->SetProtoMethod(stream_constructor_template,
                       "changeStreamPriority",
                       Http2Stream::ChangeStreamPriority);
@@ -1415,6 +3348,24 @@ void Initialize(Local<Object> target,
   env->SetProtoMethod(stream_constructor_template,
                       "resumeData",
                       Http2Stream::ResumeData);
+  env->SetProtoMethod(stream_constructor_template,
+                      "release",
+                      Http2Stream::Release);
+  env->SetProtoMethod(stream_constructor_template,
+                      "respondWithFD",
+                      Http2Stream::RespondWithFD);
+  env->SetProtoMethod(stream_constructor_template,
+                      "respondWithBuffer",
+                      Http2Stream::RespondWithBuffer);
+  env->SetProtoMethod(stream_constructor_template,
+                      "setPriority",
+                      Http2Stream::SetPriority);
+  env->SetProtoMethod(stream_constructor_template,
+                      "setIdleTimeout",
+                      Http2Stream::SetIdleTimeout);
+  env->SetProtoMethod(stream_constructor_template,
+                      "queueData",
+                      Http2Stream::QueueData);
   env->SetProtoMethod(stream_constructor_template,
                       "sendContinue",
                       Http2Stream::SendContinue);
@@ -1599,6 +3550,27 @@ void Initialize(Local<Object> target,
       Local<Value>(),
       v8::DEFAULT,
       v8::DontDelete);
+  instance->SetAccessor(
+      FIXED_ONE_BYTE_STRING(isolate, "allocatedMemory"),
+      Http2Session::GetAllocatedMemory,
+      nullptr,
+      Local<Value>(),
+      v8::DEFAULT,
+      v8::DontDelete);
+  instance->SetAccessor(
+      FIXED_ONE_BYTE_STRING(isolate, "peakAllocatedMemory"),
+      Http2Session::GetPeakAllocatedMemory,
+      nullptr,
+      Local<Value>(),
+      v8::DEFAULT,
+      v8::DontDelete);
+  instance->SetAccessor(
+      FIXED_ONE_BYTE_STRING(isolate, "reservedMemory"),
+      Http2Session::GetReservedMemory,
+      nullptr,
+      Local<Value>(),
+      v8::DEFAULT,
+      v8::DontDelete);
   instance->SetAccessor(
       FIXED_ONE_BYTE_STRING(isolate, "outboundQueueSize"),
       Http2Session::GetOutboundQueueSize,
@@ -1656,6 +3628,11 @@ void Initialize(Local<Object> target,
   env->SetProtoMethod(t, "sendData", Http2Session::SendData);
   env->SetProtoMethod(t, "receiveData", Http2Session::ReceiveData);
   env->SetProtoMethod(t, "getStream", Http2Session::GetStream);
+  env->SetProtoMethod(t, "consumeSocket", Http2Session::ConsumeSocket);
+  env->SetProtoMethod(t, "unconsumeSocket", Http2Session::UnconsumeSocket);
+  env->SetProtoMethod(t, "createHeaderTemplate",
+                      Http2Session::CreateHeaderTemplate);
+  env->SetProtoMethod(t, "request", Http2Session::SubmitRequest);
 
 
   target->Set(context,
@@ -1665,6 +3642,28 @@ void Initialize(Local<Object> target,
   Local<Object> constants = Object::New(isolate);
   NODE_DEFINE_CONSTANT(constants, SESSION_TYPE_SERVER);
   NODE_DEFINE_CONSTANT(constants, SESSION_TYPE_CLIENT);
+
+#define V(name) NODE_DEFINE_CONSTANT(constants, HTTP2_EVENT_##name);
+  SESSION_EVENTS(V)
+#undef V
+
+#define V(name) NODE_DEFINE_CONSTANT(constants, SESSION_FIELD_##name);
+  SESSION_FIELDS(V)
+#undef V
+  NODE_DEFINE_CONSTANT(constants, SESSION_FIELD_COUNT);
+
+#define V(name) NODE_DEFINE_CONSTANT(constants, STREAM_FIELD_##name);
+  STREAM_FIELDS(V)
+#undef V
+  NODE_DEFINE_CONSTANT(constants, STREAM_FIELD_COUNT);
+  NODE_DEFINE_CONSTANT(constants, HTTP2_SCHEDULING_PRIORITY_TREE);
+  NODE_DEFINE_CONSTANT(constants, HTTP2_SCHEDULING_STRICT);
+  NODE_DEFINE_CONSTANT(constants, HTTP2_SCHEDULING_WEIGHTED_FAIR);
+  NODE_DEFINE_CONSTANT(constants, HTTP2_SCHEDULING_ROUND_ROBIN);
+  NODE_DEFINE_CONSTANT(constants, HTTP2_MIN_SCHEDULING_QUANTUM);
+  NODE_DEFINE_CONSTANT(constants, HTTP2_MAX_HEADER_TEMPLATES);
+  NODE_DEFINE_CONSTANT(constants, HTTP2_PRIORITY_LEVELS);
+  NODE_DEFINE_CONSTANT(constants, HTTP2_DEFAULT_PRIORITY);
   NODE_DEFINE_CONSTANT(constants, NGHTTP2_STREAM_STATE_IDLE);
   NODE_DEFINE_CONSTANT(constants, NGHTTP2_STREAM_STATE_OPEN);
   NODE_DEFINE_CONSTANT(constants, NGHTTP2_STREAM_STATE_RESERVED_LOCAL);
@@ -1695,6 +3694,7 @@ void Initialize(Local<Object> target,
   NODE_DEFINE_CONSTANT(constants, NGHTTP2_NV_FLAG_NO_COPY_NAME);
   NODE_DEFINE_CONSTANT(constants, NGHTTP2_NV_FLAG_NO_COPY_VALUE);
   NODE_DEFINE_CONSTANT(constants, NGHTTP2_ERR_DEFERRED);
+  NODE_DEFINE_CONSTANT(constants, NGHTTP2_ERR_STREAM_CLOSED);
 
   NODE_DEFINE_STRING_CONSTANT(constants,
                               "HTTP2_HEADER_STATUS",
@@ -1718,6 +3718,10 @@ HTTP_STATUS_CODES(V)
 
 #define V(name) NODE_DEFINE_CONSTANT(constants, FLAG_##name);
 DATA_FLAGS(V)
+#undef V
+
+#define V(name, _, __) NODE_DEFINE_CONSTANT(constants, HTTP2_ERR_##name);
+HEADER_ERRORS(V)
 #undef V
 
   target->Set(context,
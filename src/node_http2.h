@@ -4,10 +4,12 @@
 #if defined(NODE_WANT_INTERNALS) && NODE_WANT_INTERNALS
 
 #include "node.h"
+#include "node_http2_core.h"
 #include "nghttp2/nghttp2.h"
 
 #include "env.h"
 #include "env-inl.h"
+#include "stream_base.h"
 #include "util.h"
 #include "util-inl.h"
 #include "v8.h"
@@ -15,9 +17,12 @@
 #include "vector"
 #include "map"
 
+#include <stddef.h>
+
 namespace node {
 namespace http2 {
 
+using v8::Function;
 using v8::FunctionCallbackInfo;
 using v8::Local;
 using v8::Name;
@@ -32,6 +37,63 @@ using v8::Value;
 #define HTTP2_HEADER_SCHEME ":scheme"
 #define HTTP2_HEADER_PATH ":path"
 
+// Header field names from the HPACK static table (RFC 7541, Appendix A).
+// Received headers using one of these names are passed to JS using
+// internalized strings that are created once per Environment.
+#define HTTP2_STATIC_HEADER_NAMES(V)                                          \
+  V(":authority")                                                             \
+  V(":method")                                                                \
+  V(":path")                                                                  \
+  V(":scheme")                                                                \
+  V(":status")                                                                \
+  V("accept-charset")                                                         \
+  V("accept-encoding")                                                        \
+  V("accept-language")                                                        \
+  V("accept-ranges")                                                          \
+  V("accept")                                                                 \
+  V("access-control-allow-origin")                                            \
+  V("age")                                                                    \
+  V("allow")                                                                  \
+  V("authorization")                                                          \
+  V("cache-control")                                                          \
+  V("content-disposition")                                                    \
+  V("content-encoding")                                                       \
+  V("content-language")                                                       \
+  V("content-length")                                                         \
+  V("content-location")                                                       \
+  V("content-range")                                                          \
+  V("content-type")                                                           \
+  V("cookie")                                                                 \
+  V("date")                                                                   \
+  V("etag")                                                                   \
+  V("expect")                                                                 \
+  V("expires")                                                                \
+  V("from")                                                                   \
+  V("host")                                                                   \
+  V("if-match")                                                               \
+  V("if-modified-since")                                                      \
+  V("if-none-match")                                                          \
+  V("if-range")                                                               \
+  V("if-unmodified-since")                                                    \
+  V("last-modified")                                                          \
+  V("link")                                                                   \
+  V("location")                                                               \
+  V("max-forwards")                                                           \
+  V("proxy-authenticate")                                                     \
+  V("proxy-authorization")                                                    \
+  V("range")                                                                  \
+  V("referer")                                                                \
+  V("refresh")                                                                \
+  V("retry-after")                                                            \
+  V("server")                                                                 \
+  V("set-cookie")                                                             \
+  V("strict-transport-security")                                              \
+  V("transfer-encoding")                                                      \
+  V("user-agent")                                                             \
+  V("vary")                                                                   \
+  V("via")                                                                    \
+  V("www-authenticate")
+
 #define HTTP_STATUS_CODES(V)                                                  \
   V(CONTINUE, 100)                                                            \
   V(SWITCHING_PROTOCOLS, 101)                                                 \
@@ -127,32 +189,109 @@ enum http2_data_flags {
 } http2_data_flags;
 #undef V
 
-#define EMIT(env, obj, event, ...)                                            \
+// Errors returned for outgoing header blocks that nghttp2 would accept but
+// that HTTP/2 does not allow, and for header templates that a session has
+// no room for. The codes lie outside the range used by nghttp2;
+// nghttp2ErrorString() describes them as well.
+#define HEADER_ERRORS(V)                                                      \
+  V(INVALID_HEADER_NAME, -1000, "Invalid HTTP header name")                   \
+  V(CONNECTION_SPECIFIC_HEADER, -1001,                                        \
+    "Connection-specific HTTP headers are not permitted")                     \
+  V(TOO_MANY_HEADER_TEMPLATES, -1002, "Too many header templates")
+
+#define V(name, code, _) HTTP2_ERR_##name = code,
+enum http2_header_error {
+  HEADER_ERRORS(V)
+} http2_header_error;
+#undef V
+
+// Events delivered from an Http2Session to JavaScript. Each is passed as a
+// small integer to the single dispatch function given to the session when
+// it was constructed.
+#define SESSION_EVENTS(V)                                                     \
+  V(SEND)                                                                     \
+  V(ERROR)                                                                    \
+  V(HEADERS_COMPLETE)                                                         \
+  V(STREAM_CLOSE)                                                             \
+  V(DATA_CHUNKS)                                                              \
+  V(FRAME_SENT)                                                               \
+  V(GOAWAY)                                                                   \
+  V(RST_STREAM)                                                               \
+  V(CAN_CLOSE)                                                                \
+  V(DESTROY)
+
+#define V(name) HTTP2_EVENT_##name,
+enum http2_session_event {
+  SESSION_EVENTS(V)
+} http2_session_event;
+#undef V
+
+// Fields of the Float64Array exposed as the fields property of each
+// Http2Session. They are refreshed after nghttp2 has processed received
+// data and after each send pass, so that JS can read them without calling
+// into C++. The frame and byte counters cover the life of the session.
+#define SESSION_FIELDS(V)                                                     \
+  V(EFFECTIVE_LOCAL_WINDOW_SIZE)                                              \
+  V(EFFECTIVE_RECV_DATA_LENGTH)                                               \
+  V(NEXT_STREAM_ID)                                                           \
+  V(LOCAL_WINDOW_SIZE)                                                        \
+  V(LAST_PROC_STREAM_ID)                                                      \
+  V(REMOTE_WINDOW_SIZE)                                                       \
+  V(OUTBOUND_QUEUE_SIZE)                                                      \
+  V(DEFLATE_DYNAMIC_TABLE_SIZE)                                               \
+  V(INFLATE_DYNAMIC_TABLE_SIZE)                                               \
+  V(REMOTE_ENABLE_PUSH)                                                       \
+  V(QUEUED_DATA)                                                              \
+  V(FRAMES_RECEIVED)                                                          \
+  V(FRAMES_SENT)                                                              \
+  V(BYTES_RECEIVED)                                                           \
+  V(BYTES_SENT)
+
+// Fields of the Float64Array exposed as the fields property of each
+// Http2Stream, refreshed along with those of its session
+#define STREAM_FIELDS(V)                                                      \
+  V(STATE)                                                                    \
+  V(LOCAL_WINDOW_SIZE)                                                        \
+  V(REMOTE_WINDOW_SIZE)                                                       \
+  V(QUEUED_DATA)                                                              \
+  V(TIMED_OUT)
+
+#define V(name) SESSION_FIELD_##name,
+enum http2_session_fields {
+  SESSION_FIELDS(V)
+  SESSION_FIELD_COUNT
+} http2_session_fields;
+#undef V
+
+#define V(name) STREAM_FIELD_##name,
+enum http2_stream_fields {
+  STREAM_FIELDS(V)
+  STREAM_FIELD_COUNT
+} http2_stream_fields;
+#undef V
+
+#define EMIT(env, session, event, ...)                                        \
   do {                                                                        \
     Environment::AsyncCallbackScope callback_scope(env);                      \
-    Local<Value> cb = obj->object()->Get(env->emit_string());                 \
-    CHECK(cb->IsFunction());                                                  \
     Local<Value> argv[] {                                                     \
-      FIXED_ONE_BYTE_STRING(env->isolate(), event),                           \
+      Integer::New(env->isolate(), HTTP2_EVENT_##event),                      \
       __VA_ARGS__                                                             \
     };                                                                        \
-    obj->MakeCallback(cb.As<Function>(), arraysize(argv), argv);              \
+    session->MakeCallback(session->emit_function(), arraysize(argv), argv);   \
   } while (0)
 
-#define EMIT0(env, obj, event)                                                \
+#define EMIT0(env, session, event)                                            \
   do {                                                                        \
     Environment::AsyncCallbackScope callback_scope(env);                      \
-    Local<Value> cb = obj->object()->Get(env->emit_string());                 \
-    CHECK(cb->IsFunction());                                                  \
     Local<Value> argv[] {                                                     \
-      FIXED_ONE_BYTE_STRING(env->isolate(), event)                            \
+      Integer::New(env->isolate(), HTTP2_EVENT_##event)                       \
     };                                                                        \
-    obj->MakeCallback(cb.As<Function>(), arraysize(argv), argv);              \
+    session->MakeCallback(session->emit_function(), arraysize(argv), argv);   \
   } while (0)
 
 #define SESSION_OR_RETURN(session)                                            \
   {                                                                           \
-    if (!**session) return;                                                   \
+    if (session == nullptr || !**session) return;                             \
   }
 
 enum http2_session_type {
@@ -160,6 +299,29 @@ enum http2_session_type {
   SESSION_TYPE_CLIENT
 } http2_session_type;
 
+// How DATA frames are interleaved across the streams of a session. By
+// default nghttp2 follows the priority tree built by the peer. The other
+// policies replace that tree with one built from the priority hints given
+// by stream.setPriority().
+enum http2_scheduling_policy {
+  // nghttp2's priority tree, as set by the peer
+  HTTP2_SCHEDULING_PRIORITY_TREE,
+  // A stream only sends while no stream with a higher priority can
+  HTTP2_SCHEDULING_STRICT,
+  // Streams share the connection in proportion to their priority
+  HTTP2_SCHEDULING_WEIGHTED_FAIR,
+  // Streams take turns regardless of priority
+  HTTP2_SCHEDULING_ROUND_ROBIN
+} http2_scheduling_policy;
+
+// Stream priority hints range from 0 (most urgent) to
+// HTTP2_PRIORITY_LEVELS - 1
+#define HTTP2_PRIORITY_LEVELS 8
+// The smallest non-zero schedulingQuantum. Below it, the 9 byte frame
+// header of each DATA frame costs more than finer interleaving gains.
+#define HTTP2_MIN_SCHEDULING_QUANTUM 1024
+#define HTTP2_DEFAULT_PRIORITY 3
+
 #define DEFAULT_SETTINGS_HEADER_TABLE_SIZE 4096
 #define DEFAULT_SETTINGS_ENABLE_PUSH 1
 #define DEFAULT_SETTINGS_INITIAL_WINDOW_SIZE 65535
@@ -168,7 +330,36 @@ enum http2_session_type {
 #define MIN_MAX_FRAME_SIZE DEFAULT_SETTINGS_MAX_FRAME_SIZE
 #define MAX_INITIAL_WINDOW_SIZE 2147483647
 
+#define HTTP2_OUTPUT_CHUNK_SIZE 16384
+#define HTTP2_MAX_FREE_OUTPUT_CHUNKS 8
+// While more than this many bytes are waiting to be written to a consumed
+// socket, no further frames are serialized.
+#define HTTP2_MAX_WRITE_QUEUE_LENGTH (256 * 1024)
+// While nghttp2 has more than this many frames queued for sending, reading
+// from a consumed socket is paused.
+#define HTTP2_MAX_OUTBOUND_QUEUE_SIZE 1024
+// The highest bandwidth sampled by receive window auto-tuning is scaled by
+// this factor at every sample, so that a stale peak does not keep the
+// windows from growing.
+#define HTTP2_BDP_BANDWIDTH_DECAY 0.75
+// Header templates are kept until the session is destroyed, so each session
+// holds at most this many
+#define HTTP2_MAX_HEADER_TEMPLATES 256
+// Size of each of the two buffers a file response is read into
+#define HTTP2_FILE_CHUNK_SIZE (64 * 1024)
+// The Http2TimerWheel advances in ticks of HTTP2_TIMER_TICK milliseconds.
+// Each of its HTTP2_TIMER_LEVELS levels has HTTP2_TIMER_SLOTS slots, and a
+// slot of level n spans HTTP2_TIMER_SLOTS^n ticks, so that deadlines up to
+// about 46 hours ahead are kept in place.
+#define HTTP2_TIMER_TICK 10
+#define HTTP2_TIMER_SLOT_BITS 6
+#define HTTP2_TIMER_SLOTS (1 << HTTP2_TIMER_SLOT_BITS)
+#define HTTP2_TIMER_LEVELS 4
+
+class Http2BufferSource;
 class Http2DataProvider;
+class Http2TimerWheel;
+class Http2FileSource;
 class Http2Header;
 class Http2Session;
 class Http2Stream;
@@ -211,8 +402,84 @@ class Http2Options {
     nghttp2_option_set_peer_max_concurrent_streams(options_, val);
   }
 
+  // Not an nghttp2 option; enforced by Http2Session. Zero means no limit.
+  void SetMaxSessionMemory(double val) {
+    max_session_memory_ = val > 0 ? static_cast<size_t>(val) : 0;
+  }
+
+  size_t max_session_memory() const {
+    return max_session_memory_;
+  }
+
+  // Not nghttp2 options; applied by Http2Session. A quantum of zero lets
+  // each DATA frame be as large as the peer allows.
+  void SetSchedulingPolicy(uint32_t val) {
+    scheduling_policy_ =
+        val <= HTTP2_SCHEDULING_ROUND_ROBIN ?
+            static_cast<enum http2_scheduling_policy>(val) :
+            HTTP2_SCHEDULING_PRIORITY_TREE;
+  }
+
+  void SetSchedulingQuantum(uint32_t val) {
+    scheduling_quantum_ =
+        val == 0 || val >= HTTP2_MIN_SCHEDULING_QUANTUM ?
+            val : HTTP2_MIN_SCHEDULING_QUANTUM;
+  }
+
+  enum http2_scheduling_policy scheduling_policy() const {
+    return scheduling_policy_;
+  }
+
+  uint32_t scheduling_quantum() const {
+    return scheduling_quantum_;
+  }
+
+  // Not an nghttp2 option; applied by Http2Session. Zero disables receive
+  // window auto-tuning.
+  void SetMaxAutoWindowSize(uint32_t val) {
+    max_auto_window_size_ =
+        val < NGHTTP2_MAX_WINDOW_SIZE ? val : NGHTTP2_MAX_WINDOW_SIZE;
+  }
+
+  uint32_t max_auto_window_size() const {
+    return max_auto_window_size_;
+  }
+
+  // Not nghttp2 options; applied by Http2Session to the streams opened by
+  // the peer. Zero means no deadline.
+  void SetStreamHeadersTimeout(uint32_t val) {
+    stream_headers_timeout_ = val;
+  }
+
+  void SetStreamBodyTimeout(uint32_t val) {
+    stream_body_timeout_ = val;
+  }
+
+  void SetStreamIdleTimeout(uint32_t val) {
+    stream_idle_timeout_ = val;
+  }
+
+  uint32_t stream_headers_timeout() const {
+    return stream_headers_timeout_;
+  }
+
+  uint32_t stream_body_timeout() const {
+    return stream_body_timeout_;
+  }
+
+  uint32_t stream_idle_timeout() const {
+    return stream_idle_timeout_;
+  }
+
  private:
   nghttp2_option* options_;
+  size_t max_session_memory_;
+  enum http2_scheduling_policy scheduling_policy_;
+  uint32_t scheduling_quantum_;
+  uint32_t max_auto_window_size_;
+  uint32_t stream_headers_timeout_;
+  uint32_t stream_body_timeout_;
+  uint32_t stream_idle_timeout_;
 };
 
 class Http2Settings : BaseObject {
@@ -361,6 +628,87 @@ class Http2Header : BaseObject {
 };
 
 
+// A received header field. The name and value are reference counted
+// buffers owned by nghttp2, retained until the header block is delivered.
+struct Http2HeaderField {
+  nghttp2_rcbuf* name;
+  nghttp2_rcbuf* value;
+};
+
+
+// A prebuilt header block registered with an Http2Session. The names and
+// values are stored in data and referenced by nva using the NO_COPY flags,
+// so a template must outlive the nghttp2_session that submits it.
+struct Http2HeaderTemplate {
+  std::vector<char> data;
+  std::vector<nghttp2_nv> nva;
+};
+
+
+// Supplies the body of a response from a Buffer that is not modified while
+// it is being sent, such as the body of a resource registered for server
+// push. Large DATA frames are written straight from the Buffer, without
+// calling into JS or copying the payload.
+class Http2BufferSource {
+ public:
+  Http2BufferSource() : stream_(nullptr), offset_(0), pending_(0) {
+    provider_.read_callback = on_read;
+    provider_.source.ptr = this;
+  }
+
+  ~Http2BufferSource() {
+    Clear();
+  }
+
+  nghttp2_data_provider* operator*() {
+    return &provider_;
+  }
+
+  void Set(Http2Stream* stream, Local<Object> buffer);
+
+  void Clear() {
+    buffer_.Reset();
+    stream_ = nullptr;
+  }
+
+  bool active() const {
+    return stream_ != nullptr;
+  }
+
+  // Appends the length bytes taken by the last on_read() that set
+  // NGHTTP2_DATA_FLAG_NO_COPY to the output of session
+  void Send(Http2Session* session, size_t length);
+
+ private:
+  static ssize_t on_read(nghttp2_session* session,
+                         int32_t stream_id,
+                         uint8_t* buf,
+                         size_t length,
+                         uint32_t* flags,
+                         nghttp2_data_source* source,
+                         void* user_data);
+
+  Http2Stream* stream_;
+  v8::Persistent<Object> buffer_;
+  nghttp2_data_provider provider_;
+  // Offset of the next byte to send, and of the bytes to be written by
+  // Send()
+  size_t offset_;
+  size_t pending_;
+};
+
+
+// An entry of the Http2TimerWheel, embedded in each Http2Stream. While the
+// entry is scheduled, next and pprev link it into a slot of the wheel;
+// pprev points at the next member of the previous entry, or at the slot.
+struct Http2Timer {
+  Http2Timer* next;
+  Http2Timer** pprev;
+  // The tick at which the entry expires
+  uint64_t expiry;
+  Http2Stream* stream;
+};
+
 class Http2Stream : public AsyncWrap {
  public:
   static void GetUid(Local<String> property,
@@ -375,6 +723,8 @@ class Http2Stream : public AsyncWrap {
                                      const PropertyCallbackInfo<Value>& args);
   static void GetLocalWindowSize(Local<String> property,
                                  const PropertyCallbackInfo<Value>& args);
+  static void GetRemoteWindowSize(Local<String> property,
+                                  const PropertyCallbackInfo<Value>& args);
   static void GetStreamLocalClose(Local<String> property,
                                   const PropertyCallbackInfo<Value>& args);
   static void GetStreamRemoteClose(Local<String> property,
@@ -387,18 +737,24 @@ class Http2Stream : public AsyncWrap {
   static void ChangeStreamPriority(const FunctionCallbackInfo<Value>& args);
   static void Respond(const FunctionCallbackInfo<Value>& args);
   static void ResumeData(const FunctionCallbackInfo<Value>& args);
+  static void QueueData(const FunctionCallbackInfo<Value>& args);
   static void SendContinue(const FunctionCallbackInfo<Value>& args);
   static void SendDataFrame(const FunctionCallbackInfo<Value>& args);
   static void SendPriority(const FunctionCallbackInfo<Value>& args);
   static void SendRstStream(const FunctionCallbackInfo<Value>& args);
   static void SendTrailers(const FunctionCallbackInfo<Value>& args);
   static void SendPushPromise(const FunctionCallbackInfo<Value>& args);
+  static void SetPriority(const FunctionCallbackInfo<Value>& args);
+  static void RespondWithFD(const FunctionCallbackInfo<Value>& args);
+  static void RespondWithBuffer(const FunctionCallbackInfo<Value>& args);
+  static void Release(const FunctionCallbackInfo<Value>& args);
+  static void SetIdleTimeout(const FunctionCallbackInfo<Value>& args);
 
-  nghttp2_stream* operator*() {
-    return stream_;
-  }
+  nghttp2_stream* operator*();
 
   bool IsLocalOpen() {
+    if (**this == nullptr)
+      return false;
     nghttp2_stream_proto_state state =
       nghttp2_stream_get_state(stream_);
     return state != NGHTTP2_STREAM_STATE_CLOSED &&
@@ -434,11 +790,93 @@ class Http2Stream : public AsyncWrap {
   static void RemoveStream(Http2Stream* stream);
   static void AddStream(Http2Stream* stream, Http2Session* session);
 
-  ~Http2Stream() override {}
+  ~Http2Stream() override {
+    CancelDeadline();
+    ClearHeaders();
+  }
+
+  // Refreshes the fields array from nghttp2
+  void UpdateFields();
+
+  void AddHeader(nghttp2_rcbuf* name, nghttp2_rcbuf* value) {
+    nghttp2_rcbuf_incref(name);
+    nghttp2_rcbuf_incref(value);
+    current_headers_.push_back({name, value});
+  }
+
+  void ClearHeaders() {
+    for (const Http2HeaderField& field : current_headers_) {
+      nghttp2_rcbuf_decref(field.name);
+      nghttp2_rcbuf_decref(field.value);
+    }
+    current_headers_.clear();
+  }
+
+  // Starts the deadlines of a stream opened by the peer, in milliseconds
+  // from now. A timeout of zero sets no deadline.
+  void StartDeadlines(uint32_t headers_timeout,
+                      uint32_t body_timeout,
+                      uint32_t idle_timeout);
+
+  // Updates the deadlines for a frame received on the stream
+  void OnFrameReceived(uint8_t type, uint8_t flags);
+
+  // Restarts the idle deadline as a frame is sent on the stream
+  void OnFrameSent() {
+    if (idle_timeout_ > 0)
+      last_activity_ = uv_now(env()->event_loop());
+  }
+
+  // Called by the Http2TimerWheel once the earliest deadline was due at
+  // the time it was scheduled for. now is the current time, in
+  // milliseconds of the event loop clock.
+  void OnDeadline(uint64_t now);
+
+  void CancelDeadline();
 
  private:
   friend class Http2Session;
 
+  // The earliest deadline of the stream, or zero if it has none
+  uint64_t NextDeadline() const;
+  void ScheduleDeadline();
+
+  // Header fields for the header block currently being received
+  std::vector<Http2HeaderField> current_headers_;
+  nghttp2_headers_category current_headers_category_;
+
+  // Outgoing DATA queued in JS that nghttp2 has not yet taken
+  size_t queued_data_;
+  // Set when the stream was reset because the session was over its
+  // memory limit; nothing more received on it is passed to JS.
+  bool refused_;
+  // The priority hint given by setPriority(), used by the session's
+  // scheduling policy
+  uint32_t priority_;
+  // Supplies the response body when responding with a file descriptor
+  Http2FileSource* file_source_;
+  // Supplies the response body when responding with a Buffer
+  Http2BufferSource buffer_source_;
+  // Set once nghttp2 has closed the stream, after which it may be released
+  bool closed_;
+
+  // Backing store of the fields array, and whether the stream is waiting in
+  // its session's list of streams to refresh
+  double* fields_;
+  bool fields_dirty_;
+
+  // Deadlines, in milliseconds of the event loop clock, for the request
+  // headers and for the whole request to be received, or zero. The idle
+  // deadline is idle_timeout_ milliseconds after last_activity_, when a
+  // frame was last received or sent. Once a deadline passes the stream is
+  // reset with CANCEL and timed_out_ is set.
+  uint64_t headers_deadline_;
+  uint64_t body_deadline_;
+  uint64_t idle_timeout_;
+  uint64_t last_activity_;
+  bool timed_out_;
+  Http2Timer deadline_timer_;
+
   Http2Session* session_;
   Http2Stream* prev_;
   Http2Stream* next_;
@@ -447,6 +885,97 @@ class Http2Stream : public AsyncWrap {
 };
 
 
+// Outgoing frame data is gathered into a linked list of fixed size chunks so
+// that everything produced by a single nghttp2_session_mem_send() pass can be
+// handed to the socket as one vectored write. Chunks are recycled by the
+// owning Http2Session once the write completes.
+struct Http2OutputChunk {
+  Http2OutputChunk* next;
+  size_t length;
+  char data[HTTP2_OUTPUT_CHUNK_SIZE];
+};
+
+// Stored in the extra storage of each WriteWrap used by Http2Session. The
+// write request object holds a reference to the session object, so that
+// session stays valid until the write completes.
+struct Http2WriteData {
+  Http2Session* session;
+  Http2OutputChunk* chunks;
+  size_t length;
+};
+
+
+// Length of an IMF-fixdate value, e.g. "Sun, 06 Nov 1994 08:49:37 GMT"
+#define HTTP2_DATE_LENGTH 29
+
+// Caches the value of the date header shared by every session of an
+// Environment. Once the value has been used, a timer refreshes it once per
+// second; the timer stops again after a second in which it was not used.
+// The buffer lives as long as the Environment and the value never changes
+// length, so it can be submitted to nghttp2 without being copied.
+class Http2DateCache {
+ public:
+  static Http2DateCache* Get(Environment* env);
+
+  // Returns an nghttp2_nv for the current date header
+  nghttp2_nv nv();
+
+ private:
+  explicit Http2DateCache(Environment* env);
+
+  void Update();
+  static void OnTimer(uv_timer_t* handle);
+  static void Cleanup(Environment* env, uv_handle_t* handle, void* arg);
+
+  Environment* env_;
+  uv_timer_t timer_;
+  bool active_;
+  bool used_;
+  char value_[HTTP2_DATE_LENGTH + 1];
+};
+
+
+// Keeps the stream deadlines of every session of an Environment. Rather
+// than a uv_timer_t per stream, a hierarchical timing wheel is driven by a
+// single timer, which only runs while entries are scheduled. Scheduling and
+// cancelling an entry take constant time. Entries expire in the slots of
+// the lowest level; those of higher levels are moved down as the wheel
+// reaches their slot. Deadlines are only ever checked when they expire, so
+// a deadline that is pushed back, as the idle deadline is by each frame,
+// needs no work until the entry expires and is scheduled again.
+class Http2TimerWheel {
+ public:
+  static Http2TimerWheel* Get(Environment* env);
+
+  // Schedules timer to expire at time when, in milliseconds of the event
+  // loop clock, unless it is already scheduled to expire earlier.
+  void Schedule(Http2Timer* timer, uint64_t when);
+  void Cancel(Http2Timer* timer);
+
+ private:
+  explicit Http2TimerWheel(Environment* env);
+
+  static void Link(Http2Timer** slot, Http2Timer* timer);
+  static void Unlink(Http2Timer* timer);
+  void Insert(Http2Timer* timer);
+  // Runs the wheel up to tick now
+  void Advance(uint64_t now);
+  void Cascade(int level, size_t slot);
+  void Expire(size_t slot);
+  void Start();
+
+  static void OnTimer(uv_timer_t* handle);
+  static void Cleanup(Environment* env, uv_handle_t* handle, void* arg);
+
+  Environment* env_;
+  uv_timer_t timer_;
+  // The last tick the wheel has run, and the number of scheduled entries
+  uint64_t current_;
+  size_t count_;
+  Http2Timer* slots_[HTTP2_TIMER_LEVELS][HTTP2_TIMER_SLOTS];
+};
+
+
 class Http2Session : public AsyncWrap {
  public:
   static void New(const FunctionCallbackInfo<Value>& args);
@@ -479,6 +1008,15 @@ class Http2Session : public AsyncWrap {
   static void GetLastProcStreamID(
       Local<String> property,
       const PropertyCallbackInfo<Value>& info);
+  static void GetAllocatedMemory(
+      Local<String> property,
+      const PropertyCallbackInfo<Value>& info);
+  static void GetPeakAllocatedMemory(
+      Local<String> property,
+      const PropertyCallbackInfo<Value>& info);
+  static void GetReservedMemory(
+      Local<String> property,
+      const PropertyCallbackInfo<Value>& info);
   static void GetOutboundQueueSize(
       Local<String> property,
       const PropertyCallbackInfo<Value>& info);
@@ -517,11 +1055,94 @@ class Http2Session : public AsyncWrap {
   static void Terminate(const FunctionCallbackInfo<Value>& args);
   static void Consume(const FunctionCallbackInfo<Value>& args);
   static void ConsumeSession(const FunctionCallbackInfo<Value>& args);
+  static void ConsumeSocket(const FunctionCallbackInfo<Value>& args);
+  static void UnconsumeSocket(const FunctionCallbackInfo<Value>& args);
+  static void CreateHeaderTemplate(const FunctionCallbackInfo<Value>& args);
+  static void SubmitRequest(const FunctionCallbackInfo<Value>& args);
   static void CreateIdleStream(const FunctionCallbackInfo<Value>& args);
   static void ReceiveData(const FunctionCallbackInfo<Value>& args);
   static void SendData(const FunctionCallbackInfo<Value>& args);
   static void GetStream(const FunctionCallbackInfo<Value>& args);
 
+  // Parses a packed header block of count NUL-terminated name and value
+  // pairs into the session's reusable nghttp2_nv storage. Names are
+  // validated and lowercased in place. Returns the number of entries
+  // available from headers(), or a negative nghttp2 or HTTP2_ERR_* error
+  // code if the block is malformed or contains a header that HTTP/2 does
+  // not allow.
+  ssize_t ParseHeaders(Local<Value> block, Local<Value> count);
+
+  nghttp2_nv* headers() {
+    return header_nv_.data();
+  }
+
+  // Appends the entries of the registered template with the given id to
+  // the count entries most recently parsed by ParseHeaders(), skipping
+  // any names that those entries already contain. Returns the new number
+  // of entries, or a negative nghttp2 error code for an unknown id.
+  ssize_t AppendHeaderTemplate(size_t count, int32_t id);
+
+  // Memory attributed to the session: everything nghttp2 has allocated,
+  // plus outgoing DATA queued in JS.
+  size_t memory() const {
+    return allocator_.allocated() + queued_data_;
+  }
+
+  bool IsOverMemoryLimit(size_t extra = 0) const {
+    return max_session_memory_ > 0 && memory() + extra > max_session_memory_;
+  }
+
+  // Accounts for length bytes of outgoing DATA queued in JS for stream.
+  // Returns false, and does not account for them, if that would exceed the
+  // session's memory limit.
+  bool QueueData(Http2Stream* stream, size_t length);
+  void DequeueData(Http2Stream* stream, size_t length);
+
+  // Replaces the peer's priority for stream with one derived from the
+  // scheduling policy and the stream's priority hint.
+  void ApplySchedulingPolicy(Http2Stream* stream);
+
+  // Under the strict policy, returns true, and records stream to be
+  // resumed later, if a stream with a higher priority has queued data
+  // that the peer's flow control window allows it to send.
+  bool DeferForPriority(Http2Stream* stream);
+
+  // Closes the file sources of every stream, as when the session is
+  // destroyed without closing its streams.
+  void CloseFileSources();
+
+  // Asks for the streams deferred by DeferForPriority() to be resumed on
+  // the next send pass
+  void ScheduleResume() {
+    resume_deferred_ = !deferred_streams_.empty();
+  }
+
+  // Refreshes the fields arrays of the session and of every stream marked
+  // by MarkFieldsDirty() since the last call
+  void UpdateFields();
+
+  // Schedules the fields of stream to be refreshed by UpdateFields()
+  void MarkFieldsDirty(Http2Stream* stream) {
+    if (stream == nullptr || stream->fields_dirty_)
+      return;
+    stream->fields_dirty_ = true;
+    dirty_streams_.push_back(stream);
+  }
+
+  // Cancels the deadlines of every stream of the session, as when the
+  // session is destroyed without closing its streams.
+  void CancelDeadlines();
+
+  // Marks every stream of the session closed and releases the header fields
+  // they hold, which belong to the allocator of the nghttp2_session. Called
+  // before the nghttp2_session is deleted, which closes its streams without
+  // invoking on_stream_close.
+  void DetachStreams();
+
+  // Appends the cached date header to the first count header entries.
+  // Returns the new number of entries.
+  ssize_t AppendDateHeader(size_t count);
+
   size_t self_size() const override {
     return sizeof(*this);
   }
@@ -530,8 +1151,14 @@ class Http2Session : public AsyncWrap {
     return session_;
   }
 
+  Local<Function> emit_function() {
+    return StrongPersistentToLocal(emit_);
+  }
+
  private:
   friend class Http2Stream;
+  friend class Http2BufferSource;
+  friend class Http2FileSource;
   static Http2Stream* create_stream(Environment* env,
                                     Http2Session* session,
                                     uint32_t stream_id);
@@ -539,18 +1166,35 @@ class Http2Session : public AsyncWrap {
   Http2Session(Environment* env,
                Local<Object> wrap,
                enum http2_session_type type,
-               Local<Value> options);
+               Local<Value> options,
+               Local<Function> emit);
 
   ~Http2Session() override {
+    CloseFileSources();
+    CancelDeadlines();
+    DetachStreams();
+    while (streams_ != nullptr) {
+      Http2Stream* stream = streams_;
+      streams_ = stream->next_;
+      stream->session_ = nullptr;
+      stream->prev_ = stream->next_ = nullptr;
+    }
     nghttp2_session_del(session_);
+    slab_.Reset();
+    emit_.Reset();
+    pending_refs_.Reset();
+    recv_buffer_.Reset();
+    recv_chunks_.Reset();
+    for (Http2HeaderTemplate* tmpl : header_templates_)
+      delete tmpl;
+    ReleaseOutputChunks(pending_head_);
+    while (free_chunks_ != nullptr) {
+      Http2OutputChunk* next = free_chunks_->next;
+      delete free_chunks_;
+      free_chunks_ = next;
+    }
   }
 
-  static ssize_t send(nghttp2_session* session,
-                      const uint8_t* data,
-                      size_t length,
-                      int flags,
-                      void *user_data);
-
   static int on_rst_stream_frame(Http2Session* session,
                                  int32_t id,
                                  const nghttp2_frame_hd hd,
@@ -570,6 +1214,9 @@ class Http2Session : public AsyncWrap {
                               const nghttp2_frame_hd hd,
                               const nghttp2_headers headers);
 
+  template <typename Handler>
+  friend void SetSessionCallbacks(nghttp2_session_callbacks* callbacks);
+
   static int on_frame_recv(nghttp2_session *session,
                            const nghttp2_frame *frame,
                            void *user_data);
@@ -581,10 +1228,8 @@ class Http2Session : public AsyncWrap {
 
   static int on_header(nghttp2_session *session,
                        const nghttp2_frame *frame,
-                       const uint8_t *name,
-                       size_t namelen,
-                       const uint8_t *value,
-                       size_t valuelen,
+                       nghttp2_rcbuf *name,
+                       nghttp2_rcbuf *value,
                        uint8_t flags,
                        void *user_data);
 
@@ -608,7 +1253,63 @@ class Http2Session : public AsyncWrap {
                                 size_t max_payloadlen,
                                 void *user_data);
 
+  static ssize_t data_source_read_length(nghttp2_session* session,
+                                         uint8_t frame_type,
+                                         int32_t stream_id,
+                                         int32_t session_remote_window_size,
+                                         int32_t stream_remote_window_size,
+                                         uint32_t remote_max_frame_size,
+                                         void* user_data);
+
+  static int send_data(nghttp2_session* session,
+                       nghttp2_frame* frame,
+                       const uint8_t* framehd,
+                       size_t length,
+                       nghttp2_data_source* source,
+                       void* user_data);
+
+  // StreamBase callbacks used once the session has consumed a socket
+  // Socket reads are allocated from slabs of kAllocBufferSize bytes. A new
+  // slab is started once less than kMinAllocSize bytes remain in the current
+  // one; the old slab is freed once JS releases every slice of it, so a
+  // single retained DATA chunk keeps the whole 64 KB slab alive.
+  static const size_t kAllocBufferSize = 64 * 1024;
+  static const size_t kMinAllocSize = 16 * 1024;
+
+  static void OnAllocImpl(size_t suggested_size, uv_buf_t* buf, void* ctx);
+  static void OnReadImpl(ssize_t nread,
+                         const uv_buf_t* buf,
+                         uv_handle_type pending,
+                         void* ctx);
+  static void AfterWrite(WriteWrap* req_wrap, int status);
+
   void Init(enum http2_session_type type);
+  void Unconsume();
+  void EmitError(int rv);
+
+  // Passes len bytes of data held by buffer to nghttp2. DATA payloads
+  // within it are delivered to JS as slices of buffer rather than copies.
+  ssize_t Receive(Local<Object> buffer, const uint8_t* data, size_t len);
+  void AddDataChunk(Http2Stream* stream, const uint8_t* data, size_t len);
+  void AddDataEnd(Http2Stream* stream, uint8_t flags);
+  void AddDataItem(Http2Stream* stream, Local<Value> item);
+  void FlushDataChunks();
+
+  // Serializes all pending frames and writes them out in a single pass
+  int SendPendingData();
+  void AppendOutput(const uint8_t* data, size_t length);
+  void AppendExternal(Local<Object> buffer);
+  void AppendExternal(Local<Object> buffer, size_t offset, size_t length);
+  void FlushOutput();
+  void FlushOutputToSocket();
+  Http2OutputChunk* AllocateOutputChunk();
+  void ReleaseOutputChunks(Http2OutputChunk* chunk);
+
+  // Receive window auto-tuning
+  uint32_t ReceiveWindowSize();
+  void SampleBdp(size_t length);
+  void OnBdpPingSent();
+  void OnBdpPingAck();
 
   bool WantReadOrWrite() {
     return nghttp2_session_want_read(session_) != 0 ||
@@ -617,7 +1318,97 @@ class Http2Session : public AsyncWrap {
 
   Http2Stream* root_;
   enum http2_session_type type_;
+  // Declared before session_ so that it is available when session_ is
+  // created; nghttp2_session_del() still uses it from ~Http2Session().
+  Http2Allocator allocator_;
   nghttp2_session* session_;
+
+  // Set while the session reads from and writes to a StreamBase directly
+  StreamBase* stream_;
+  StreamResource::Callback<StreamResource::AllocCb> prev_alloc_cb_;
+  StreamResource::Callback<StreamResource::ReadCb> prev_read_cb_;
+
+  // Output gathered during the current send pass. pending_bufs_ lists the
+  // segments to write in order; they point either into the owned chunks or
+  // into the Buffers held by pending_refs_.
+  Http2OutputChunk* pending_head_;
+  Http2OutputChunk* pending_tail_;
+  size_t pending_length_;
+  std::vector<uv_buf_t> pending_bufs_;
+  v8::Persistent<v8::Array> pending_refs_;
+
+  // Input currently being processed by nghttp2_session_mem_recv, and the
+  // received DATA slices and frame ends not yet delivered to JS. All three
+  // handles are only set for the duration of a single pass.
+  v8::Persistent<Object> recv_buffer_;
+  v8::Persistent<v8::Array> recv_chunks_;
+
+  // Dispatch function that every session event is delivered to
+  v8::Persistent<Function> emit_;
+
+  // Slab that reads from the consumed socket are placed into
+  v8::Persistent<Object> slab_;
+  size_t slab_offset_;
+
+  Http2OutputChunk* free_chunks_;
+  size_t free_chunk_count_;
+
+  // Bytes passed to the consumed socket that have not been written yet,
+  // and whether reading from it has been paused by the session
+  size_t write_queue_length_;
+  bool reading_paused_;
+
+  // Scratch storage for outgoing header blocks. nghttp2 copies the name
+  // and value of each nghttp2_nv on submission, so these are reused.
+  std::vector<char> header_buffer_;
+  std::vector<nghttp2_nv> header_nv_;
+
+  // Header templates, indexed by the id returned to JS
+  std::vector<Http2HeaderTemplate*> header_templates_;
+
+  // The maxSessionMemory option, or zero if there is no limit
+  size_t max_session_memory_;
+  // Total of queued_data_ over the session's streams
+  size_t queued_data_;
+
+  enum http2_scheduling_policy scheduling_policy_;
+  uint32_t scheduling_quantum_;
+  // Streams with queued outgoing DATA, and the streams deferred by the
+  // strict policy until one of those can no longer send
+  std::vector<Http2Stream*> sending_streams_;
+  std::vector<Http2Stream*> deferred_streams_;
+  bool resume_deferred_;
+
+  // File sources of the open streams that respond with a file descriptor
+  std::vector<Http2FileSource*> file_sources_;
+
+  // Receive window auto-tuning. While DATA is arriving, one PING is kept in
+  // flight; the bytes received before its ACK are a sample of the
+  // bandwidth-delay product that the receive windows are grown to cover,
+  // up to the maxAutoWindowSize option (zero if auto-tuning is disabled).
+  uint32_t max_auto_window_size_;
+  uint32_t auto_window_size_;
+  bool bdp_ping_pending_;
+  uint64_t bdp_ping_sent_;
+  size_t bdp_bytes_;
+  double bdp_max_bandwidth_;
+
+  // Deadlines given to the streams opened by the peer, from the
+  // streamHeadersTimeout, streamBodyTimeout and streamIdleTimeout options,
+  // and the streams with a deadline scheduled on the Http2TimerWheel
+  uint32_t stream_headers_timeout_;
+  uint32_t stream_body_timeout_;
+  uint32_t stream_idle_timeout_;
+  std::vector<Http2Stream*> timed_streams_;
+
+  // The streams of the session that have not been released yet, linked
+  // through Http2Stream::prev_ and next_
+  Http2Stream* streams_;
+
+  // Backing store of the fields array, and the streams whose fields need
+  // to be refreshed
+  double* fields_;
+  std::vector<Http2Stream*> dirty_streams_;
 };
 
 
@@ -633,8 +1424,20 @@ class Http2DataProvider : BaseObject {
     return stream_;
   }
 
+  void set_stream(Http2Stream* stream) {
+    stream_ = stream;
+  }
+
+  // Returns the Buffers that make up the payload of the DATA frame currently
+  // being sent without copying, and releases them from the provider.
+  Local<v8::Array> TakePending() {
+    Local<v8::Array> pending =
+        v8::Local<v8::Array>::New(env()->isolate(), pending_);
+    pending_.Reset();
+    return pending;
+  }
+
  private:
-  static void FreeCallbackNonop(char* data, void* hint) {}
   static ssize_t on_read(nghttp2_session* session,
                          int32_t stream_id,
                          uint8_t* buf,
@@ -647,11 +1450,81 @@ class Http2DataProvider : BaseObject {
                     Local<Object> wrap,
                     Http2Stream* stream);
 
-  ~Http2DataProvider() {}
+  ~Http2DataProvider() {
+    pending_.Reset();
+  }
 
   Http2Stream* stream_;
   nghttp2_data_provider provider_;
   Local<Name> read_;
+  v8::Persistent<v8::Array> pending_;
+};
+
+
+// Supplies the body of a response from a range of a file descriptor. The
+// file is read on the libuv threadpool into two alternating buffers, so
+// the next read is in progress while DATA frames are being filled from the
+// previous one. Nothing passes through JS. The provider defers while no
+// data is buffered and is resumed when a read completes. nghttp2 only asks
+// for as much data as the peer's flow control windows allow.
+class Http2FileSource {
+ public:
+  Http2FileSource(Http2Stream* stream,
+                  int fd,
+                  int64_t offset,
+                  int64_t length,
+                  bool close_fd);
+
+  nghttp2_data_provider* operator*() {
+    return &provider_;
+  }
+
+  // Detaches the source from its stream. It is deleted once any read in
+  // progress completes.
+  void Close();
+
+ private:
+  ~Http2FileSource();
+
+  static ssize_t on_read(nghttp2_session* session,
+                         int32_t stream_id,
+                         uint8_t* buf,
+                         size_t length,
+                         uint32_t* flags,
+                         nghttp2_data_source* source,
+                         void* user_data);
+  static void OnRead(uv_fs_t* req);
+  static void OnClose(uv_fs_t* req);
+
+  // Starts reading into an empty buffer, unless a read is in progress or
+  // the whole range has been read.
+  void ReadAhead();
+
+  bool finished() const {
+    return remaining_ == 0 && !reading_ &&
+           length_[0] == pos_[0] && length_[1] == pos_[1];
+  }
+
+  Http2Stream* stream_;
+  Environment* env_;
+  nghttp2_data_provider provider_;
+  uv_fs_t req_;
+  int fd_;
+  bool close_fd_;
+  // Offset of the next read, and the bytes of the range not yet read
+  int64_t offset_;
+  int64_t remaining_;
+  // Each buffer holds length_ bytes, of which pos_ have been sent.
+  // current_ is the buffer DATA frames are filled from.
+  char buffers_[2][HTTP2_FILE_CHUNK_SIZE];
+  size_t length_[2];
+  size_t pos_[2];
+  int current_;
+  int target_;
+  bool reading_;
+  bool deferred_;
+  bool closed_;
+  int error_;
 };
 
 }  // namespace http2
@@ -0,0 +1,155 @@
+#include "node_http2_core.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+namespace node {
+namespace http2 {
+
+// Http2Allocator statics
+
+Http2Allocator::Http2Allocator() : arena_blocks_(nullptr),
+                                   arena_pos_(nullptr),
+                                   arena_end_(nullptr),
+                                   allocated_(0),
+                                   peak_allocated_(0),
+                                   reserved_(0) {
+  mem_.mem_user_data = this;
+  mem_.malloc = MallocCallback;
+  mem_.free = FreeCallback;
+  mem_.calloc = CallocCallback;
+  mem_.realloc = ReallocCallback;
+  for (size_t n = 0; n < HTTP2_ALLOC_CLASS_COUNT; n++)
+    free_lists_[n] = nullptr;
+}
+
+Http2Allocator::~Http2Allocator() {
+  while (arena_blocks_ != nullptr) {
+    ArenaBlock* next = arena_blocks_->next;
+    free(arena_blocks_);
+    arena_blocks_ = next;
+  }
+}
+
+inline size_t AllocClass(size_t size) {
+  return size == 0 ? 0 : (size - 1) / HTTP2_ALLOC_CLASS_SIZE;
+}
+
+inline size_t AlignAllocation(size_t size) {
+  return (size + alignof(max_align_t) - 1) & ~(alignof(max_align_t) - 1);
+}
+
+void* Http2Allocator::AllocateFromArena(size_t size) {
+  size_t index = AllocClass(size);
+  if (free_lists_[index] != nullptr) {
+    FreeBlock* block = free_lists_[index];
+    free_lists_[index] = block->next;
+    return block;
+  }
+
+  size_t length =
+      AlignAllocation(sizeof(Header) + (index + 1) * HTTP2_ALLOC_CLASS_SIZE);
+  if (arena_pos_ == nullptr ||
+      static_cast<size_t>(arena_end_ - arena_pos_) < length) {
+    // The remainder of the current block is abandoned
+    ArenaBlock* block =
+        static_cast<ArenaBlock*>(malloc(HTTP2_ALLOC_ARENA_BLOCK_SIZE));
+    if (block == nullptr)
+      return nullptr;
+    block->next = arena_blocks_;
+    arena_blocks_ = block;
+    reserved_ += HTTP2_ALLOC_ARENA_BLOCK_SIZE;
+    arena_pos_ =
+        reinterpret_cast<char*>(block) + AlignAllocation(sizeof(ArenaBlock));
+    arena_end_ = reinterpret_cast<char*>(block) + HTTP2_ALLOC_ARENA_BLOCK_SIZE;
+  }
+  void* ptr = arena_pos_;
+  arena_pos_ += length;
+  return ptr;
+}
+
+void* Http2Allocator::Allocate(size_t size) {
+  Header* header;
+  if (AllocClass(size) < HTTP2_ALLOC_CLASS_COUNT) {
+    header = static_cast<Header*>(AllocateFromArena(size));
+  } else {
+    header = static_cast<Header*>(malloc(sizeof(Header) + size));
+    if (header != nullptr)
+      reserved_ += size;
+  }
+  if (header == nullptr)
+    return nullptr;
+  header->size = size;
+  allocated_ += size;
+  if (allocated_ > peak_allocated_)
+    peak_allocated_ = allocated_;
+  return header + 1;
+}
+
+void Http2Allocator::Free(void* ptr) {
+  if (ptr == nullptr)
+    return;
+  Header* header = static_cast<Header*>(ptr) - 1;
+  size_t size = header->size;
+  allocated_ -= size;
+  size_t index = AllocClass(size);
+  if (index < HTTP2_ALLOC_CLASS_COUNT) {
+    FreeBlock* block = reinterpret_cast<FreeBlock*>(header);
+    block->next = free_lists_[index];
+    free_lists_[index] = block;
+  } else {
+    reserved_ -= size;
+    free(header);
+  }
+}
+
+void* Http2Allocator::Reallocate(void* ptr, size_t size) {
+  if (ptr == nullptr)
+    return Allocate(size);
+  Header* header = static_cast<Header*>(ptr) - 1;
+  size_t old_size = header->size;
+  size_t index = AllocClass(old_size);
+  // Arena allocations can grow or shrink within their size class
+  if (index < HTTP2_ALLOC_CLASS_COUNT && AllocClass(size) == index) {
+    allocated_ += size;
+    allocated_ -= old_size;
+    if (allocated_ > peak_allocated_)
+      peak_allocated_ = allocated_;
+    header->size = size;
+    return ptr;
+  }
+  void* result = Allocate(size);
+  if (result == nullptr)
+    return nullptr;
+  memcpy(result, ptr, old_size < size ? old_size : size);
+  Free(ptr);
+  return result;
+}
+
+void* Http2Allocator::MallocCallback(size_t size, void* user_data) {
+  return static_cast<Http2Allocator*>(user_data)->Allocate(size);
+}
+
+void Http2Allocator::FreeCallback(void* ptr, void* user_data) {
+  static_cast<Http2Allocator*>(user_data)->Free(ptr);
+}
+
+void* Http2Allocator::CallocCallback(size_t nmemb,
+                                     size_t size,
+                                     void* user_data) {
+  if (size != 0 && nmemb > static_cast<size_t>(-1) / size)
+    return nullptr;
+  void* ptr = static_cast<Http2Allocator*>(user_data)->Allocate(nmemb * size);
+  if (ptr != nullptr)
+    memset(ptr, 0, nmemb * size);
+  return ptr;
+}
+
+void* Http2Allocator::ReallocCallback(void* ptr,
+                                      size_t size,
+                                      void* user_data) {
+  return static_cast<Http2Allocator*>(user_data)->Reallocate(ptr, size);
+}
+
+}  // namespace http2
+}  // namespace node
@@ -0,0 +1,122 @@
+#ifndef SRC_NODE_HTTP2_CORE_H_
+#define SRC_NODE_HTTP2_CORE_H_
+
+#if defined(NODE_WANT_INTERNALS) && NODE_WANT_INTERNALS
+
+#include "nghttp2/nghttp2.h"
+
+#include <stddef.h>
+
+// The parts of the nghttp2 setup of Http2Session that do not depend on V8 or
+// on the Environment. They are kept apart so that the cctest microbenchmarks
+// drive nghttp2 exactly as Http2Session does.
+
+namespace node {
+namespace http2 {
+
+// DATA payloads smaller than this are copied into the frame buffer rather
+// than being referenced, as the extra write segment would cost more than
+// the copy.
+#define HTTP2_MIN_NO_COPY_LENGTH 1024
+// Allocations made by nghttp2 of up to HTTP2_ALLOC_CLASS_COUNT size classes
+// of HTTP2_ALLOC_CLASS_SIZE bytes each are served from a per-session arena.
+#define HTTP2_ALLOC_CLASS_SIZE 32
+#define HTTP2_ALLOC_CLASS_COUNT 16
+#define HTTP2_ALLOC_ARENA_BLOCK_SIZE (16 * 1024)
+
+// The nghttp2_mem allocator used by each Http2Session. nghttp2 makes a large
+// number of small allocations for streams, outbound items and HPACK table
+// entries. Those are carved from arena blocks owned by the session and
+// recycled through per size class free lists; the blocks are only returned
+// once the session is destroyed. Larger allocations use malloc. Every
+// allocation records its size so that the memory used by the session can be
+// accounted for.
+class Http2Allocator {
+ public:
+  Http2Allocator();
+  ~Http2Allocator();
+
+  nghttp2_mem* mem() {
+    return &mem_;
+  }
+
+  // Bytes currently allocated by nghttp2
+  size_t allocated() const {
+    return allocated_;
+  }
+
+  // Highest value allocated() has reached
+  size_t peak_allocated() const {
+    return peak_allocated_;
+  }
+
+  // Bytes obtained from the system, including arena blocks and free lists
+  size_t reserved() const {
+    return reserved_;
+  }
+
+ private:
+  // Precedes every allocation, and keeps the memory that follows it aligned
+  // as malloc() would
+  union Header {
+    size_t size;
+    max_align_t align;
+  };
+
+  // Reuses the memory of a free arena allocation
+  struct FreeBlock {
+    FreeBlock* next;
+  };
+
+  struct ArenaBlock {
+    ArenaBlock* next;
+  };
+
+  void* Allocate(size_t size);
+  void Free(void* ptr);
+  void* Reallocate(void* ptr, size_t size);
+  void* AllocateFromArena(size_t size);
+
+  static void* MallocCallback(size_t size, void* user_data);
+  static void FreeCallback(void* ptr, void* user_data);
+  static void* CallocCallback(size_t nmemb, size_t size, void* user_data);
+  static void* ReallocCallback(void* ptr, size_t size, void* user_data);
+
+  nghttp2_mem mem_;
+  FreeBlock* free_lists_[HTTP2_ALLOC_CLASS_COUNT];
+  ArenaBlock* arena_blocks_;
+  char* arena_pos_;
+  char* arena_end_;
+  size_t allocated_;
+  size_t peak_allocated_;
+  size_t reserved_;
+};
+
+// Registers the callbacks every Http2Session uses. Handler implements them
+// as static members with the same names and signatures as Http2Session.
+template <typename Handler>
+inline void SetSessionCallbacks(nghttp2_session_callbacks* callbacks) {
+  nghttp2_session_callbacks_set_on_frame_recv_callback(
+      callbacks, Handler::on_frame_recv);
+  nghttp2_session_callbacks_set_on_stream_close_callback(
+      callbacks, Handler::on_stream_close);
+  nghttp2_session_callbacks_set_on_header_callback2(
+      callbacks, Handler::on_header);
+  nghttp2_session_callbacks_set_on_begin_headers_callback(
+      callbacks, Handler::on_begin_headers);
+  nghttp2_session_callbacks_set_on_data_chunk_recv_callback(
+      callbacks, Handler::on_data_chunk_recv);
+  nghttp2_session_callbacks_set_on_frame_send_callback(
+      callbacks, Handler::on_frame_send);
+  nghttp2_session_callbacks_set_select_padding_callback(
+      callbacks, Handler::select_padding);
+  nghttp2_session_callbacks_set_send_data_callback(
+      callbacks, Handler::send_data);
+}
+
+}  // namespace http2
+}  // namespace node
+
+#endif  // defined(NODE_WANT_INTERNALS) && NODE_WANT_INTERNALS
+
+#endif  // SRC_NODE_HTTP2_CORE_H_
@@ -192,6 +192,11 @@ v8::MaybeLocal<v8::Object> New(Environment* env,
 // because ArrayBufferAllocator::Free() deallocates it again with free().
 // Mixing operator new and free() is undefined behavior so don't do that.
 v8::MaybeLocal<v8::Object> New(Environment* env, char* data, size_t length);
+// A Buffer that views length bytes of |ab|, starting at byte_offset.
+v8::MaybeLocal<v8::Object> New(Environment* env,
+                               v8::Local<v8::ArrayBuffer> ab,
+                               size_t byte_offset,
+                               size_t length);
 }  // namespace Buffer
 
 }  // namespace node
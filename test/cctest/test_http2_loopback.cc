@@ -0,0 +1,466 @@
+// Microbenchmarks for the nghttp2 layer beneath Http2Session.
+//
+// A client and a server nghttp2_session, set up with the callbacks and the
+// allocator that the Http2Session constructor uses, are connected through an
+// in-memory pipe. Frame processing, HPACK and allocation costs can then be
+// measured without sockets or JavaScript, which separates regressions in
+// src/node_http2.cc and deps/nghttp2 from noise in the JS layer.
+//
+// The timed benchmarks are disabled so that they neither slow down nor
+// clutter the output of regular runs; Http2Loopback only checks that the
+// loopback works. Results are printed as they are measured. The number of
+// iterations defaults to a value that keeps the benchmarks quick, and can be
+// raised with the NODE_HTTP2_BENCH_ITERATIONS environment variable, for
+// instance:
+//
+//   $ export NODE_HTTP2_BENCH_ITERATIONS=100000
+//   $ export GTEST_ALSO_RUN_DISABLED_TESTS=1
+//   $ out/Release/cctest --gtest_filter='Http2Loopback*'
+
+#include "node_http2_core.h"
+#include "nghttp2/nghttp2.h"
+#include "gtest/gtest.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>  // NOLINT(build/c++11)
+#include <vector>
+
+namespace {
+
+using node::http2::Http2Allocator;
+
+const uint8_t kPayload[16384] = { 0 };
+
+size_t Iterations() {
+  const char* value = getenv("NODE_HTTP2_BENCH_ITERATIONS");
+  if (value != nullptr && atoi(value) > 0)
+    return atoi(value);
+  return 1000;
+}
+
+double SecondsSince(std::chrono::steady_clock::time_point start) {
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+
+void Report(const char* name, double value, const char* unit) {
+  printf("[ BENCH    ] %s: %.2f %s\n", name, value, unit);
+}
+
+#define NV(NAME, VALUE)                                                       \
+  {                                                                           \
+    const_cast<uint8_t*>(reinterpret_cast<const uint8_t*>(NAME)),             \
+    const_cast<uint8_t*>(reinterpret_cast<const uint8_t*>(VALUE)),            \
+    sizeof(NAME) - 1, sizeof(VALUE) - 1,                                      \
+    NGHTTP2_NV_FLAG_NONE                                                      \
+  }
+
+// A typical browser request, and a small response
+nghttp2_nv request_headers[] = {
+  NV(":method", "GET"),
+  NV(":path", "/index.html"),
+  NV(":scheme", "https"),
+  NV(":authority", "www.example.com"),
+  NV("user-agent", "Mozilla/5.0 (X11; Linux x86_64; rv:52.0) Gecko/20100101"),
+  NV("accept", "text/html,application/xhtml+xml,application/xml;q=0.9"),
+  NV("accept-language", "en-US,en;q=0.5"),
+  NV("accept-encoding", "gzip, deflate, br"),
+  NV("cookie", "session=0123456789abcdef; theme=dark"),
+  NV("cache-control", "no-cache")
+};
+
+nghttp2_nv response_headers[] = {
+  NV(":status", "200"),
+  NV("content-type", "text/html; charset=utf-8"),
+  NV("cache-control", "max-age=3600"),
+  NV("date", "Mon, 01 Jan 2018 00:00:00 GMT")
+};
+
+#undef NV
+
+// One end of the loopback connection. The server answers every request with
+// response_headers and a body of body_length bytes.
+class Endpoint {
+ public:
+  Endpoint(bool server, size_t body_length)
+      : server_(server),
+        body_length_(body_length),
+        frames_sent_(0),
+        frames_received_(0),
+        headers_received_(0),
+        data_received_(0),
+        streams_closed_(0) {
+    nghttp2_session_callbacks* cb;
+    nghttp2_session_callbacks_new(&cb);
+    node::http2::SetSessionCallbacks<Endpoint>(cb);
+    // Http2Session creates its nghttp2_option from the options given to it
+    // through Http2Options, which needs an Environment; none are set by
+    // default.
+    nghttp2_option* options;
+    nghttp2_option_new(&options);
+    if (server) {
+      nghttp2_session_server_new3(&session_, cb, this, options,
+                                  allocator_.mem());
+    } else {
+      nghttp2_session_client_new3(&session_, cb, this, options,
+                                  allocator_.mem());
+    }
+    nghttp2_option_del(options);
+    nghttp2_session_callbacks_del(cb);
+    nghttp2_submit_settings(session_, NGHTTP2_FLAG_NONE, nullptr, 0);
+  }
+
+  ~Endpoint() {
+    nghttp2_session_del(session_);
+  }
+
+  nghttp2_session* operator*() {
+    return session_;
+  }
+
+  // Serializes every pending frame into the outbox
+  void Send() {
+    const uint8_t* data;
+    ssize_t len;
+    while ((len = nghttp2_session_mem_send(session_, &data)) > 0)
+      outbox_.insert(outbox_.end(), data, data + len);
+    GTEST_ASSERT_GE(len, 0);
+  }
+
+  // Passes the outbox of peer to nghttp2. Returns false if there was
+  // nothing to pass.
+  bool ReceiveFrom(Endpoint* peer) {
+    if (peer->outbox_.empty())
+      return false;
+    std::vector<uint8_t> input;
+    input.swap(peer->outbox_);
+    EXPECT_EQ(static_cast<ssize_t>(input.size()),
+              nghttp2_session_mem_recv(session_, input.data(), input.size()));
+    return true;
+  }
+
+  int32_t Request() {
+    return nghttp2_submit_request(session_, nullptr, request_headers,
+                                  arraysize(request_headers), nullptr,
+                                  nullptr);
+  }
+
+  Http2Allocator* allocator() {
+    return &allocator_;
+  }
+
+  size_t frames_sent() const {
+    return frames_sent_;
+  }
+
+  size_t frames_received() const {
+    return frames_received_;
+  }
+
+  size_t headers_received() const {
+    return headers_received_;
+  }
+
+  size_t data_received() const {
+    return data_received_;
+  }
+
+  size_t streams_closed() const {
+    return streams_closed_;
+  }
+
+ private:
+  template <typename Handler>
+  friend void node::http2::SetSessionCallbacks(
+      nghttp2_session_callbacks* callbacks);
+
+  template <typename T, size_t N>
+  static size_t arraysize(const T (&)[N]) {
+    return N;
+  }
+
+  // Named as the Http2Session callbacks, for SetSessionCallbacks()
+  static int on_frame_recv(nghttp2_session* session,
+                           const nghttp2_frame* frame,
+                           void* user_data) {
+    Endpoint* endpoint = static_cast<Endpoint*>(user_data);
+    endpoint->frames_received_++;
+    if (endpoint->server_ && frame->hd.type == NGHTTP2_HEADERS &&
+        (frame->hd.flags & NGHTTP2_FLAG_END_STREAM)) {
+      nghttp2_data_provider provider;
+      provider.source.ptr = nullptr;
+      provider.read_callback = on_read;
+      size_t* remaining = new size_t(endpoint->body_length_);
+      nghttp2_session_set_stream_user_data(session, frame->hd.stream_id,
+                                           remaining);
+      return nghttp2_submit_response(session, frame->hd.stream_id,
+                                     response_headers,
+                                     arraysize(response_headers),
+                                     endpoint->body_length_ > 0 ?
+                                         &provider : nullptr);
+    }
+    return 0;
+  }
+
+  static int on_stream_close(nghttp2_session* session,
+                             int32_t stream_id,
+                             uint32_t error_code,
+                             void* user_data) {
+    Endpoint* endpoint = static_cast<Endpoint*>(user_data);
+    endpoint->streams_closed_++;
+    delete static_cast<size_t*>(
+        nghttp2_session_get_stream_user_data(session, stream_id));
+    return 0;
+  }
+
+  static int on_header(nghttp2_session* session,
+                       const nghttp2_frame* frame,
+                       nghttp2_rcbuf* name,
+                       nghttp2_rcbuf* value,
+                       uint8_t flags,
+                       void* user_data) {
+    static_cast<Endpoint*>(user_data)->headers_received_++;
+    return 0;
+  }
+
+  static int on_begin_headers(nghttp2_session* session,
+                              const nghttp2_frame* frame,
+                              void* user_data) {
+    return 0;
+  }
+
+  static int on_data_chunk_recv(nghttp2_session* session,
+                                uint8_t flags,
+                                int32_t stream_id,
+                                const uint8_t* data,
+                                size_t len,
+                                void* user_data) {
+    static_cast<Endpoint*>(user_data)->data_received_ += len;
+    return 0;
+  }
+
+  static int on_frame_send(nghttp2_session* session,
+                           const nghttp2_frame* frame,
+                           void* user_data) {
+    static_cast<Endpoint*>(user_data)->frames_sent_++;
+    return 0;
+  }
+
+  static ssize_t select_padding(nghttp2_session* session,
+                                const nghttp2_frame* frame,
+                                size_t max_payloadlen,
+                                void* user_data) {
+    return frame->hd.length;
+  }
+
+  // Like Http2DataProvider::on_read, large payloads are referenced and
+  // written by SendData, small ones are copied into the frame buffer.
+  static ssize_t on_read(nghttp2_session* session,
+                         int32_t stream_id,
+                         uint8_t* buf,
+                         size_t length,
+                         uint32_t* flags,
+                         nghttp2_data_source* source,
+                         void* user_data) {
+    size_t* remaining = static_cast<size_t*>(
+        nghttp2_session_get_stream_user_data(session, stream_id));
+    size_t amount = *remaining < length ? *remaining : length;
+    if (amount > sizeof(kPayload))
+      amount = sizeof(kPayload);
+    *remaining -= amount;
+    if (*remaining == 0)
+      *flags |= NGHTTP2_DATA_FLAG_EOF;
+    if (amount >= HTTP2_MIN_NO_COPY_LENGTH)
+      *flags |= NGHTTP2_DATA_FLAG_NO_COPY;
+    else
+      memcpy(buf, kPayload, amount);
+    return amount;
+  }
+
+  static int send_data(nghttp2_session* session,
+                       nghttp2_frame* frame,
+                       const uint8_t* framehd,
+                       size_t length,
+                       nghttp2_data_source* source,
+                       void* user_data) {
+    std::vector<uint8_t>& outbox = static_cast<Endpoint*>(user_data)->outbox_;
+    outbox.insert(outbox.end(), framehd, framehd + 9);
+    outbox.insert(outbox.end(), kPayload, kPayload + length);
+    return 0;
+  }
+
+  bool server_;
+  size_t body_length_;
+  Http2Allocator allocator_;
+  nghttp2_session* session_;
+  std::vector<uint8_t> outbox_;
+  size_t frames_sent_;
+  size_t frames_received_;
+  size_t headers_received_;
+  size_t data_received_;
+  size_t streams_closed_;
+};
+
+// Exchanges frames between client and server until neither has anything
+// more to send
+void Pump(Endpoint* client, Endpoint* server) {
+  for (;;) {
+    client->Send();
+    bool progress = server->ReceiveFrom(client);
+    server->Send();
+    progress = client->ReceiveFrom(server) || progress;
+    if (!progress)
+      return;
+  }
+}
+
+// Runs count requests, concurrent at a time, and returns the time taken
+double RunRequests(Endpoint* client, Endpoint* server,
+                   size_t count, size_t concurrent) {
+  auto start = std::chrono::steady_clock::now();
+  for (size_t done = 0; done < count; done += concurrent) {
+    for (size_t n = 0; n < concurrent && done + n < count; n++)
+      EXPECT_GT(client->Request(), 0);
+    Pump(client, server);
+  }
+  return SecondsSince(start);
+}
+
+void BenchmarkRequests(const char* name,
+                       size_t body_length,
+                       size_t concurrent) {
+  Endpoint client(false, 0);
+  Endpoint server(true, body_length);
+  Pump(&client, &server);
+
+  size_t count = Iterations();
+  double elapsed = RunRequests(&client, &server, count, concurrent);
+  size_t frames = client.frames_sent() + server.frames_sent();
+
+  EXPECT_EQ(count, client.streams_closed());
+  EXPECT_EQ(count * body_length, client.data_received());
+
+  char label[128];
+  snprintf(label, sizeof(label), "%s requests", name);
+  Report(label, count / elapsed, "req/s");
+  snprintf(label, sizeof(label), "%s frames", name);
+  Report(label, frames / elapsed, "frames/s");
+}
+
+}  // anonymous namespace
+
+TEST(Http2Loopback, Requests) {
+  Endpoint client(false, 0);
+  Endpoint server(true, 64 * 1024);
+  Pump(&client, &server);
+  RunRequests(&client, &server, 20, 10);
+
+  EXPECT_EQ(20u, client.streams_closed());
+  EXPECT_EQ(20u, server.streams_closed());
+  EXPECT_EQ(20u * 64 * 1024, client.data_received());
+  // Every stream has been freed; only the HPACK tables and the buffers of
+  // the sessions remain.
+  EXPECT_LT(client.allocator()->allocated(),
+            client.allocator()->peak_allocated());
+}
+
+TEST(Http2LoopbackBenchmark, DISABLED_RequestsWithoutBody) {
+  BenchmarkRequests("no body, 1 stream", 0, 1);
+  BenchmarkRequests("no body, 100 streams", 0, 100);
+}
+
+TEST(Http2LoopbackBenchmark, DISABLED_RequestsWithBody) {
+  BenchmarkRequests("4 byte body, 100 streams", 4, 100);
+  BenchmarkRequests("64 KiB body, 10 streams", 64 * 1024, 10);
+}
+
+TEST(Http2LoopbackBenchmark, DISABLED_HpackEncodeDecode) {
+  Http2Allocator allocator;
+  nghttp2_hd_deflater* deflater;
+  nghttp2_hd_inflater* inflater;
+  GTEST_ASSERT_EQ(0,
+                  nghttp2_hd_deflate_new2(&deflater, 4096, allocator.mem()));
+  GTEST_ASSERT_EQ(0, nghttp2_hd_inflate_new2(&inflater, allocator.mem()));
+
+  const size_t count = sizeof(request_headers) / sizeof(request_headers[0]);
+  size_t bound = nghttp2_hd_deflate_bound(deflater, request_headers, count);
+  std::vector<uint8_t> block(bound);
+  size_t iterations = Iterations() * 10;
+  size_t encoded = 0;
+  size_t decoded = 0;
+  double encode_time = 0;
+  double decode_time = 0;
+
+  for (size_t i = 0; i < iterations; i++) {
+    auto start = std::chrono::steady_clock::now();
+    ssize_t length = nghttp2_hd_deflate_hd(deflater, block.data(),
+                                           block.size(), request_headers,
+                                           count);
+    encode_time += SecondsSince(start);
+    GTEST_ASSERT_GT(length, 0);
+    encoded += length;
+
+    start = std::chrono::steady_clock::now();
+    uint8_t* in = block.data();
+    size_t remaining = length;
+    for (;;) {
+      nghttp2_nv nv;
+      int flags = 0;
+      ssize_t read = nghttp2_hd_inflate_hd2(inflater, &nv, &flags, in,
+                                            remaining, 1);
+      GTEST_ASSERT_GE(read, 0);
+      in += read;
+      remaining -= read;
+      if (flags & NGHTTP2_HD_INFLATE_EMIT)
+        decoded++;
+      if (flags & NGHTTP2_HD_INFLATE_FINAL) {
+        nghttp2_hd_inflate_end_headers(inflater);
+        break;
+      }
+      if (read == 0 && remaining == 0)
+        break;
+    }
+    decode_time += SecondsSince(start);
+  }
+
+  EXPECT_EQ(iterations * count, decoded);
+  Report("hpack encode", iterations * count / encode_time, "headers/s");
+  Report("hpack encode", encoded / encode_time / (1024 * 1024), "MiB/s out");
+  Report("hpack decode", iterations * count / decode_time, "headers/s");
+  Report("hpack decode", encoded / decode_time / (1024 * 1024), "MiB/s in");
+
+  nghttp2_hd_deflate_del(deflater);
+  nghttp2_hd_inflate_del(inflater);
+  EXPECT_EQ(0u, allocator.allocated());
+}
+
+TEST(Http2LoopbackBenchmark, DISABLED_MemoryPerStream) {
+  Endpoint client(false, 0);
+  Endpoint server(true, 4);
+  Pump(&client, &server);
+  // The first requests grow the HPACK tables and buffers to their working
+  // size, and fill the arenas; only the memory obtained after that counts.
+  RunRequests(&client, &server, 100, 10);
+
+  size_t client_before = client.allocator()->reserved();
+  size_t server_before = server.allocator()->reserved();
+  size_t count = Iterations();
+  RunRequests(&client, &server, count, 10);
+  size_t client_reserved = client.allocator()->reserved() - client_before;
+  size_t server_reserved = server.allocator()->reserved() - server_before;
+
+  EXPECT_EQ(count + 100, server.streams_closed());
+  Report("client bytes reserved", static_cast<double>(client_reserved) / count,
+         "per stream");
+  Report("server bytes reserved", static_cast<double>(server_reserved) / count,
+         "per stream");
+  Report("client peak allocated", client.allocator()->peak_allocated(),
+         "bytes");
+  Report("server peak allocated", server.allocator()->peak_allocated(),
+         "bytes");
+}
@@ -0,0 +1,47 @@
+'use strict';
+
+// Tests that the maxAutoWindowSize option grows the receive window of a
+// session that downloads a large body, never beyond the limit, and that the
+// window is left alone without the option.
+
+const common = require('../common');
+const assert = require('assert');
+const http2 = require('http').HTTP2;
+
+const defaultWindowSize = 65535;
+const maxAutoWindowSize = 1024 * 1024;
+const body = Buffer.alloc(8 * 1024 * 1024, 'x');
+
+const server = http2.createServer(common.mustCall((req, res) => {
+  res.end(body);
+}, 2));
+
+server.listen(0, common.mustCall(() => {
+  const port = server.address().port;
+  var remaining = 2;
+
+  function download(options, check) {
+    const agent = new http2.Http2Agent(options);
+    var client;
+    agent.on('session', common.mustCall((session) => client = session));
+    http2.get({ port, path: '/', agent }, common.mustCall((res) => {
+      var received = 0;
+      res.on('data', (chunk) => received += chunk.length);
+      res.on('end', common.mustCall(() => {
+        assert.strictEqual(received, body.length);
+        check(client.session.localWindowSize);
+        agent.destroy();
+        if (--remaining === 0)
+          server.close();
+      }));
+    }));
+  }
+
+  download({ maxAutoWindowSize }, (windowSize) => {
+    assert(windowSize > defaultWindowSize, `${windowSize}`);
+    assert(windowSize <= maxAutoWindowSize, `${windowSize}`);
+  });
+  download({}, (windowSize) => {
+    assert.strictEqual(windowSize, defaultWindowSize);
+  });
+}));
@@ -0,0 +1,67 @@
+'use strict';
+
+// Tests that an Http2Agent multiplexes requests to one origin over a single
+// session, and that the client sends request bodies.
+
+const common = require('../common');
+const assert = require('assert');
+const http2 = require('http').HTTP2;
+
+const count = 5;
+
+const server = http2.createServer(common.mustCall((req, res) => {
+  var body = '';
+  req.setEncoding('utf8');
+  req.on('data', (chunk) => body += chunk);
+  req.on('end', common.mustCall(() => {
+    res.setHeader('x-method', req.method);
+    res.end(`${req.url} ${body}`);
+  }));
+}, count + 1));
+
+server.listen(0, common.mustCall(() => {
+  const port = server.address().port;
+  const agent = new http2.Http2Agent();
+  agent.on('session', common.mustCall(() => {}));
+  var remaining = count + 1;
+
+  function done() {
+    if (--remaining > 0)
+      return;
+    assert.strictEqual(agent.sessions.size, 1);
+    agent.destroy();
+    server.close();
+  }
+
+  for (var n = 0; n < count; n++) {
+    const path = `/get/${n}`;
+    http2.get({ port, path, agent }, common.mustCall((res) => {
+      assert.strictEqual(res.status, 200);
+      assert.strictEqual(res.headers.get('x-method'), 'GET');
+      var body = '';
+      res.setEncoding('utf8');
+      res.on('data', (chunk) => body += chunk);
+      res.on('end', common.mustCall(() => {
+        assert.strictEqual(body, `${path} `);
+        done();
+      }));
+    }));
+  }
+
+  const req = http2.request({ port, path: '/post', method: 'POST', agent },
+                            common.mustCall((res) => {
+                              var body = '';
+                              res.setEncoding('utf8');
+                              res.on('data', (chunk) => body += chunk);
+                              res.on('end', common.mustCall(() => {
+                                assert.strictEqual(body, '/post hello');
+                                done();
+                              }));
+                            }));
+  req.end('hello');
+
+  // Invalid headers are rejected before anything is submitted
+  assert.throws(() => agent.request({ port, path: '/' },
+                                    { connection: 'close' }),
+                /Connection-specific HTTP headers are not permitted/);
+}));
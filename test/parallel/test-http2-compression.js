@@ -0,0 +1,118 @@
+'use strict';
+
+// Tests the transparent compression of response bodies: the negotiation of
+// the content coding, the reuse of pooled zlib contexts, and the compressed
+// variants of cached responses.
+
+const common = require('../common');
+const assert = require('assert');
+const zlib = require('zlib');
+const http2 = require('http').HTTP2;
+
+const text = 'Lorem ipsum dolor sit amet. '.repeat(200);
+
+const server = http2.createServer({
+  compression: { threshold: 100 },
+  responseCache: true
+}, common.mustCall((req, res) => {
+  res.setHeader('content-type', 'text/plain');
+  if (req.url === '/cached')
+    return res.end(text);
+  res.setHeader('cache-control', 'no-store');
+  if (req.url === '/small')
+    return res.end('small');
+  // Written in several chunks
+  res.write(text.slice(0, 1000));
+  setImmediate(() => res.end(text.slice(1000)));
+}, 10));
+
+function get(agent, path, accept, callback) {
+  const headers = accept !== undefined ? { 'accept-encoding': accept } : {};
+  http2.get({ port: server.address().port, path, agent, headers },
+            common.mustCall((res) => {
+              const chunks = [];
+              res.on('data', (chunk) => chunks.push(chunk));
+              res.on('end', common.mustCall(() => {
+                const body = Buffer.concat(chunks);
+                const encoding = res.headers.get('content-encoding');
+                var decoded = body;
+                if (encoding === 'gzip')
+                  decoded = zlib.gunzipSync(body);
+                else if (encoding === 'deflate')
+                  decoded = zlib.inflateSync(body);
+                callback(res.headers, decoded.toString(), encoding);
+              }));
+            }));
+}
+
+server.listen(0, common.mustCall(() => {
+  const agent = new http2.Http2Agent();
+  const steps = [
+    (next) => get(agent, '/', 'gzip, deflate', (headers, body, encoding) => {
+      assert.strictEqual(encoding, 'gzip');
+      assert.strictEqual(headers.get('vary'), 'accept-encoding');
+      assert.strictEqual(body, text);
+      next();
+    }),
+    (next) => get(agent, '/', 'gzip;q=0.5, deflate', (headers, body, enc) => {
+      assert.strictEqual(enc, 'deflate');
+      assert.strictEqual(body, text);
+      next();
+    }),
+    (next) => get(agent, '/', undefined, (headers, body, encoding) => {
+      assert.strictEqual(encoding, undefined);
+      assert.strictEqual(body, text);
+      next();
+    }),
+    (next) => get(agent, '/', 'br', (headers, body, encoding) => {
+      assert.strictEqual(encoding, undefined);
+      next();
+    }),
+    (next) => get(agent, '/small', 'gzip', (headers, body, encoding) => {
+      assert.strictEqual(encoding, undefined);
+      assert.strictEqual(body, 'small');
+      next();
+    }),
+    // The pooled zlib contexts are reset between responses
+    (next) => {
+      var remaining = 4;
+      for (var n = 0; n < 4; n++) {
+        get(agent, '/', 'gzip', (headers, body, encoding) => {
+          assert.strictEqual(encoding, 'gzip');
+          assert.strictEqual(body, text);
+          if (--remaining === 0)
+            next();
+        });
+      }
+    },
+    // The first response is stored in the cache. The identity variant is
+    // then served, with vary, until the gzip variant has been compressed.
+    (next) => get(agent, '/cached', undefined, (headers, body, encoding) => {
+      assert.strictEqual(encoding, undefined);
+      assert.strictEqual(body, text);
+      next();
+    }),
+    (next) => get(agent, '/cached', 'gzip', (headers, body, encoding) => {
+      assert.strictEqual(encoding, undefined);
+      assert.strictEqual(headers.get('vary'), 'accept-encoding');
+      assert.strictEqual(body, text);
+      setTimeout(next, common.platformTimeout(100));
+    }),
+    (next) => get(agent, '/cached', 'gzip', (headers, body, encoding) => {
+      assert.strictEqual(encoding, 'gzip');
+      assert.strictEqual(headers.get('vary'), 'accept-encoding');
+      assert.strictEqual(body, text);
+      next();
+    })
+  ];
+
+  (function run() {
+    const step = steps.shift();
+    if (step === undefined) {
+      agent.destroy();
+      server.close();
+      return;
+    }
+    step(run);
+  })();
+}));
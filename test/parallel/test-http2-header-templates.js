@@ -0,0 +1,35 @@
+'use strict';
+
+// Tests that header templates are sent with the responses that use them,
+// and that a session holds at most HTTP2_MAX_HEADER_TEMPLATES of them.
+
+const common = require('../common');
+const assert = require('assert');
+const http2 = require('http').HTTP2;
+
+const max = http2.constants.HTTP2_MAX_HEADER_TEMPLATES;
+
+const server = http2.createServer(common.mustCall((req, res) => {
+  const session = req.stream.session;
+  const id = session.createHeaderTemplate({ 'x-template': '0' });
+  for (var n = 1; n < max; n++)
+    session.createHeaderTemplate({ 'x-template': `${n}` });
+  assert.throws(() => session.createHeaderTemplate({ 'x-template': 'more' }),
+                /Too many header templates/);
+  res.setHeaderTemplate(id);
+  res.end('ok');
+}));
+
+server.listen(0, common.mustCall(() => {
+  const agent = new http2.Http2Agent();
+  const port = server.address().port;
+  http2.get({ port, path: '/', agent }, common.mustCall((res) => {
+    assert.strictEqual(res.status, 200);
+    assert.strictEqual(res.headers.get('x-template'), '0');
+    res.resume();
+    res.on('end', common.mustCall(() => {
+      agent.destroy();
+      server.close();
+    }));
+  }));
+}));
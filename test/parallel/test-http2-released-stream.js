@@ -0,0 +1,52 @@
+'use strict';
+
+// Tests that a response kept after its stream has closed and been released
+// can still be written to and ended without effect, and without disturbing
+// a later stream on the same session.
+
+const common = require('../common');
+const assert = require('assert');
+const http2 = require('http').HTTP2;
+
+var stale;
+
+const server = http2.createServer({
+  streamIdleTimeout: common.platformTimeout(50)
+}, common.mustCall((req, res) => {
+  if (req.url === '/stale') {
+    // Never answered, so the stream is reset once it has been idle
+    stale = res;
+    res.on('timeout', common.mustCall(() => {}));
+    return;
+  }
+  assert.strictEqual(stale.stream.state,
+                     http2.constants.NGHTTP2_STREAM_STATE_CLOSED);
+  assert.notStrictEqual(stale.stream, res.stream);
+  stale.on('error', common.mustCall(() => {}, 0));
+  stale.setHeader('x-stale', 'yes');
+  stale.write('stale');
+  stale.end('stale');
+  res.end('fresh');
+}, 2));
+
+server.listen(0, common.mustCall(() => {
+  const agent = new http2.Http2Agent();
+  const port = server.address().port;
+  http2.get({ port, path: '/stale', agent }, common.mustCall(() => {}, 0))
+    .on('error', common.mustCall((err) => {
+      assert.strictEqual(err.code, http2.constants.NGHTTP2_CANCEL);
+      http2.get({ port, path: '/fresh', agent }, common.mustCall((res) => {
+        assert.strictEqual(res.status, 200);
+        assert.strictEqual(res.headers.has('x-stale'), false);
+        var body = '';
+        res.setEncoding('utf8');
+        res.on('data', (chunk) => body += chunk);
+        res.on('end', common.mustCall(() => {
+          assert.strictEqual(body, 'fresh');
+          assert.strictEqual(agent.sessions.size, 1);
+          agent.destroy();
+          server.close();
+        }));
+      }));
+    }));
+}));
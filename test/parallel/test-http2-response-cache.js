@@ -0,0 +1,77 @@
+'use strict';
+
+// Tests that responses to GET requests are answered from the response
+// cache, that responses which must not be cached are not, and that the
+// :scheme of the request is part of the key.
+
+const common = require('../common');
+const assert = require('assert');
+const http2 = require('http').HTTP2;
+
+const counts = {};
+
+const server = http2.createServer({ responseCache: true }, (req, res) => {
+  counts[req.url] = (counts[req.url] || 0) + 1;
+  switch (req.url) {
+    case '/buffer':
+      // The cached body must not change when the written Buffer does
+      const chunk = Buffer.from('original');
+      res.write(chunk);
+      chunk.fill('x');
+      res.end();
+      break;
+    case '/trailers':
+      res.setTrailer('x-trailer', 'yes');
+      res.end('trailers');
+      break;
+    case '/no-store':
+      res.setHeader('cache-control', 'no-store');
+      res.end('no-store');
+      break;
+    default:
+      res.end('ok');
+  }
+});
+
+function get(agent, path, callback, headers) {
+  http2.get({ port: server.address().port, path, agent, headers },
+            common.mustCall((res) => {
+              var body = '';
+              res.setEncoding('utf8');
+              res.on('data', (chunk) => body += chunk);
+              res.on('end', common.mustCall(() => callback(body)));
+            }));
+}
+
+server.listen(0, common.mustCall(() => {
+  const agent = new http2.Http2Agent();
+  const paths = ['/', '/buffer', '/trailers', '/no-store'];
+  const steps = [];
+  for (const round of [0, 1]) {
+    for (const path of paths) {
+      steps.push((next) => get(agent, path, (body) => {
+        if (path === '/buffer' && round > 0)
+          assert.strictEqual(body, 'original');
+        next();
+      }));
+    }
+  }
+  // An entry stored for one scheme does not answer requests for another
+  for (const scheme of ['http', 'https', 'https'])
+    steps.push((next) => get(agent, '/scheme', next, { ':scheme': scheme }));
+
+  (function run() {
+    const step = steps.shift();
+    if (step === undefined) {
+      assert.strictEqual(counts['/'], 1);
+      assert.strictEqual(counts['/scheme'], 2);
+      assert.strictEqual(counts['/buffer'], 1);
+      assert.strictEqual(counts['/trailers'], 2);
+      assert.strictEqual(counts['/no-store'], 2);
+      agent.destroy();
+      server.close();
+      return;
+    }
+    step(run);
+  })();
+}));
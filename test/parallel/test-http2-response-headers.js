@@ -0,0 +1,70 @@
+'use strict';
+
+// Tests that header names rejected by the native layer are reported
+// synchronously by the call that sends the headers, which resets the
+// stream, and that names are lowercased and values sent as strings.
+
+const common = require('../common');
+const assert = require('assert');
+const http2 = require('http').HTTP2;
+
+const constants = http2.constants;
+
+function assertRejected(res, name, value, code) {
+  res.setHeader(name, value);
+  assert.throws(() => res.end('rejected'), (err) => {
+    return err.code === code && err.message === http2.nghttp2ErrorString(code);
+  });
+}
+
+const server = http2.createServer(common.mustCall((req, res) => {
+  assert.throws(() => res.setHeader(':status', '200'),
+                /Cannot set HTTP\/2 pseudo-headers/);
+  switch (req.url) {
+    case '/connection':
+      assertRejected(res, 'Connection', 'close',
+                     constants.HTTP2_ERR_CONNECTION_SPECIFIC_HEADER);
+      return;
+    case '/te':
+      assertRejected(res, 'te', 'gzip',
+                     constants.HTTP2_ERR_CONNECTION_SPECIFIC_HEADER);
+      return;
+    case '/name':
+      assertRejected(res, 'x y', 'z', constants.HTTP2_ERR_INVALID_HEADER_NAME);
+      return;
+  }
+  res.setHeader('te', 'trailers');
+  res.setHeader('X-Number', 42);
+  res.setHeader('x-list', [1, 2]);
+  assert.strictEqual(res.getHeader('x-number'), 42);
+  res.end('ok');
+}, 4));
+
+server.listen(0, common.mustCall(() => {
+  const agent = new http2.Http2Agent();
+  const port = server.address().port;
+  var remaining = 4;
+
+  function done() {
+    if (--remaining > 0)
+      return;
+    agent.destroy();
+    server.close();
+  }
+
+  for (const path of ['/connection', '/te', '/name']) {
+    http2.get({ port, path, agent }, common.mustCall(() => {}, 0))
+      .on('error', common.mustCall((err) => {
+        assert.strictEqual(err.code, constants.NGHTTP2_INTERNAL_ERROR);
+        done();
+      }));
+  }
+
+  http2.get({ port, path: '/', agent }, common.mustCall((res) => {
+    assert.strictEqual(res.status, 200);
+    assert.strictEqual(res.headers.get('x-number'), '42');
+    assert.deepStrictEqual(res.headers.get('x-list'), ['1', '2']);
+    res.resume();
+    res.on('end', common.mustCall(done));
+  }));
+}));
@@ -0,0 +1,63 @@
+'use strict';
+
+// Tests that every schedulingPolicy delivers concurrent responses in full,
+// that the strict policy finishes the more urgent of two responses first,
+// and that the schedulingQuantum option is validated.
+
+const common = require('../common');
+const assert = require('assert');
+const http2 = require('http').HTTP2;
+
+const body = Buffer.alloc(512 * 1024, 'x');
+
+assert.throws(() => http2.createServer({ schedulingPolicy: 'fastest' }),
+              TypeError);
+assert.throws(() => http2.createServer({ schedulingQuantum: 1 }),
+              RangeError);
+assert.throws(() => http2.createServer({ schedulingQuantum: 'big' }),
+              RangeError);
+http2.createServer({
+  schedulingQuantum: http2.constants.HTTP2_MIN_SCHEDULING_QUANTUM
+});
+
+function test(schedulingPolicy, callback) {
+  const server = http2.createServer({
+    schedulingPolicy,
+    schedulingQuantum: 4096
+  }, common.mustCall((req, res) => {
+    res.setPriority(req.url === '/urgent' ? 0 : 7);
+    res.end(body);
+  }, 2));
+
+  server.listen(0, common.mustCall(() => {
+    const agent = new http2.Http2Agent();
+    const port = server.address().port;
+    const finished = [];
+
+    // The less urgent request is made first, so that its response starts
+    // sending first
+    for (const path of ['/background', '/urgent']) {
+      http2.get({ port, path, agent }, common.mustCall((res) => {
+        var received = 0;
+        res.on('data', (chunk) => received += chunk.length);
+        res.on('end', common.mustCall(() => {
+          assert.strictEqual(received, body.length);
+          finished.push(path);
+          if (finished.length < 2)
+            return;
+          if (schedulingPolicy === 'strict')
+            assert.deepStrictEqual(finished, ['/urgent', '/background']);
+          agent.destroy();
+          server.close(callback);
+        }));
+      }));
+    }
+  }));
+}
+
+const policies = ['priority-tree', 'strict', 'weighted-fair', 'round-robin'];
+(function next() {
+  const policy = policies.shift();
+  if (policy !== undefined)
+    test(policy, common.mustCall(next));
+})();
@@ -0,0 +1,48 @@
+'use strict';
+
+// Tests that the resources registered with server.addPush() are promised
+// ahead of the response to their trigger.
+
+const common = require('../common');
+const assert = require('assert');
+const http2 = require('http').HTTP2;
+
+const server = http2.createServer(common.mustCall((req, res) => {
+  res.end('page');
+}));
+
+assert.throws(() => server.addPush('page', '/a.txt', { body: 'a' }),
+              /trigger must be a string starting with "\/"/);
+assert.throws(() => server.addPush('/', 'a.txt', { body: 'a' }),
+              /path must be a string starting with "\/"/);
+
+server.addPush('/', '/pushed.txt', {
+  body: 'pushed',
+  headers: { 'content-type': 'text/plain' }
+});
+server.addPush('/', '/pushed.js', {
+  file: __filename,
+  headers: { 'content-type': 'application/javascript' }
+});
+
+server.listen(0, common.mustCall(() => {
+  const agent = new http2.Http2Agent();
+  const promised = [];
+  agent.on('session', common.mustCall((client) => {
+    client.session.on('headers-complete', (stream, finished, headers) => {
+      const path = headers.get(':path');
+      if (stream.id % 2 === 0 && path !== undefined)
+        promised.push(path);
+    });
+  }));
+  http2.get({ port: server.address().port, path: '/', agent },
+            common.mustCall((res) => {
+              res.resume();
+              res.on('end', common.mustCall(() => {
+                assert.deepStrictEqual(promised.sort(),
+                                       ['/pushed.js', '/pushed.txt']);
+                agent.destroy();
+                server.close();
+              }));
+            }));
+}));
@@ -0,0 +1,34 @@
+'use strict';
+
+// Tests that a write that would take the session over its maxSessionMemory
+// limit resets the stream, and fails with an error that is passed to the
+// write callback and emitted on the response.
+
+const common = require('../common');
+const assert = require('assert');
+const http2 = require('http').HTTP2;
+
+const maxSessionMemory = 256 * 1024;
+
+const server = http2.createServer({
+  maxSessionMemory
+}, common.mustCall((req, res) => {
+  res.on('error', common.mustCall((err) => {
+    assert(/maxSessionMemory/.test(err.message));
+    assert(err.code < 0);
+  }));
+  res.write(Buffer.alloc(maxSessionMemory * 2), common.mustCall((err) => {
+    assert(err instanceof Error);
+  }));
+}));
+
+server.listen(0, common.mustCall(() => {
+  const agent = new http2.Http2Agent();
+  const port = server.address().port;
+  http2.get({ port, path: '/', agent }, common.mustCall(() => {}, 0))
+    .on('error', common.mustCall((err) => {
+      assert.strictEqual(err.code, http2.constants.NGHTTP2_ENHANCE_YOUR_CALM);
+      agent.destroy();
+      server.close();
+    }));
+}));
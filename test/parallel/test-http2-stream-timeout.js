@@ -0,0 +1,60 @@
+'use strict';
+
+// Tests that the stream deadlines reset only the stream that timed out,
+// and that request.setTimeout() applies to the stream, not the socket.
+
+const common = require('../common');
+const assert = require('assert');
+const http2 = require('http').HTTP2;
+
+const server = http2.createServer({
+  streamIdleTimeout: common.platformTimeout(200)
+}, common.mustCall((req, res) => {
+  switch (req.url) {
+    case '/set-timeout':
+      // Overrides the streamIdleTimeout option
+      req.setTimeout(common.platformTimeout(50), common.mustCall(() => {
+        assert.strictEqual(req.stream.id > 0, true);
+      }));
+      res.on('timeout', common.mustCall(() => {}));
+      break;
+    case '/idle':
+      // Neither answered nor given a timeout of its own
+      res.on('timeout', common.mustCall(() => {}));
+      break;
+    default:
+      res.end('ok');
+  }
+}, 3));
+
+server.listen(0, common.mustCall(() => {
+  const agent = new http2.Http2Agent();
+  const port = server.address().port;
+  var remaining = 2;
+
+  function timedOut(err) {
+    assert.strictEqual(err.code, http2.constants.NGHTTP2_CANCEL);
+    if (--remaining > 0)
+      return;
+    // The session is still usable once both streams have timed out
+    http2.get({ port, path: '/', agent }, common.mustCall((res) => {
+      assert.strictEqual(res.status, 200);
+      res.resume();
+      res.on('end', common.mustCall(() => {
+        assert.strictEqual(agent.sessions.size, 1);
+        agent.destroy();
+        server.close();
+      }));
+    }));
+  }
+
+  const start = Date.now();
+  const noResponse = common.mustCall(() => {}, 0);
+  http2.get({ port, path: '/set-timeout', agent }, noResponse)
+    .on('error', common.mustCall((err) => {
+      assert(Date.now() - start < common.platformTimeout(200));
+      timedOut(err);
+    }));
+  http2.get({ port, path: '/idle', agent }, noResponse)
+    .on('error', common.mustCall(timedOut));
+}));